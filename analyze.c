@@ -0,0 +1,251 @@
+#include "analyze.h"
+
+static inline void setBit(unsigned char *bits, unsigned int addr) {
+	bits[(addr & MEMORY_MASK) >> 3] |= 1 << (addr & 7);
+}
+
+typedef struct walker {
+	const unsigned char *program;
+	unsigned int size;
+	Analysis *result;
+	unsigned short stack[ANALYSIS_SPACE];	/* Blocks left to walk, each address is queued once */
+	unsigned int sp;
+	unsigned char queued[ANALYSIS_SPACE / 8];
+	int mega;		/* Decode 0NNN as MegaChip instructions */
+	int chip8x;		/* Decode BXYN and 02A0 as CHIP-8X colors */
+	unsigned int base;	/* Address the program is loaded at */
+} Walker;
+
+/* Instruction word at addr, -1 outside of the program (memory the program can only fill at run time) */
+static int fetch(const Walker *w, unsigned int addr) {
+	if (addr < w->base || addr + 2 > w->base + w->size)
+		return -1;
+	return w->program[addr - w->base] << 8 | w->program[addr - w->base + 1];
+}
+
+/* Starts a new block at addr and walks it later */
+static void branch(Walker *w, unsigned int addr) {
+	addr &= MEMORY_MASK;
+	setBit(w->result->leaders, addr);
+	if (!analysisBit(w->queued, addr)) {
+		setBit(w->queued, addr);
+		w->stack[w->sp++] = addr;
+	}
+}
+
+/* Both outcomes of a skip: the next instruction, or the one after it (XO-CHIP skips F000 NNNN whole) */
+static void skip(Walker *w, unsigned int next) {
+	branch(w, next);
+	branch(w, next + (fetch(w, next) == 0xF000 ? 4 : 2));
+}
+
+static int validArithmetic(unsigned int op) {
+	switch (op & 0x000F) {
+		case 0x0: case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xE:
+			return 1;
+	}
+	return 0;
+}
+
+/* Walks straight-line code from addr until a block ends, queuing the other paths */
+static void walkBlock(Walker *w, unsigned int addr) {
+	Analysis *result = w->result;
+	int op;
+
+	while ((op = fetch(w, addr)) >= 0 && !analysisBit(result->code, addr)) {
+		unsigned int next = addr + 2, nnn = op & 0x0FFF;
+		switch (op >> 12) {
+			case 0x0:
+				if (op == 0x00EE || op == 0x00FD) {	/* Return, or SUPER-CHIP exit */
+					if (op == 0x00FD)
+						result->variants |= VARIANT_SCHIP;
+					next = 0;
+				} else if ((op & 0xFFF0) == 0x00C0 || op == 0x00FB || op == 0x00FC || op == 0x00FE || op == 0x00FF) {
+					result->variants |= VARIANT_SCHIP;	/* Scrolls and resolution switches */
+				} else if ((op & 0xFFF0) == 0x00D0) {
+					result->variants |= VARIANT_XOCHIP;	/* Scroll up */
+				} else if (op == 0x0010) {
+					result->variants |= VARIANT_MEGACHIP;	/* MegaChip mode on */
+				} else if (w->mega && (op & 0xFF00) == 0x0100) {
+					next = addr + 4;	/* 24-bit I load, NNNN follows */
+				} else if (w->mega && (op == 0x0011 || (op & 0xFFF0) == 0x00B0 || (op >= 0x0200 && op < 0x0A00))) {
+					/* Other MegaChip instructions */
+				} else if (op == 0x0230 && (result->variants & VARIANT_HIRES)) {
+					/* Clears the hires screen */
+				} else if (op == 0x02A0 && w->chip8x) {
+					/* Next background color */
+				} else if (op != 0x00E0) {
+					result->variants |= VARIANT_MACHINE_CODE;
+					if (result->first_machine_call == 0)
+						result->first_machine_call = addr;
+				}
+				break;
+			case 0x1:
+				if (addr == 0x200 && op == 0x1260) {
+					/* Two-page hires boot: 0x202-0x2BF is the 1802 code switching the VIP to 64x64 */
+					result->variants |= VARIANT_HIRES;
+					result->entry = 0x2C0;
+					nnn = 0x2C0;
+				}
+				setBit(result->leaders, nnn);
+				next = nnn;
+				break;
+			case 0x2:
+				branch(w, nnn);
+				branch(w, next);	/* Return point */
+				break;
+			case 0x3: case 0x4:
+				skip(w, next);
+				next = 0;
+				break;
+			case 0x5:
+				if ((op & 0x000F) == 0x0) {
+					skip(w, next);
+					next = 0;
+				} else if ((op & 0x000F) == 0x2 || (op & 0x000F) == 0x3) {
+					result->variants |= VARIANT_XOCHIP;	/* Save and load a range of registers */
+				} else if ((op & 0x000F) == 0x1) {
+					result->variants |= VARIANT_CHIP8X;	/* Nibble-wise add */
+				} else {
+					op = -1;
+				}
+				break;
+			case 0x8:
+				if (!validArithmetic(op))
+					op = -1;
+				break;
+			case 0x9:
+				if ((op & 0x000F) == 0x0) {
+					skip(w, next);
+					next = 0;
+				} else {
+					op = -1;
+				}
+				break;
+			case 0xB:
+				if (w->chip8x)
+					break;	/* Color zones */
+				result->indirect++;
+				branch(w, nnn);
+				next = 0;
+				break;
+			case 0xD:
+				if ((op & 0x000F) == 0x0)
+					result->variants |= VARIANT_SCHIP;	/* 16x16 sprite */
+				break;
+			case 0xE:
+				if ((op & 0x00FF) == 0x9E || (op & 0x00FF) == 0xA1) {
+					skip(w, next);
+					next = 0;
+				} else if ((op & 0x00FF) == 0xF2 || (op & 0x00FF) == 0xF5) {
+					result->variants |= VARIANT_CHIP8X;	/* Second keypad */
+					skip(w, next);
+					next = 0;
+				} else {
+					op = -1;
+				}
+				break;
+			case 0xF:
+				switch (op & 0x00FF) {
+					case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x33: case 0x55: case 0x65:
+						break;
+					case 0x30: case 0x75: case 0x85:	/* Large font, RPL flags */
+						result->variants |= VARIANT_SCHIP;
+						break;
+					case 0x00:
+						if (op != 0xF000) {
+							op = -1;
+							break;
+						}
+						result->variants |= VARIANT_XOCHIP;	/* Long I load, NNNN follows */
+						next = addr + 4;
+						break;
+					case 0x01: case 0x3A:	/* Bitplane selection, pitch */
+						result->variants |= VARIANT_XOCHIP;
+						break;
+					case 0xF8: case 0xFB:	/* Sound and input ports */
+						result->variants |= VARIANT_CHIP8X;
+						break;
+					case 0x02:
+						if (op != 0xF002) {
+							op = -1;
+							break;
+						}
+						result->variants |= VARIANT_XOCHIP;	/* Audio pattern */
+						break;
+					default:
+						op = -1;
+				}
+				break;
+		}
+		if (op < 0) {
+			result->unknown++;
+			return;
+		}
+		setBit(result->code, addr);
+		result->instructions++;
+		if (next == 0)
+			return;
+		addr = next & MEMORY_MASK;
+	}
+}
+
+void analyzeProgram(const unsigned char *program, unsigned int size, Analysis *result) {
+	static __thread Walker w;
+	memset(result, 0, sizeof(Analysis));
+	memset(w.queued, 0, sizeof(w.queued));
+	w.program = program;
+	w.size = size < MAX_PROGRAM_SIZE ? size : MAX_PROGRAM_SIZE;
+	w.result = result;
+	w.mega = 0;
+	w.chip8x = 0;
+	w.base = 0x200;
+	for (;;) {
+		w.sp = 0;
+		result->entry = w.base;
+		branch(&w, w.base);
+		while (w.sp > 0) {
+			walkBlock(&w, w.stack[--w.sp]);
+		}
+
+		/* 0NNN calls machine code unless the program turns the MegaChip mode on, in which case it
+		 * is walked again with 0100-09FF as MegaChip instructions (0100 being 4 bytes long). CHIP-8X
+		 * programs, recognized by the instructions only they have, are walked again from 0x300 with
+		 * BXYN coloring instead of jumping */
+		if ((result->variants & VARIANT_MEGACHIP) && !w.mega) {
+			w.mega = 1;
+		} else if ((result->variants & VARIANT_CHIP8X) && !w.chip8x && !w.mega) {
+			w.chip8x = 1;
+			w.base = programBase(VARIANT_CHIP8X);
+			w.size = size < MEMORY_MASK + 1 - w.base ? size : MEMORY_MASK + 1 - w.base;
+		} else {
+			break;
+		}
+		memset(result, 0, sizeof(Analysis));
+		memset(w.queued, 0, sizeof(w.queued));
+		if (w.chip8x)
+			result->variants = VARIANT_CHIP8X;
+	}
+	if (result->variants & (VARIANT_XOCHIP | VARIANT_MEGACHIP))
+		result->variants |= VARIANT_SCHIP;	/* XO-CHIP and MegaChip extend SUPER-CHIP */
+	if (size > MAX_PROGRAM_SIZE && !(result->variants & (VARIANT_MEGACHIP | VARIANT_CHIP8X)))
+		result->variants |= VARIANT_XOCHIP | VARIANT_SCHIP;	/* Only fits in XO-CHIP's 64kiB */
+}
+
+unsigned int programVariants(const unsigned char *program, unsigned int size) {
+	static __thread Analysis result;
+	analyzeProgram(program, size, &result);
+	return result.variants;
+}
+
+void formatVariants(unsigned int variants, char *buf, unsigned int len) {
+	static const char *names[] = {"hires", "schip", "xochip", "machine-code", "megachip", "chip8x"};
+	unsigned int i, used = 0;
+	if (variants & (VARIANT_XOCHIP | VARIANT_MEGACHIP))
+		variants &= ~VARIANT_SCHIP;	/* Implied */
+	snprintf(buf, len, "chip8");
+	for (i = 0; i < sizeof(names) / sizeof(names[0]) && used < len; i++) {
+		if (variants & (1 << i))
+			used += snprintf(buf + used, len - used, "%s%s", used ? "," : "", names[i]);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "chip8.h"
+
+/* Static analysis of a program: its reachable code is walked from its entry without running it, following
+ * jumps, calls and both sides of every skip, to find the instruction-set variant it was written for.
+ * Data is never decoded unless the code flows into it, so sprites that happen to look like SUPER-CHIP
+ * opcodes do not count. BNNN jumps depend on V0 and are only followed to NNN itself. Only the first 4kiB
+ * are walked, programs larger than that are XO-CHIP's anyway */
+
+#define ANALYSIS_SPACE (MEMORY_MASK + 1)
+
+typedef struct analysis {
+	unsigned int variants;		/* VARIANT_* flags */
+	unsigned int instructions;	/* Reachable instructions */
+	unsigned int unknown;		/* Reachable words that decode to no instruction, where the walk stopped */
+	unsigned int indirect;		/* BNNN jumps, whose other targets are unknown */
+	unsigned short entry;		/* First instruction: 0x200, 0x300 for CHIP-8X, or 0x2C0 for the hires boot convention */
+	unsigned short first_machine_call;	/* Address of the first 0NNN call to machine code, 0 if none */
+	unsigned char code[ANALYSIS_SPACE / 8];	/* Bit set: an instruction starts at this address */
+	unsigned char leaders[ANALYSIS_SPACE / 8];	/* Bit set: jump, call or skip target, or entry (starts a block) */
+} Analysis;
+
+void analyzeProgram(const unsigned char *program, unsigned int size, Analysis *result);
+unsigned int programVariants(const unsigned char *program, unsigned int size);	/* Just analyzeProgram()'s variants */
+void formatVariants(unsigned int variants, char *buf, unsigned int len);	/* "chip8" when there is none */
+
+static inline int analysisBit(const unsigned char *bits, unsigned int addr) {
+	return (bits[(addr & MEMORY_MASK) >> 3] >> (addr & 7)) & 1;
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "chip8.h"
+#include "analyze.h"
+#include "megachip.h"
+#include "cosmac.h"
 
 /* Font set - 4px wide and 5px high */
 unsigned char chip8_fontset[80] = {
@@ -20,6 +23,178 @@ unsigned char chip8_fontset[80] = {
 	0xF0, 0x80, 0xF0, 0x80, 0x80  /* F */
 };
 
+/* Large font set (SUPER-CHIP, A to F from XO-CHIP) - 8px wide and 10px high */
+unsigned char chip8_big_fontset[160] = {
+	0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, /* 0 */
+	0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, /* 1 */
+	0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, /* 2 */
+	0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, /* 3 */
+	0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, /* 4 */
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, /* 5 */
+	0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, /* 6 */
+	0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, /* 7 */
+	0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, /* 8 */
+	0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, /* 9 */
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, /* A */
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, /* B */
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, /* C */
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, /* D */
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, /* E */
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  /* F */
+};
+
+/* Page shared by every instance for untouched memory; its own reference keeps it from being written or freed */
+static MemPage zero_page = { 1, {0} };
+
+static void releasePage(MemPage *page) {
+	if (__atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(page);
+}
+
+MemPage *unsharePage(Chip8 *chip, unsigned int page) {
+	MemPage *copy = malloc(sizeof(MemPage));
+	if (copy == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	copy->refs = 1;
+	memcpy(copy->data, chip->pages[page]->data, MEM_PAGE_SIZE);
+	releasePage(chip->pages[page]);
+	chip->pages[page] = copy;
+	return copy;
+}
+
+static MemPage **allocPageTable(unsigned int count) {
+	MemPage **pages = malloc(count * sizeof(MemPage *));
+	if (pages == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	return pages;
+}
+
+void chip8_fork(Chip8 *dst, const Chip8 *src) {
+	unsigned int i;
+	*dst = *src;
+	if (src->pages == src->small_pages) {
+		dst->pages = dst->small_pages;
+	} else {
+		dst->pages = allocPageTable(memPages(src));
+		memcpy(dst->pages, src->pages, memPages(src) * sizeof(MemPage *));
+	}
+	if (src->mega != NULL)
+		dst->mega = megaClone(src->mega);
+	for (i = 0; i < memPages(dst); i++) {
+		__atomic_add_fetch(&dst->pages[i]->refs, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* XO-CHIP and MegaChip programs get their larger address space (mask + 1 bytes): the pages past the
+ * first 4kiB start as the zero page */
+static void growMemory(Chip8 *chip, unsigned int mask) {
+	unsigned int i, count = (mask + 1) >> MEM_PAGE_SHIFT;
+	if (chip->pages != chip->small_pages)
+		return;
+	chip->pages = allocPageTable(count);
+	memcpy(chip->pages, chip->small_pages, MEM_PAGES * sizeof(MemPage *));
+	memset(chip->small_pages, 0, sizeof(chip->small_pages));	/* Moved, not shared */
+	for (i = MEM_PAGES; i < count; i++) {
+		chip->pages[i] = &zero_page;
+	}
+	__atomic_add_fetch(&zero_page.refs, count - MEM_PAGES, __ATOMIC_RELAXED);
+	chip->mem_mask = mask;
+}
+
+/* Memory and state of the variant the program needs beyond CHIP-8's, for the loaders */
+static void growVariant(Chip8 *chip, unsigned int variants) {
+	if (variants & VARIANT_MEGACHIP) {
+		growMemory(chip, MEGA_MEMORY_MASK);
+		if (chip->mega == NULL)
+			chip->mega = megaCreate();
+	} else if (variants & VARIANT_XOCHIP) {
+		growMemory(chip, XO_MEMORY_MASK);
+	}
+}
+
+Chip8 *chip8_clone(const Chip8 *src) {
+	Chip8 *chip = malloc(sizeof(Chip8));
+	if (chip != NULL) {
+		chip8_fork(chip, src);
+	}
+	return chip;
+}
+
+void chip8_release(Chip8 *chip) {
+	unsigned int i;
+	if (chip->pages == NULL)	/* Zeroed, never initialized */
+		return;
+	for (i = 0; i < memPages(chip); i++) {
+		if (chip->pages[i] != NULL) {
+			releasePage(chip->pages[i]);
+			chip->pages[i] = NULL;
+		}
+	}
+	if (chip->pages != chip->small_pages)
+		free(chip->pages);
+	chip->pages = chip->small_pages;
+	chip->mem_mask = MEMORY_MASK;
+	megaRelease(chip->mega);
+	chip->mega = NULL;
+	chip->mega_on = 0;
+}
+
+void chip8_free(Chip8 *chip) {
+	chip8_release(chip);
+	free(chip);
+}
+
+static unsigned long long hashBytes(unsigned long long h, const unsigned char *data, unsigned int len) {
+	unsigned long long word;
+	unsigned int i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&word, data + i, 8);
+		h = mix64(h ^ word);
+	}
+	for (; i < len; i++) {
+		h = mix64(h ^ data[i]);
+	}
+	return h;
+}
+
+static unsigned long long planeHash(const Chip8 *chip, unsigned int p) {
+	unsigned long long h = 0;
+	unsigned int y;
+	for (y = 0; y < chip->height; y++) {
+		h ^= gfxRowHash(p, y, chip->gfx[p][y]);
+	}
+	return h;
+}
+
+unsigned long long gfxHash(const Chip8 *chip) {
+	return planeHash(chip, 0) ^ planeHash(chip, 1);
+}
+
+/* Memory and framebuffer are hashed incrementally, only the registers are folded in here */
+unsigned long long chip8_hash(const Chip8 *chip) {
+	unsigned long long h = mix64(chip->mem_hash ^ mix64(chip8_gfx_hash(chip)));
+	h = hashBytes(h, chip->V, sizeof(chip->V));
+	h = hashBytes(h, chip->rpl, sizeof(chip->rpl));
+	h = hashBytes(h, chip->audio_pattern, sizeof(chip->audio_pattern));
+	h = hashBytes(h, (const unsigned char *)chip->stack, sizeof(chip->stack[0]) * (chip->sp <= 16 ? chip->sp : 16));
+	h = mix64(h ^ ((unsigned long long)chip->pc << 32 | chip->index_reg));
+	h = mix64(h ^ chip->rng);
+	h = mix64(h ^ ((unsigned long long)chip->planes << 56 | (unsigned long long)chip->pitch << 48 |
+			(unsigned long long)chip->width << 40 | (unsigned long long)chip->height << 32 |
+			chip->sp << 16 | chip->delay_timer << 8 | chip->sound_timer));
+	if (chip->mega != NULL)
+		h = mix64(h ^ megaHash(chip->mega) ^ chip->mega_on);
+	if (chip->variants & VARIANT_CHIP8X) {
+		h = hashBytes(h, &chip->zone_colors[0][0], sizeof(chip->zone_colors));
+		h = mix64(h ^ chip->background);
+	}
+	return h;
+}
+
 void initialize(Chip8 *chip) {
 	chip->pc = 0x200;	/* Program is loaded in address 0x200 */
 	chip->opcode = 0;	/* Reset current opcode */
@@ -27,24 +202,44 @@ void initialize(Chip8 *chip) {
 	chip->sp = 0;		/* Reset stack pointer */
 	chip->key_layout = 0;	/* QWERTY is the default keyboard */
 	chip->debug = 1;
-
-	srand(time(NULL));
+	chip->quirks = 0;
+	chip->variants = 0;
+	chip->rng = (unsigned int)time(NULL) | 1;	/* xorshift state must never be 0 */
 	
 	/* Clear display */
 	unsigned int i = 0;
-	for (i = 0; i < WIDTH*HEIGHT; i++) {
-		chip->gfx[i] = 0;
-	}
+	memset(chip->gfx, 0, sizeof(chip->gfx));
+	chip->width = WIDTH;
+	chip->height = HEIGHT;
+	chip->planes = 1;
+	chip->plane_hash[0] = chip->plane_hash[1] = 0;
+	chip->gfx_stale = 0;
+	chip->mem_hash = 0;
+	clearDirty(chip);
 	
 	/* Clear stack and registers */
 	for (i = 0; i < 16; i++) {
 		chip->stack[i] = 0;
 		chip->V[i] = 0;
+		chip->rpl[i] = 0;
 	}
 
-	/* Clear memory */
-	for (i = 0; i < 4096; i++) {
-		chip->memory[i] = 0;
+	/* CHIP-8X's colors after a reset: red on blue */
+	memset(chip->zone_colors, CHIP8X_RED, sizeof(chip->zone_colors));
+	chip->background = CHIP8X_BLUE;
+
+	/* Silent audio pattern at the default pitch (4000 Hz) */
+	memset(chip->audio_pattern, 0, sizeof(chip->audio_pattern));
+	chip->pitch = 64;
+
+	/* Clear memory: every page starts as the shared zero page, in 4kiB until an XO-CHIP program is loaded */
+	chip->pages = chip->small_pages;
+	chip->mem_mask = MEMORY_MASK;
+	chip->mega = NULL;
+	chip->mega_on = 0;
+	for (i = 0; i < MEM_PAGES; i++) {
+		__atomic_add_fetch(&zero_page.refs, 1, __ATOMIC_RELAXED);
+		chip->pages[i] = &zero_page;
 	}
 
 	/* Clear keypad */
@@ -54,7 +249,10 @@ void initialize(Chip8 *chip) {
 	
 	/* Load fontset */
 	for (i = 0; i < 80; i++) {
-		chip->memory[i] = chip8_fontset[i];
+		memWrite(chip, i, chip8_fontset[i]);
+	}
+	for (i = 0; i < 160; i++) {
+		memWrite(chip, BIG_FONT_ADDR + i, chip8_big_fontset[i]);
 	}
 
 	/* Reset timers */
@@ -62,37 +260,320 @@ void initialize(Chip8 *chip) {
 	chip->sound_timer = 0xFF;
 }
 
-int loadProgram(unsigned char memory[4096], char *filename) {
+void setScreenMode(Chip8 *chip, unsigned int width, unsigned int height) {
+	chip->width = width;
+	chip->height = height;
+	memset(chip->gfx, 0, sizeof(chip->gfx));
+	chip->plane_hash[0] = chip->plane_hash[1] = 0;
+	chip->gfx_stale = 0;
+	markAllDirty(chip);
+	chip->update_screen = 1;
+}
+
+/* Clears the selected planes (00E0) */
+static void clearPlanes(Chip8 *chip) {
+	unsigned int p;
+	for (p = 0; p < PLANES; p++) {
+		if (chip->planes & (1 << p)) {
+			memset(chip->gfx[p], 0, sizeof(chip->gfx[p]));
+			chip->plane_hash[p] = 0;
+			chip->gfx_stale &= ~(1 << p);
+		}
+	}
+	markAllDirty(chip);
+	chip->update_screen = 1;
+}
+
+/* SUPER-CHIP and XO-CHIP scrolls move whole rows of the selected planes with memmove() and shift
+ * the words of each row, in units of the current mode's pixels. Every row hash changes, so rather
+ * than rehashing the planes their hashes are left stale until someone asks for them
+ * (chip8_gfx_hash()) or the planes are cleared */
+static void scrolled(Chip8 *chip) {
+	chip->gfx_stale |= chip->planes & ((1 << PLANES) - 1);
+	markAllDirty(chip);
+	chip->update_screen = 1;
+}
+
+static void scrollDown(Chip8 *chip, unsigned int n) {
+	unsigned int height = chip->height, p;
+	if (n > height)
+		n = height;
+	for (p = 0; p < PLANES; p++) {
+		if (chip->planes & (1 << p)) {
+			memmove(chip->gfx[p][n], chip->gfx[p][0], (height - n) * sizeof(chip->gfx[p][0]));
+			memset(chip->gfx[p][0], 0, n * sizeof(chip->gfx[p][0]));
+		}
+	}
+	scrolled(chip);
+}
+
+static void scrollUp(Chip8 *chip, unsigned int n) {
+	unsigned int height = chip->height, p;
+	if (n > height)
+		n = height;
+	for (p = 0; p < PLANES; p++) {
+		if (chip->planes & (1 << p)) {
+			memmove(chip->gfx[p][0], chip->gfx[p][n], (height - n) * sizeof(chip->gfx[p][0]));
+			memset(chip->gfx[p][height - n], 0, n * sizeof(chip->gfx[p][0]));
+		}
+	}
+	scrolled(chip);
+}
+
+/* 4 pixels, to the right when right is set. Column of words by column of words, so that the inner
+ * loops over rows are straight shifts the compiler can vectorize */
+static void scrollPlaneSideways(unsigned long long (*gfx)[GFX_WORDS], unsigned int words, unsigned int height, int right) {
+	unsigned int y, i;
+	if (right) {
+		for (i = words - 1; i > 0; i--) {
+			for (y = 0; y < height; y++)
+				gfx[y][i] = gfx[y][i] >> 4 | gfx[y][i - 1] << 60;
+		}
+		for (y = 0; y < height; y++)
+			gfx[y][0] >>= 4;
+	} else {
+		for (i = 0; i + 1 < words; i++) {
+			for (y = 0; y < height; y++)
+				gfx[y][i] = gfx[y][i] << 4 | gfx[y][i + 1] >> 60;
+		}
+		for (y = 0; y < height; y++)
+			gfx[y][words - 1] <<= 4;
+	}
+}
+
+static void scrollSideways(Chip8 *chip, int right) {
+	unsigned int p;
+	for (p = 0; p < PLANES; p++) {
+		if (chip->planes & (1 << p))
+			scrollPlaneSideways(chip->gfx[p], chip->width >> 6, chip->height, right);
+	}
+	scrolled(chip);
+}
+
+/* Machine setup the program's variant expects before its first instruction */
+static void bootVariant(Chip8 *chip) {
+	if (chip->variants & VARIANT_HIRES) {
+		/* The two-page hires boot code at 0x202-0x2BF reconfigures the VIP's display for 64x64 */
+		setScreenMode(chip, 64, 64);
+		chip->pc = 0x2C0;
+	} else {
+		chip->pc = programBase(chip->variants);
+	}
+}
+
+int loadProgram(Chip8 *chip, char *filename) {
 	
 	FILE *fp = fopen(filename, "r");
 	if (fp == NULL) {
 		fprintf(stderr, "Program %s not found!\n", filename);
 		return 0;
 	}
-	unsigned int i = 0;
-	unsigned char current_byte = 0;
-	
-	/* Program is loaded starting at address 0x200 (512 in decimal) */
-	while (fread(&current_byte, sizeof(char), 1, fp) && i < 3584) {
-		memory[i + 0x200] = current_byte;
-		i++;
-	}
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (length > MAX_MEGA_PROGRAM_SIZE)
+		length = MAX_MEGA_PROGRAM_SIZE;
+	unsigned char *program = malloc(length > 0 ? length : 1);
+	unsigned int size = fread(program, 1, length, fp);
 
 	fclose(fp);
 	fp = NULL;
+	loadProgramBuffer(chip, program, size);
+	free(program);
 	printf("Program loaded into memory\n");
+	if (chip->variants != 0) {
+		char variants[64];
+		formatVariants(chip->variants, variants, sizeof(variants));
+		printf("Program written for %s\n", variants);
+	}
+	if (chip->quirks != 0) {
+		char quirks[64];
+		formatQuirks(chip->quirks, quirks, sizeof(quirks));
+		printf("Running with the %s quirks\n", quirks);
+	}
 	return 1;
 }
 
-void emulateCycle(Chip8 *chip) {
-	unsigned short pc = chip->pc; 
+void loadProgramBuffer(Chip8 *chip, const unsigned char *program, unsigned int size) {
+	unsigned int i, base;
+	if (size > MAX_MEGA_PROGRAM_SIZE)
+		size = MAX_MEGA_PROGRAM_SIZE;
+	chip->variants = programVariants(program, size);
+	growVariant(chip, chip->variants);
+	base = programBase(chip->variants);
+	if (size > chip->mem_mask + 1 - base)
+		size = chip->mem_mask + 1 - base;
+	/* Program is loaded starting at address 0x200 (512 in decimal), 0x300 for CHIP-8X */
+	for (i = 0; i < size; i++) {
+		memWrite(chip, i + base, program[i]);
+	}
+	chip->quirks = quirksForProgram(programHash(program, size), chip->variants);
+	bootVariant(chip);
+}
+
+static unsigned long long loadedHash(const unsigned char *program, unsigned int size, unsigned int base) {
+	unsigned long long hash = 0;
+	unsigned int i;
+	for (i = 0; i < size && i < MAX_MEGA_PROGRAM_SIZE; i++) {
+		hash += memHashTerm(i + base, program[i]);
+	}
+	return hash;
+}
+
+/* Contribution of a program loaded at 0x200 to mem_hash */
+unsigned long long programHash(const unsigned char *program, unsigned int size) {
+	return loadedHash(program, size, 0x200);
+}
+
+/* Fast path of loadProgramBuffer() for instances fresh from initialize(), whose program area is
+ * still zero: memory is copied a page at a time, the hash and variants come precomputed from
+ * programHash() and programVariants() */
+void loadProgramImage(Chip8 *chip, const unsigned char *program, unsigned int size, unsigned long long hash, unsigned int variants) {
+	unsigned int base = programBase(variants), addr = base, end;
+	growVariant(chip, variants);
+	if (size > chip->mem_mask + 1 - base) {
+		size = chip->mem_mask + 1 - base;
+		hash = programHash(program, size);	/* Of what fits */
+	}
+	end = base + size;
+	while (addr < end) {
+		unsigned int page = addr >> MEM_PAGE_SHIFT, offset = addr & (MEM_PAGE_SIZE - 1);
+		unsigned int len = MEM_PAGE_SIZE - offset < end - addr ? MEM_PAGE_SIZE - offset : end - addr;
+		MemPage *target = chip->pages[page];
+		if (__atomic_load_n(&target->refs, __ATOMIC_ACQUIRE) != 1)
+			target = unsharePage(chip, page);
+		memcpy(target->data + offset, program + (addr - base), len);
+		addr += len;
+	}
+	chip->mem_hash += base == 0x200 ? hash : loadedHash(program, size, base);
+	chip->variants = variants;
+	chip->quirks = quirksForProgram(hash, variants);
+	bootVariant(chip);
+}
+
+static const struct {
+	const char *name;
+	unsigned int quirks;
+} quirk_names[] = {
+	{"chip8", 0},
+	{"vip", QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_CLIP},
+	{"schip", QUIRK_CLIP | QUIRK_JUMP_VX},
+	{"xochip", QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I},
+	{"shift-vy", QUIRK_SHIFT_VY},
+	{"load-store", QUIRK_LOAD_STORE_I},
+	{"clip", QUIRK_CLIP},
+	{"jump-vx", QUIRK_JUMP_VX},
+};
+
+#define QUIRK_NAMES (sizeof(quirk_names) / sizeof(quirk_names[0]))
+#define QUIRK_PROFILES 4	/* The first names are whole profiles */
+
+/* ROMs of the collection that do not run with the default quirks */
+static const struct {
+	unsigned long long hash;	/* programHash() */
+	unsigned int quirks;
+} quirk_database[] = {
+	{0xC1589B5B40CCECBDULL, QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_CLIP},	/* Animal Race [Brian Astle] */
+	{0x0E0BA0F35345D2EDULL, QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_CLIP},	/* Shooting Stars [Philip Baltzer, 1978] */
+	{0x85406D5AB0433A5DULL, QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_CLIP},	/* Submarine [Carmelo Cortez, 1978] */
+	{0x0F6C00E21102C97DULL, QUIRK_CLIP},	/* Rocket Launch [Jonas Lindstedt]: its frame is drawn across the right edge */
+};
+
+/* Known ROMs first, then the profile of the platform the program was written for */
+unsigned int quirksForProgram(unsigned long long program_hash, unsigned int variants) {
+	unsigned int i;
+	for (i = 0; i < sizeof(quirk_database) / sizeof(quirk_database[0]); i++) {
+		if (quirk_database[i].hash == program_hash)
+			return quirk_database[i].quirks;
+	}
+	if (variants & VARIANT_XOCHIP)
+		return QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I;
+	if (variants & VARIANT_SCHIP)
+		return QUIRK_CLIP | QUIRK_JUMP_VX;
+	if (variants & (VARIANT_MACHINE_CODE | VARIANT_CHIP8X))	/* Only ever ran on the COSMAC VIP */
+		return QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_CLIP;
+	/* Most hires programs are recent and expect the usual behaviour, not the VIP's */
+	return 0;
+}
+
+int parseQuirks(const char *spec) {
+	unsigned int quirks = 0, i;
+	while (*spec != '\0') {
+		size_t len = strcspn(spec, ",");
+		for (i = 0; i < QUIRK_NAMES; i++) {
+			if (strlen(quirk_names[i].name) == len && strncmp(quirk_names[i].name, spec, len) == 0)
+				break;
+		}
+		if (i == QUIRK_NAMES) {
+			fprintf(stderr, "Unknown quirk %.*s\n", (int)len, spec);
+			return -1;
+		}
+		quirks |= quirk_names[i].quirks;
+		spec += len + (spec[len] == ',');
+	}
+	return quirks;
+}
+
+/* Profile name when the set matches one, the list of quirks otherwise */
+void formatQuirks(unsigned int quirks, char *buf, unsigned int len) {
+	unsigned int i, used = 0;
+	for (i = 0; i < QUIRK_PROFILES; i++) {
+		if (quirk_names[i].quirks == quirks) {
+			snprintf(buf, len, "%s", quirk_names[i].name);
+			return;
+		}
+	}
+	buf[0] = '\0';
+	for (i = QUIRK_PROFILES; i < QUIRK_NAMES && used < len; i++) {
+		if (quirks & quirk_names[i].quirks)
+			used += snprintf(buf + used, len - used, "%s%s", used ? "," : "", quirk_names[i].name);
+	}
+}
+
+/* 02A0 steps the CHIP-8X background through these */
+static const unsigned char chip8x_backgrounds[4] = {CHIP8X_BLUE, CHIP8X_BLACK, CHIP8X_GREEN, CHIP8X_RED};
+
+/* CHIP-8X BXYN: colors VY the zones of an area at VX and VX+1. BXY0 takes 8x4 zones, their first
+ * column and row in the low nibbles and how many more in the high ones; BXYN the N rows of 8x1
+ * zones under pixel (VX, VX+1). The area is clipped at the screen edges */
+static void colorZones(Chip8 *chip, unsigned int x, unsigned int y, unsigned int n) {
+	unsigned int h = chip->V[x], v = chip->V[(x + 1) & 0xF], col, row, col0, cols, row0, rows;
+	if (n == 0) {
+		col0 = h & 0xF;
+		cols = (h >> 4) + 1;
+		row0 = (v & 0xF) * CHIP8X_ZONE_HEIGHT;
+		rows = ((v >> 4) + 1) * CHIP8X_ZONE_HEIGHT;
+	} else {
+		col0 = h >> 3;
+		cols = 1;
+		row0 = v;
+		rows = n;
+	}
+	for (row = row0; row < row0 + rows && row < HEIGHT; row++) {
+		for (col = col0; col < col0 + cols && col < WIDTH / 8; col++) {
+			chip->zone_colors[row][col] = chip->V[y] & 7;
+		}
+	}
+	chip->update_screen = 1;
+}
+
+/* Address a skip at pc jumps to: past the next instruction, which is 4 bytes long for XO-CHIP's F000 NNNN */
+static inline unsigned short skipTarget(const Chip8 *chip, unsigned short pc) {
+	if ((chip->variants & VARIANT_XOCHIP) && memRead(chip, pc + 2) == 0xF0 && memRead(chip, pc + 3) == 0x00)
+		return pc + 6;
+	return pc + 4;
+}
+
+/* The interpreter, written once for every quirk combination: it is only ever inlined with quirks
+ * being a constant (see INTERPRETER below), so that the quirk tests disappear from the handlers */
+static inline __attribute__((always_inline)) void executeCycle(Chip8 *chip, const unsigned int quirks) {
+	unsigned short pc = chip->pc & chip->mem_mask; 
 	unsigned short opcode;
 	
 	unsigned char *V = chip->V;	
-	unsigned char *memory = chip->memory;	
 	
 	/* Fetch opcode */
-	chip->opcode = memory[pc] << 8 | memory[pc + 1];
+	chip->opcode = memRead(chip, pc) << 8 | memRead(chip, pc + 1);
 	opcode = chip->opcode;
 
 	unsigned char x = ( (opcode & 0x0F00) >> 8 );
@@ -102,17 +583,18 @@ void emulateCycle(Chip8 *chip) {
 	/* Decode opcode of the general form 0xZNNN - except when noted otherwise */
         switch (opcode & 0xF000) {
 
-		case 0x0000: /* 3 possibilities */
-			switch (opcode & 0x00FF) {
-				case 0x00E0: /* CLS -- Clear the screen (0x00E0) */
+		case 0x0000: /* Screen and subroutine control, or a call to machine code */
+			switch (opcode) {
+				case 0x00E0: /* CLS -- Clear the screen (0x00E0), the selected planes of it */
 					if (chip->debug) {
 						printf("CLS\n");
 					}
 
-					for (loop = 0; loop < WIDTH * HEIGHT; loop++) {
-						chip->gfx[loop] = 0;
+					if (chip->mega_on) {
+						megaPresent(chip);
+					} else {
+						clearPlanes(chip);
 					}
-					chip->update_screen = 1;
 					pc += 2;
 					break;
 
@@ -130,7 +612,95 @@ void emulateCycle(Chip8 *chip) {
 					pc += 2;
 					break;
 
+				case 0x00FB: /* SCR -- Scroll the screen right by 4 pixels (SUPER-CHIP) */
+				case 0x00FC: /* SCL -- Scroll the screen left by 4 pixels (SUPER-CHIP) */
+					if (chip->debug) {
+						printf(opcode == 0x00FB ? "SCR\n" : "SCL\n");
+					}
+					if (chip->mega_on) {
+						megaScroll(chip, opcode == 0x00FB ? 4 : -4, 0);
+					} else {
+						scrollSideways(chip, opcode == 0x00FB);
+					}
+					pc += 2;
+					break;
+
+				case 0x00FD: /* EXIT -- Stop the interpreter (SUPER-CHIP): wait on this instruction forever */
+					if (chip->debug) {
+						printf("EXIT\n");
+					}
+					break;
+
+				case 0x00FE: /* LOW -- Back to the 64x32 mode, which clears the screen (SUPER-CHIP) */
+				case 0x00FF: /* HIGH -- Extended 128x64 mode, which clears the screen (SUPER-CHIP) */
+					if (chip->debug) {
+						printf(opcode == 0x00FF ? "HIGH\n" : "LOW\n");
+					}
+					if (opcode == 0x00FF) {
+						setScreenMode(chip, MAX_WIDTH, MAX_HEIGHT);
+					} else {
+						setScreenMode(chip, WIDTH, HEIGHT);
+					}
+					pc += 2;
+					break;
+
 				default: /* Call RCA 1802 program at address NNN*/ 
+					if ((opcode & 0xFFF0) == 0x00C0) { /* SCD N -- Scroll the screen down by N pixels (SUPER-CHIP) */
+						if (chip->debug) {
+							printf("SCD %x\n", opcode & 0x000F);
+						}
+						if (chip->mega_on) {
+							megaScroll(chip, 0, opcode & 0x000F);
+						} else {
+							scrollDown(chip, opcode & 0x000F);
+						}
+						pc += 2;
+						break;
+					}
+					if ((opcode & 0xFFF0) == 0x00D0) { /* SCU N -- Scroll the screen up by N pixels (XO-CHIP) */
+						if (chip->debug) {
+							printf("SCU %x\n", opcode & 0x000F);
+						}
+						scrollUp(chip, opcode & 0x000F);
+						pc += 2;
+						break;
+					}
+					if (opcode == 0x0230 && (chip->variants & VARIANT_HIRES)) {
+						/* Hires screen clear routine of the two-page hires interpreter */
+						if (chip->debug) {
+							printf("CLS (hires)\n");
+						}
+						setScreenMode(chip, chip->width, chip->height);
+						pc += 2;
+						break;
+					}
+					if (chip->mega != NULL && (loop = megaInstruction(chip, opcode, pc)) != 0) {
+						pc += loop;
+						break;
+					}
+					if (opcode == 0x02A0 && (chip->variants & VARIANT_CHIP8X)) {
+						/* Next background color (CHIP-8X) */
+						if (chip->debug) {
+							printf("BGCOL\n");
+						}
+						for (loop = 0; loop < 4; loop++) {
+							if (chip8x_backgrounds[loop] == chip->background)
+								break;
+						}
+						chip->background = chip8x_backgrounds[(loop + 1) & 3];
+						chip->update_screen = 1;
+						pc += 2;
+						break;
+					}
+					if ((chip->variants & VARIANT_MACHINE_CODE) && (opcode & 0x0FFF) >= 0x200) {
+						/* Machine code of a hybrid program, on the embedded 1802 (below 0x200 would be the
+						 * VIP's CHIP-8 interpreter itself) */
+						if (chip->debug) {
+							printf("SYS %x\n", opcode & 0x0FFF);
+						}
+						pc = machineCall(chip, opcode, pc);
+						break;
+					}
 					printf("[Error] SYS(0x%x) not implemented!\n", opcode & 0x0FFF);
 					pc += 2;
 			}
@@ -147,6 +717,11 @@ void emulateCycle(Chip8 *chip) {
 			if (chip->debug) {
 				printf("CALL 0x%x\n", opcode & 0x0FFF);
 			}
+			if (chip->sp >= 16) {
+				printf("Stack overflow!\n");
+				pc += 2;
+				break;
+			}
 			chip->stack[chip->sp] = pc;
 			(chip->sp)++;
 			pc = opcode & 0x0FFF;
@@ -157,7 +732,7 @@ void emulateCycle(Chip8 *chip) {
 				printf("SE V%x, %x\n", x, opcode & 0x00FF);
 			}
 			if (V[x] == (opcode & 0x00FF) ) {
-				pc += 4;
+				pc = skipTarget(chip, pc);
 			} else {
 				pc += 2;
 			}
@@ -168,23 +743,45 @@ void emulateCycle(Chip8 *chip) {
 				printf("SNE V%x, %x\n", x, opcode & 0x00FF);
 			}
 			if (V[x] != (opcode & 0x00FF) ) {
-				pc += 4;
+				pc = skipTarget(chip, pc);
 			} else {
 				pc += 2;
 			}
 			break;
 
 		case 0x5000: /* 0x5XY0 -- if (VX == VY): skip next instruction */
-			if (chip->debug) {
-				printf("SE V%x, V%x\n", x, y);
-			}
-			
 			if ( (opcode & 0x000F) == 0 ) {
+				if (chip->debug) {
+					printf("SE V%x, V%x\n", x, y);
+				}
 				if (V[x] == V[y] ) {
-					pc += 4;
+					pc = skipTarget(chip, pc);
 				} else {
 					pc += 2;
 				}
+			} else if ( (opcode & 0x000F) == 1 && (chip->variants & VARIANT_CHIP8X) ) {
+				/* 0x5XY1 -- VX += VY nibble by nibble, each sum modulo 8 (CHIP-8X) */
+				if (chip->debug) {
+					printf("ADD3 V%x, V%x\n", x, y);
+				}
+				V[x] = (((V[x] & 0x70) + (V[y] & 0x70)) & 0x70) | (((V[x] & 0x07) + (V[y] & 0x07)) & 0x07);
+				pc += 2;
+			} else if ( (opcode & 0x000F) == 2 || (opcode & 0x000F) == 3 ) {
+				/* 0x5XY2 / 0x5XY3 -- Store / load VX to VY, in that order even when X > Y, at index_reg
+				 * without moving it (XO-CHIP) */
+				int step = x <= y ? 1 : -1;
+				unsigned int count = (x <= y ? y - x : x - y) + 1;
+				if (chip->debug) {
+					printf((opcode & 0x000F) == 2 ? "LD [I], V%x-V%x\n" : "LD V%x-V%x, [I]\n", x, y);
+				}
+				for (loop = 0; loop < count; loop++) {
+					if ((opcode & 0x000F) == 2) {
+						memWrite(chip, chip->index_reg + loop, V[x + step * (int)loop]);
+					} else {
+						V[x + step * (int)loop] = memRead(chip, chip->index_reg + loop);
+					}
+				}
+				pc += 2;
 			} else {
 				printf("Unknown opcode: 0x%x\n", opcode);
 			}
@@ -266,10 +863,13 @@ void emulateCycle(Chip8 *chip) {
 					pc += 2;
 					break;
 
-				case 0x0006: /* VX = VX >> 1 and store the least significant bit of VX in VF */
+				case 0x0006: /* VX = VX >> 1 (VY >> 1 with QUIRK_SHIFT_VY) and store the least significant bit in VF */
 					if (chip->debug) {
 						printf("SHR V%x\n", x);
 					}
+					if (quirks & QUIRK_SHIFT_VY) {
+						V[x] = V[y];
+					}
 					V[0xF] = V[x] & 0x01;
 					V[x] >>= 1;
 					pc += 2;
@@ -288,10 +888,13 @@ void emulateCycle(Chip8 *chip) {
 					pc += 2;
 					break;
 
-				case 0x000E: /* VX = VX << 1 and store the least significant bit of VX in VF */
+				case 0x000E: /* VX = VX << 1 (VY << 1 with QUIRK_SHIFT_VY) and store the least significant bit in VF */
 					if (chip->debug) {
 						printf("SHL V%x\n", x);
 					}
+					if (quirks & QUIRK_SHIFT_VY) {
+						V[x] = V[y];
+					}
 					V[0xF] = V[x] & 0x01;
 					V[x] <<= 1;
 					pc += 2;
@@ -308,7 +911,7 @@ void emulateCycle(Chip8 *chip) {
 			}
 			if ( (opcode & 0x000F) == 0 ) {
 				if (V[x] != V[y] ) {
-					pc += 4;
+					pc = skipTarget(chip, pc);
 				} else {
 					pc += 2;
 				}
@@ -325,18 +928,29 @@ void emulateCycle(Chip8 *chip) {
 			pc += 2;
 			break;
 
-		case 0xB000: /* pc = V0 + NNN */
+		case 0xB000: /* pc = V0 + NNN, or VX + XNN with QUIRK_JUMP_VX */
+			if (chip->variants & VARIANT_CHIP8X) { /* 0xBXYN -- Color zones VY (CHIP-8X) */
+				if (chip->debug) {
+					printf("COL V%x, V%x, %x\n", x, y, opcode & 0x000F);
+				}
+				colorZones(chip, x, y, opcode & 0x000F);
+				pc += 2;
+				break;
+			}
 			if (chip->debug) {
-				printf("JP V0, %x\n", opcode & 0x0FFF);
+				printf("JP V%x, %x\n", (quirks & QUIRK_JUMP_VX) ? x : 0, opcode & 0x0FFF);
 			}
-			pc = V[0] + (opcode & 0x0FFF);
+			pc = V[(quirks & QUIRK_JUMP_VX) ? x : 0] + (opcode & 0x0FFF);
 			break;
 
 		case 0xC000: /* 0xCXNN -- VX = rand() & NN */
 			if (chip->debug) {
 				printf("RND V%x, %x\n", x, opcode & 0x00FF);
 			}
-			V[x] = (rand() % 256) & (opcode & 0x00FF);
+			chip->rng ^= chip->rng << 13;
+			chip->rng ^= chip->rng >> 17;
+			chip->rng ^= chip->rng << 5;
+			V[x] = (chip->rng & 0xFF) & (opcode & 0x00FF);
 			pc += 2;
 			break;
 
@@ -345,22 +959,73 @@ void emulateCycle(Chip8 *chip) {
 			if (chip->debug) {
 				printf("DRW V%x, V%x, %x\n", x, y, opcode & 0x000F);
 			}
-			unsigned char height = (opcode & 0x000F);
-			unsigned char sprite_row;
-			unsigned char xline = 0, yline = 0;
+			/* Each sprite row is shifted into place and XORed into the packed framebuffer a word at
+			 * a time, spilling into the next word (or wrapping around) past a word boundary. Every
+			 * selected plane gets its own sprite, stored one after the other from index_reg (XO-CHIP) */
+			if (chip->mega_on) { /* Palettized sprite of the size set by 03NN and 04NN (MegaChip) */
+				V[0xF] = megaDraw(chip, V[x], V[y]);
+				pc += 2;
+				break;
+			}
+			unsigned int height = (opcode & 0x000F), sprite_w = 8, yline, p, addr = chip->index_reg;
+			if (height == 0) { /* DXY0: 16x16 sprite, two bytes per row (SUPER-CHIP) */
+				height = 16;
+				sprite_w = 16;
+			}
+			unsigned int screen_w = chip->width, screen_h = chip->height;
+			unsigned int x_start = V[x] & (screen_w - 1), y_start = V[y] & (screen_h - 1);
+			unsigned int word = x_start >> 6, shift = x_start & 63;
+			unsigned int next_word = (word + 1) & ((screen_w >> 6) - 1);
+			int spill = shift > 64 - sprite_w && (!(quirks & QUIRK_CLIP) || next_word > word);
+			unsigned char drawn = 0;
 			V[0xF] = 0;
-			for (yline = 0; yline < height; yline++) { /* For each sprite row */
-
-				sprite_row = memory[chip->index_reg + yline]; /* Get sprite row */
-				for (xline = 0; xline < 8; xline++) { /* For each pixel in the row */
+			for (p = 0; p < PLANES; p++) {
+				if (!(chip->planes & (1 << p)))
+					continue;
+				int stale = chip->gfx_stale & (1 << p);
+				for (yline = 0; yline < height; yline++) { /* For each sprite row */
 
-					if ( (sprite_row & (0x80 >> xline)) != 0 ) { /* Check if the current evaluated pixel is set to 1 */
-						unsigned char x_pos = (V[x] + xline) % WIDTH;
-						unsigned char y_pos = (V[y] + yline) % HEIGHT;
-						if (chip->gfx[x_pos + (y_pos * WIDTH)] == 1 ) /* Check if the pixel on display is set to 1 */
-							V[0xF] = 1; /* Pixel collision occured */
-						chip->gfx[x_pos + (y_pos * WIDTH)] ^= 1;
+					unsigned int y_pos = y_start + yline;
+					if (quirks & QUIRK_CLIP) {
+						if (y_pos >= screen_h)
+							break;
+					} else {
+						y_pos &= screen_h - 1;
+					}
+					unsigned long long sprite_row; /* Get sprite row */
+					if (sprite_w == 16) {
+						unsigned int row_addr = addr + 2 * yline;
+						sprite_row = (unsigned long long)(memRead(chip, row_addr) << 8 | memRead(chip, row_addr + 1)) << 48;
+					} else {
+						sprite_row = (unsigned long long)memRead(chip, addr + yline) << 56;
 					}
+					if (sprite_row == 0)
+						continue;
+					unsigned long long *row = chip->gfx[p][y_pos];
+					unsigned long long low = sprite_row >> shift, high = spill ? sprite_row << (64 - shift) : 0;
+					unsigned long long old_hash = stale ? 0 : gfxRowHash(p, y_pos, row);
+					if ((row[word] & low) | (row[next_word] & high)) /* Check if a pixel on display is set where the sprite has one */
+						V[0xF] = 1; /* Pixel collision occured */
+					row[word] ^= low;
+					row[next_word] ^= high;
+					if (!stale)
+						chip->plane_hash[p] ^= old_hash ^ gfxRowHash(p, y_pos, row);
+					chip->dirty_rows |= 1ULL << y_pos;
+					drawn = 1;
+				}
+				addr += height * (sprite_w >> 3);
+			}
+			if (drawn) {
+				/* Column span of the sprite, the whole width if it wraps around the right edge */
+				if (x_start + sprite_w - 1 >= screen_w && !(quirks & QUIRK_CLIP)) {
+					chip->dirty_x0 = 0;
+					chip->dirty_x1 = screen_w - 1;
+				} else {
+					unsigned int x_end = x_start + sprite_w - 1 < screen_w ? x_start + sprite_w - 1 : screen_w - 1;
+					if (x_start < chip->dirty_x0)
+						chip->dirty_x0 = x_start;
+					if (x_end > chip->dirty_x1)
+						chip->dirty_x1 = x_end;
 				}
 			}
 			chip->update_screen = 1;
@@ -372,8 +1037,8 @@ void emulateCycle(Chip8 *chip) {
 				if (chip->debug) {
 					printf("SKP V%x\n", x);
 				}
-				if (chip->keypad[V[x]] == 1) {
-					pc += 4;
+				if (chip->keypad[V[x] & 0xF] == 1) {
+					pc = skipTarget(chip, pc);
 				} else {
 					pc+= 2;
 				}
@@ -381,8 +1046,19 @@ void emulateCycle(Chip8 *chip) {
 				if (chip->debug) {
 					printf("SKNP V%x\n", x);
 				}
-				if (chip->keypad[V[x]] == 0) {
-					pc += 4;
+				if (chip->keypad[V[x] & 0xF] == 0) {
+					pc = skipTarget(chip, pc);
+				} else {
+					pc += 2;
+				}
+			} else if ( ((opcode & 0x00FF) == 0x00F2 || (opcode & 0x00FF) == 0x00F5) && (chip->variants & VARIANT_CHIP8X) ) {
+				/* 0xEXF2 / 0xEXF5 -- Skip if the key in VX of the second keypad is / is not pressed
+				 * (CHIP-8X): there is none, no key ever is */
+				if (chip->debug) {
+					printf((opcode & 0x00FF) == 0x00F2 ? "SKP2 V%x\n" : "SKNP2 V%x\n", x);
+				}
+				if ((opcode & 0x00FF) == 0x00F5) {
+					pc = skipTarget(chip, pc);
 				} else {
 					pc += 2;
 				}
@@ -393,6 +1069,40 @@ void emulateCycle(Chip8 *chip) {
 		
 		case 0xF000: /* 9 options of the form 0xFXZZ -- where ZZ defines the different cases */
 			switch (opcode & 0x00FF) {
+				case 0x0000: /* 0xF000 0xNNNN -- index_reg = NNNN, the word after the instruction (XO-CHIP) */
+					if (opcode != 0xF000) {
+						printf("Unknown opcode: 0x%x\n", opcode);
+						break;
+					}
+					chip->index_reg = memRead(chip, pc + 2) << 8 | memRead(chip, pc + 3);
+					if (chip->debug) {
+						printf("LD I, %x (long)\n", chip->index_reg);
+					}
+					pc += 4;
+					break;
+
+				case 0x0001: /* 0xFN01 -- Select the bitplanes N that drawing, clearing and scrolling affect (XO-CHIP) */
+					if (chip->debug) {
+						printf("PLANE %x\n", x);
+					}
+					chip->planes = x;
+					pc += 2;
+					break;
+
+				case 0x0002: /* 0xF002 -- Load the 16-byte audio pattern from index_reg (XO-CHIP) */
+					if (opcode != 0xF002) {
+						printf("Unknown opcode: 0x%x\n", opcode);
+						break;
+					}
+					if (chip->debug) {
+						printf("AUDIO\n");
+					}
+					for (loop = 0; loop < sizeof(chip->audio_pattern); loop++) {
+						chip->audio_pattern[loop] = memRead(chip, chip->index_reg + loop);
+					}
+					pc += 2;
+					break;
+
 				case 0x0007: /* Set VX to the value of delay_timer */
 					if (chip->debug) {
 						printf("LD V%x, DT\n", x);
@@ -433,7 +1143,7 @@ void emulateCycle(Chip8 *chip) {
 					if (chip->debug) {
 						printf("ADD I, V%x\n", x);
 					}
-					chip->index_reg += V[x];
+					chip->index_reg = (chip->index_reg + V[x]) & indexMask(chip);
 					pc += 2;
 					break;
 
@@ -445,35 +1155,94 @@ void emulateCycle(Chip8 *chip) {
 					pc += 2;
 					break;
 
+				case 0x0030: /* Set index_reg to the location of the large sprite for the digit in VX (SUPER-CHIP) */
+					if (chip->debug) {
+						printf("LD HF, V%x\n", x);
+					}
+					chip->index_reg = BIG_FONT_ADDR + (V[x] & 0xF) * 10;
+					pc += 2;
+					break;
+
 				case 0x0033: /* Store BCD representation of VX in memory locations index_reg, index_reg+1 and index_reg+2 */
 					if (chip->debug) {
 						printf("LD B,  V%x\n", x);
 					}
-					memory[chip->index_reg] = V[x] / 100;
-					memory[chip->index_reg+1] = (V[x] / 10) % 10;
-					memory[chip->index_reg+2] = (V[x] % 100) % 10;
+					memWrite(chip, chip->index_reg, V[x] / 100);
+					memWrite(chip, chip->index_reg+1, (V[x] / 10) % 10);
+					memWrite(chip, chip->index_reg+2, (V[x] % 100) % 10);
+					pc += 2;
+					break;
+
+				case 0x003A: /* Set the audio pattern's pitch to VX (XO-CHIP) */
+					if (chip->debug) {
+						printf("PITCH V%x\n", x);
+					}
+					chip->pitch = V[x];
 					pc += 2;
 					break;
 
-				case 0x0055: /* Store registers V0 through VX in memory starting at location index_reg */
+				case 0x0055: /* Store registers V0 through VX in memory starting at location index_reg (then past them with QUIRK_LOAD_STORE_I) */
 					if (chip->debug) {
 						printf("LD [I], V%x\n", x);
 					}
 					for (loop = 0; loop <= x; loop++) {
-						memory[chip->index_reg + loop] = V[loop];
+						memWrite(chip, chip->index_reg + loop, V[loop]);
+					}
+					if (quirks & QUIRK_LOAD_STORE_I) {
+						chip->index_reg = (chip->index_reg + x + 1) & indexMask(chip);
 					}
 					pc += 2;
 					break;
 
-				case 0x0065: /* Fill V0 to VX with values from memory starting at addr index_reg */
+				case 0x0065: /* Fill V0 to VX with values from memory starting at addr index_reg (then past them with QUIRK_LOAD_STORE_I) */
 					if (chip->debug) {
 						printf("LD V%x, [I]\n", x);
 					}
 					for (loop = 0; loop <= x; loop++) {
-						V[loop] = memory[chip->index_reg + loop];
+						V[loop] = memRead(chip, chip->index_reg + loop);
+					}
+					if (quirks & QUIRK_LOAD_STORE_I) {
+						chip->index_reg = (chip->index_reg + x + 1) & indexMask(chip);
 					}
 					pc += 2;
 					break;
+
+				case 0x00F8: /* Output VX to the sound board's tone port (CHIP-8X), which is not emulated */
+					if (!(chip->variants & VARIANT_CHIP8X)) {
+						printf("Unknown opcode: 0x%x\n", opcode);
+						break;
+					}
+					if (chip->debug) {
+						printf("OUT V%x\n", x);
+					}
+					pc += 2;
+					break;
+
+				case 0x00FB: /* Wait for a byte on the input port (CHIP-8X): nothing is connected, it never comes */
+					if (!(chip->variants & VARIANT_CHIP8X)) {
+						printf("Unknown opcode: 0x%x\n", opcode);
+						break;
+					}
+					if (chip->debug) {
+						printf("IN V%x\n", x);
+					}
+					break;
+
+				case 0x0075: /* Store V0 through VX in the RPL user flags (SUPER-CHIP) */
+					if (chip->debug) {
+						printf("LD R, V%x\n", x);
+					}
+					memcpy(chip->rpl, V, x + 1);
+					pc += 2;
+					break;
+
+				case 0x0085: /* Fill V0 to VX from the RPL user flags (SUPER-CHIP) */
+					if (chip->debug) {
+						printf("LD V%x, R\n", x);
+					}
+					memcpy(V, chip->rpl, x + 1);
+					pc += 2;
+					break;
 			}
 			break;
 	
@@ -483,19 +1252,102 @@ void emulateCycle(Chip8 *chip) {
 
        	}
 	
-	/* Update timers */
-	if (chip->delay_timer > 0) {
-		--(chip->delay_timer);
-	}
+	/* Update struct variable */
+	chip->pc = pc;
+}
 
-	if (chip->sound_timer > 0) {
-		if (chip->sound_timer == 1) {
-			//printf("BEEP\n");
-		}
-		--(chip->sound_timer);
+/* One specialized interpreter per quirk combination, each with the whole instruction loop inlined.
+ * The timers tick once per instruction */
+#define INTERPRETER(q) \
+	static void emulateFrame##q(Chip8 *chip, unsigned int cycles) { \
+		while (cycles--) { \
+			executeCycle(chip, q); \
+			tickTimers(chip); \
+		} \
 	}
+INTERPRETER(0) INTERPRETER(1) INTERPRETER(2) INTERPRETER(3)
+INTERPRETER(4) INTERPRETER(5) INTERPRETER(6) INTERPRETER(7)
+INTERPRETER(8) INTERPRETER(9) INTERPRETER(10) INTERPRETER(11)
+INTERPRETER(12) INTERPRETER(13) INTERPRETER(14) INTERPRETER(15)
 
-	/* Update struct variable */
-	chip->pc = pc;
+const FrameFunction chip8_interpreters[QUIRK_COMBINATIONS] = {
+	emulateFrame0, emulateFrame1, emulateFrame2, emulateFrame3,
+	emulateFrame4, emulateFrame5, emulateFrame6, emulateFrame7,
+	emulateFrame8, emulateFrame9, emulateFrame10, emulateFrame11,
+	emulateFrame12, emulateFrame13, emulateFrame14, emulateFrame15
+};
+
+void emulateCycle(Chip8 *chip) {
+	chip8_interpreters[chip->quirks & (QUIRK_COMBINATIONS - 1)](chip, 1);
 }
 
+void emulateFrame(Chip8 *chip, unsigned int cycles) {
+	chip8_interpreters[chip->quirks & (QUIRK_COMBINATIONS - 1)](chip, cycles);
+}
+
+/* Approximate machine cycles of the VIP's interpreter per instruction group, after published
+ * measurements of it. Groups whose cost depends on the operands are left to vipCycles() */
+#define VIP_FETCH_CYCLES 40	/* Fetch and dispatch, on top of every instruction */
+static const unsigned char vip_costs[16] = {
+	23,		/* 0NNN: RET, and calls to machine code whose own cycles are not counted */
+	23, 23,		/* Jump, call */
+	12, 12, 16,	/* Skips */
+	6, 10,		/* 6XNN, 7XNN */
+	44,		/* Arithmetic and logic */
+	16,		/* 9XY0 */
+	12, 23, 36,	/* ANNN, BNNN, CXNN */
+	68,		/* DXYN, then each row */
+	16,		/* Key skips */
+	10		/* Timers and key wait, the others in vipCycles() */
+};
+
+unsigned int vipCycles(const Chip8 *chip, unsigned short opcode) {
+	unsigned int x = (opcode >> 8) & 0xF, v = chip->V[x], cost = vip_costs[opcode >> 12];
+
+	switch (opcode >> 12) {
+		case 0x0:
+			if (opcode == 0x00E0)
+				cost = 24;
+			break;
+		case 0xD: /* Each row is shifted into place one bit at a time */
+			cost += (opcode & 0xF) * (20 + 4 * (v & 7));
+			break;
+		case 0xF:
+			switch (opcode & 0xFF) {
+				case 0x1E: cost = 19; break;
+				case 0x29: cost = 20; break;
+				case 0x33: cost = 44 + 16 * (v / 100 + v / 10 % 10 + v % 10); break;	/* Digits by repeated subtraction */
+				case 0x55: case 0x65: cost = 14 + 14 * (x + 1); break;
+			}
+			break;
+	}
+	return VIP_FETCH_CYCLES + cost;
+}
+
+/* VIP timing, specialized per quirk combination like the interpreters above */
+#define VIP_INTERPRETER(q) \
+	static int emulateVipCycles##q(Chip8 *chip, int *cycles) { \
+		while (*cycles > 0) { \
+			unsigned short opcode = memRead(chip, chip->pc) << 8 | memRead(chip, chip->pc + 1); \
+			*cycles -= vipCycles(chip, opcode); \
+			executeCycle(chip, q); \
+			if ((opcode & 0xF000) == 0xD000) \
+				return 1; \
+		} \
+		return 0; \
+	}
+VIP_INTERPRETER(0) VIP_INTERPRETER(1) VIP_INTERPRETER(2) VIP_INTERPRETER(3)
+VIP_INTERPRETER(4) VIP_INTERPRETER(5) VIP_INTERPRETER(6) VIP_INTERPRETER(7)
+VIP_INTERPRETER(8) VIP_INTERPRETER(9) VIP_INTERPRETER(10) VIP_INTERPRETER(11)
+VIP_INTERPRETER(12) VIP_INTERPRETER(13) VIP_INTERPRETER(14) VIP_INTERPRETER(15)
+
+static int (*const chip8_vip_interpreters[QUIRK_COMBINATIONS])(Chip8 *chip, int *cycles) = {
+	emulateVipCycles0, emulateVipCycles1, emulateVipCycles2, emulateVipCycles3,
+	emulateVipCycles4, emulateVipCycles5, emulateVipCycles6, emulateVipCycles7,
+	emulateVipCycles8, emulateVipCycles9, emulateVipCycles10, emulateVipCycles11,
+	emulateVipCycles12, emulateVipCycles13, emulateVipCycles14, emulateVipCycles15
+};
+
+int emulateVipCycles(Chip8 *chip, int *cycles) {
+	return chip8_vip_interpreters[chip->quirks & (QUIRK_COMBINATIONS - 1)](chip, cycles);
+}
@@ -1,21 +1,85 @@
-#define WIDTH 64
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#define WIDTH 64		/* Default screen mode */
 #define HEIGHT 32
+#define MAX_WIDTH 128		/* Largest screen mode (SUPER-CHIP), the size of the framebuffer */
+#define MAX_HEIGHT 64
+#define GFX_WORDS (MAX_WIDTH / 64)	/* 64-bit words per framebuffer row */
+#define PLANES 2		/* XO-CHIP bitplanes, plain programs only ever draw to the first */
+#define CYCLES_PER_FRAME 15	/* Instructions executed between two screen updates (900 per second at 60 fps) */
+#define MEMORY_MASK 0x0FFF	/* Addresses wrap around the 4kiB address space */
+#define XO_MEMORY_MASK 0xFFFF	/* or XO-CHIP's 64kiB */
+#define MEGA_MEMORY_MASK 0xFFFFFF	/* or MegaChip's 16MiB, addressed by its 24-bit I */
+#define MAX_PROGRAM_SIZE 3584	/* Bytes from 0x200 to the end of memory */
+#define MAX_XO_PROGRAM_SIZE 65024	/* Bytes from 0x200 to the end of XO-CHIP's memory, larger programs are XO-CHIP's */
+#define MAX_MEGA_PROGRAM_SIZE (MEGA_MEMORY_MASK + 1 - 0x200)
+#define BIG_FONT_ADDR 0x50	/* Large 8x10 font (FX30), right after the small one */
+
+/* Behaviours that differ between the interpreters ROMs were written for. Every combination runs on
+ * its own specialized interpreter (chip8_interpreters), the default is this emulator's original set */
+#define QUIRK_SHIFT_VY 0x1	/* 8XY6/8XYE shift VY into VX (COSMAC VIP) instead of shifting VX in place */
+#define QUIRK_LOAD_STORE_I 0x2	/* FX55/FX65 leave I past the last register (COSMAC VIP) instead of unchanged */
+#define QUIRK_CLIP 0x4		/* Sprites are clipped at the screen edges instead of wrapping around */
+#define QUIRK_JUMP_VX 0x8	/* BXNN jumps to XNN + VX (SUPER-CHIP) instead of BNNN to NNN + V0 */
+#define QUIRK_COMBINATIONS 16
+
+/* Instruction-set variants a program needs, found by analyzeProgram() (analyze.h) */
+#define VARIANT_HIRES 0x1		/* 64x64 two-page hires of the COSMAC VIP: boots with 1260, 0230 clears the screen */
+#define VARIANT_SCHIP 0x2		/* SUPER-CHIP: 128x64 mode, scrolls, 16x16 sprites, large font, RPL flags */
+#define VARIANT_XOCHIP 0x4		/* XO-CHIP: long I loads, bitplanes, audio patterns, register ranges */
+#define VARIANT_MACHINE_CODE 0x8	/* 0NNN calls to 1802 machine code */
+#define VARIANT_MEGACHIP 0x10		/* MegaChip8: 256x192 palettized screen, 24-bit I, samples (megachip.h) */
+#define VARIANT_CHIP8X 0x20		/* CHIP-8X: the VP-590 color board's zones and background, loaded at 0x300 */
+
+/* CHIP-8X colors, from the bits of the color RAM: 1 red, 2 blue, 4 green */
+#define CHIP8X_BLACK 0
+#define CHIP8X_RED 1
+#define CHIP8X_BLUE 2
+#define CHIP8X_GREEN 4
+#define CHIP8X_ZONE_HEIGHT 4	/* Rows of the zones BXY0 colors, BXYN colors single rows */
+
+/* Memory is split in pages that are shared copy-on-write between cloned instances */
+#define MEM_PAGE_SHIFT 8
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGES ((MEMORY_MASK + 1) >> MEM_PAGE_SHIFT)
+#define XO_MEM_PAGES ((XO_MEMORY_MASK + 1) >> MEM_PAGE_SHIFT)
 
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* short: 2 Bytes */
 /* char:  1 Byte  */
 
+typedef struct mem_page {
+	unsigned int refs;		/* Number of instances (plus owners like the zero page) using this page */
+	unsigned char data[MEM_PAGE_SIZE];
+} MemPage;
+
 typedef struct chip8 {
 	unsigned short opcode;		/* Stores the current opcode to be executed */		
-	unsigned char memory[4096];	/* 4kiB of memory */
+	MemPage **pages;		/* Page table of memory - read with memRead(), write with memWrite() */
+	unsigned int mem_mask;		/* MEMORY_MASK, or XO_MEMORY_MASK / MEGA_MEMORY_MASK once the program needs more */
+	MemPage *small_pages[MEM_PAGES];	/* Page table of a 4kiB instance, XO-CHIP's is allocated */
 	unsigned char V[16]; 		/* Indexes from 0 to 14 (V0, V1, ..., VE):  General purpose registers; index 15 (VF): carry flag */
-	unsigned short index_reg;	/* Index register */
+	unsigned int index_reg;		/* Index register, 16 bits but for MegaChip's 24 */
 	unsigned short pc;		/* Program Counter */
-	unsigned char gfx[WIDTH*HEIGHT];	/* Graphics matrix - Black and white screen of 2048 pixels (64x32) */
+	unsigned long long gfx[PLANES][MAX_HEIGHT][GFX_WORDS];	/* Graphics matrix - One bit per pixel and plane, leftmost pixel in the most significant bit: read with gfxPixel() */
+	unsigned char planes;		/* Bitplanes drawn to, cleared and scrolled (XO-CHIP's FN01), the first one by default */
+	unsigned char width, height;	/* Screen mode (64x32, 64x64 for the hires variant or 128x64 for SUPER-CHIP), the top left part of gfx in use */
 	unsigned char update_screen;	/* If this is true (1), update the screen */
+
+	/* Area of gfx written since the frontend last called clearDirty() */
+	unsigned long long dirty_rows;	/* Bit y set: row y was drawn to */
+	unsigned char dirty_x0;		/* First and last column drawn to, dirty_x0 > dirty_x1 when nothing was */
+	unsigned char dirty_x1;
+
+	/* State hashes, updated on every write so that they can be read in O(1) */
+	unsigned long long mem_hash;	/* Sum of memHashTerm() over every non-zero byte of memory */
+	unsigned long long plane_hash[PLANES];	/* XOR of gfxRowHash() over the rows of each plane, unless stale: read with chip8_gfx_hash() */
+	unsigned char gfx_stale;	/* Bit p set: plane_hash[p] is out of date, a scroll moved every row */
 	
 	/* Interupts and hardware registers */
 	unsigned char delay_timer;
@@ -29,12 +93,186 @@ typedef struct chip8 {
 	unsigned char keypad[16];
 	unsigned char key_layout; /* 0: QWERTY; 1: AZERTY */
 
+	/* SUPER-CHIP RPL user flags (FX75/FX85), kept when another program is loaded */
+	unsigned char rpl[16];
+
+	/* XO-CHIP sound: a 1-bit sample loop played while sound_timer runs (F002), at a pitch set by FX3A */
+	unsigned char audio_pattern[16];
+	unsigned char pitch;		/* Sample rate is 4000 * 2^((pitch - 64) / 48) Hz */
+
+	/* CHIP-8X colors: foreground of each 8x1 pixel zone of the 64x32 screen and background, CHIP8X_* bits */
+	unsigned char zone_colors[HEIGHT][WIDTH / 8];
+	unsigned char background;
+
+	/* MegaChip state, only allocated for programs of the variant, and whether its screen mode is on */
+	struct megachip *mega;
+	unsigned char mega_on;
+
+	/* QUIRK_* flags the program expects and its VARIANT_* flags, set by loading it (see quirksForProgram()) */
+	unsigned char quirks;
+	unsigned char variants;
+
+	/* Random number generator state (xorshift), kept per instance so runs are reproducible */
+	unsigned int rng;
+
 	/* Debug flag */
 	unsigned char debug;
 } Chip8;
 
 extern unsigned char chip8_fontset[80];
+extern unsigned char chip8_big_fontset[160];
 
 void initialize(Chip8 *chip8);
-int loadProgram(unsigned char memory[4096], char *filename);
+int loadProgram(Chip8 *chip, char *filename);
+void loadProgramBuffer(Chip8 *chip, const unsigned char *program, unsigned int size);
+void loadProgramImage(Chip8 *chip, const unsigned char *program, unsigned int size, unsigned long long hash, unsigned int variants);	/* Fresh instances only */
+unsigned long long programHash(const unsigned char *program, unsigned int size);
 void emulateCycle(Chip8 *chip);
+void emulateFrame(Chip8 *chip, unsigned int cycles);
+
+typedef void (*FrameFunction)(Chip8 *chip, unsigned int cycles);
+extern const FrameFunction chip8_interpreters[QUIRK_COMBINATIONS];	/* emulateFrame() for each quirk combination */
+
+/* Delay and sound timers: emulateFrame() ticks them after every instruction, the VIP timing once per
+ * frame */
+static inline void tickTimers(Chip8 *chip) {
+	if (chip->delay_timer > 0)
+		--chip->delay_timer;
+	if (chip->sound_timer > 0)
+		--chip->sound_timer;
+}
+
+/* COSMAC VIP timing: the VIP's 1802 runs 220113 machine cycles a second (8 clocks each at 1.7609 MHz),
+ * VIP_FRAME_CYCLES per 60 Hz frame. The display's DMA (8 bytes on each of 128 lines) and the interrupt
+ * routine take theirs first, which leaves VIP_INTERPRETER_CYCLES to the CHIP-8 interpreter */
+#define VIP_CYCLES_PER_SECOND 220113
+#define VIP_FRAME_CYCLES 3668
+#define VIP_INTERPRETER_CYCLES (VIP_FRAME_CYCLES - 1024 - 46)
+
+/* Machine cycles the VIP's interpreter takes for opcode in the current state, its fetch included */
+unsigned int vipCycles(const Chip8 *chip, unsigned short opcode);
+
+/* Runs instructions while *cycles is positive, charging each its vipCycles(). Returns 1 when it
+ * stopped at a DXYN, after which the VIP's interpreter waits for the next frame; the timers do not
+ * tick */
+int emulateVipCycles(Chip8 *chip, int *cycles);
+
+/* Quirk profiles: the ROM database is keyed by programHash(), specs are comma-separated profile
+ * ("chip8", "vip", "schip", "xochip") or quirk ("shift-vy", "load-store", "clip", "jump-vx") names */
+unsigned int quirksForProgram(unsigned long long program_hash, unsigned int variants);
+int parseQuirks(const char *spec);	/* -1 when the spec is invalid */
+void formatQuirks(unsigned int quirks, char *buf, unsigned int len);
+
+/* State hashing, used to detect identical machine states */
+unsigned long long chip8_hash(const Chip8 *chip);	/* Whole state except input and debug settings */
+unsigned long long gfxHash(const Chip8 *chip);		/* Framebuffer hash computed from scratch */
+
+/* Framebuffer only, every plane */
+static inline unsigned long long chip8_gfx_hash(const Chip8 *chip) {
+	return chip->gfx_stale ? gfxHash(chip) : chip->plane_hash[0] ^ chip->plane_hash[1];
+}
+
+static inline void clearDirty(Chip8 *chip) {
+	chip->dirty_rows = 0;
+	chip->dirty_x0 = MAX_WIDTH;
+	chip->dirty_x1 = 0;
+}
+
+/* Whole screen needs to be redrawn, e.g. after a reset or a state restore */
+static inline void markAllDirty(Chip8 *chip) {
+	chip->dirty_rows = ~0ULL >> (64 - chip->height);
+	chip->dirty_x0 = 0;
+	chip->dirty_x1 = chip->width - 1;
+}
+
+void setScreenMode(Chip8 *chip, unsigned int width, unsigned int height);	/* Switch resolution, which clears the screen */
+
+/* Largest screen mode the loaded program can switch to, e.g. the size of a recording */
+static inline void largestScreenMode(const Chip8 *chip, unsigned int *width, unsigned int *height) {
+	*width = chip->variants & VARIANT_SCHIP ? MAX_WIDTH : chip->width;
+	*height = chip->variants & VARIANT_SCHIP ? MAX_HEIGHT : chip->height;
+}
+
+/* Pixel lit in any plane: monochrome frontends show every color but the background alike */
+static inline int gfxPixel(const Chip8 *chip, unsigned int x, unsigned int y) {
+	return ((chip->gfx[0][y][x >> 6] | chip->gfx[1][y][x >> 6]) >> (63 - (x & 63))) & 1;
+}
+
+/* Color of a pixel, bit p from plane p: 0 is the background */
+static inline unsigned int gfxColor(const Chip8 *chip, unsigned int x, unsigned int y) {
+	return ((chip->gfx[0][y][x >> 6] >> (63 - (x & 63))) & 1) | ((chip->gfx[1][y][x >> 6] >> (63 - (x & 63))) & 1) << 1;
+}
+
+/* Pixels x to x + 7 of row y as a byte, MSB first (x multiple of 8), lit in any plane: the packed
+ * form of the recordings, screenshots and control socket */
+static inline unsigned char gfxByte(const Chip8 *chip, unsigned int x, unsigned int y) {
+	return (chip->gfx[0][y][x >> 6] | chip->gfx[1][y][x >> 6]) >> (56 - (x & 63));
+}
+
+/* Instance forking: pages are shared until one of the instances writes to them */
+void chip8_fork(Chip8 *dst, const Chip8 *src);	/* dst must not hold any page (fresh or released) */
+Chip8 *chip8_clone(const Chip8 *src);
+void chip8_release(Chip8 *chip);		/* Drop the memory pages and page table, the struct itself can be reused */
+void chip8_free(Chip8 *chip);			/* Release and free an instance returned by chip8_clone() */
+
+MemPage *unsharePage(Chip8 *chip, unsigned int page);
+
+/* Address the program is loaded at: 0x200, or 0x300 past the larger CHIP-8X interpreter */
+static inline unsigned int programBase(unsigned int variants) {
+	return variants & VARIANT_CHIP8X ? 0x300 : 0x200;
+}
+
+/* Pages in the page table: MEM_PAGES, or more for XO-CHIP and MegaChip programs */
+static inline unsigned int memPages(const Chip8 *chip) {
+	return (chip->mem_mask + 1) >> MEM_PAGE_SHIFT;
+}
+
+/* Finalizer of MurmurHash3 */
+static inline unsigned long long mix64(unsigned long long h) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* Contribution of one memory byte to mem_hash, zero bytes contribute nothing */
+static inline unsigned long long memHashTerm(unsigned int addr, unsigned char value) {
+	return value ? mix64((unsigned long long)addr << 8 | value) : 0;
+}
+
+/* Contribution of row y of plane p to plane_hash[p], an empty row contributes nothing */
+static inline unsigned long long gfxRowHash(unsigned int p, unsigned int y, const unsigned long long *row) {
+	unsigned long long h = p * MAX_HEIGHT + y + 0x9E3779B97F4A7C15ULL, any = 0;
+	unsigned int i;
+	for (i = 0; i < GFX_WORDS; i++) {
+		h = mix64(h ^ row[i]);
+		any |= row[i];
+	}
+	return any ? h : 0;
+}
+
+/* Index register arithmetic wraps around 16 bits, or around the address space when it is larger */
+static inline unsigned int indexMask(const Chip8 *chip) {
+	return chip->mem_mask | 0xFFFF;
+}
+
+static inline unsigned char memRead(const Chip8 *chip, unsigned int addr) {
+	addr &= chip->mem_mask;
+	return chip->pages[addr >> MEM_PAGE_SHIFT]->data[addr & (MEM_PAGE_SIZE - 1)];
+}
+
+static inline void memWrite(Chip8 *chip, unsigned int addr, unsigned char value) {
+	addr &= chip->mem_mask;
+	MemPage *page = chip->pages[addr >> MEM_PAGE_SHIFT];
+	unsigned char old = page->data[addr & (MEM_PAGE_SIZE - 1)];
+	if (old == value)
+		return;
+	if (__atomic_load_n(&page->refs, __ATOMIC_ACQUIRE) != 1)	/* Shared: copy it first */
+		page = unsharePage(chip, addr >> MEM_PAGE_SHIFT);
+	page->data[addr & (MEM_PAGE_SIZE - 1)] = value;
+	chip->mem_hash += memHashTerm(addr, value) - memHashTerm(addr, old);
+}
+
+#endif
@@ -0,0 +1,283 @@
+#include "control.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define CONTROL_HEADER 4
+#define CONTROL_BUFFER (1 << 17)	/* Holds at least one request with the largest payload */
+#define CONTROL_MAX_RESPONSE (CONTROL_HEADER + 4 + MAX_WIDTH * MAX_HEIGHT / 8)
+
+struct control {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd, client_fd;
+	Scheduler *sched;
+	int quirks;	/* Quirks every loaded program runs with, -1 for the ROM database's */
+	int quit;
+
+	Chip8 slots[CONTROL_SLOTS];
+	unsigned char used[CONTROL_SLOTS];
+
+	/* Requests received but not executed yet, and responses not sent yet */
+	unsigned char in[CONTROL_BUFFER];
+	unsigned int in_len;
+	unsigned char out[CONTROL_BUFFER];
+	unsigned int out_start, out_len;
+};
+
+static void putLE(unsigned char *out, unsigned long long value, unsigned int bytes) {
+	unsigned int i;
+	for (i = 0; i < bytes; i++)
+		out[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static unsigned long long getLE(const unsigned char *in, unsigned int bytes) {
+	unsigned long long value = 0;
+	unsigned int i;
+	for (i = 0; i < bytes; i++)
+		value |= (unsigned long long)in[i] << (8 * i);
+	return value;
+}
+
+Control *controlOpen(const char *path, Scheduler *sched, int quirks) {
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return NULL;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Could not create socket\n");
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);	/* Left over by a previous run */
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+		fprintf(stderr, "Could not listen on %s\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	Control *ctl = calloc(1, sizeof(Control));
+	strcpy(ctl->path, path);
+	ctl->listen_fd = fd;
+	ctl->client_fd = -1;
+	ctl->sched = sched;
+	ctl->quirks = quirks;
+	return ctl;
+}
+
+static void disconnect(Control *ctl) {
+	close(ctl->client_fd);
+	ctl->client_fd = -1;
+	ctl->in_len = 0;
+	ctl->out_start = 0;
+	ctl->out_len = 0;
+}
+
+/* Machine state changed behind the frontend's back: redraw everything and forget queued input */
+static void resetView(Control *ctl) {
+	Chip8 *chip = ctl->sched->chip;
+	markAllDirty(chip);
+	chip->update_screen = 1;
+	ctl->sched->head = ctl->sched->tail;
+}
+
+/* Executes one request and appends its response, the payload has been checked to be complete */
+static void execute(Control *ctl, unsigned char command, unsigned char arg, const unsigned char *payload, unsigned int len) {
+	Scheduler *sched = ctl->sched;
+	Chip8 *chip = sched->chip;
+	unsigned char *response = ctl->out + ctl->out_start + ctl->out_len;
+	unsigned char *data = response + CONTROL_HEADER;
+	unsigned int data_len = 0, i;
+	unsigned char status = CONTROL_OK;
+
+	switch (command) {
+		case CONTROL_LOAD: {
+			/* A new program in the same instance: settings and the RPL flags survive, like a real SUPER-CHIP's.
+			 * The 16-bit length keeps ROMs within 64 KB, so MegaChip programs larger than that cannot be loaded here */
+			unsigned char layout = chip->key_layout, debug = chip->debug, rpl[16];
+			memcpy(rpl, chip->rpl, sizeof(rpl));
+			chip8_release(chip);
+			initialize(chip);
+			chip->key_layout = layout;
+			chip->debug = debug;
+			memcpy(chip->rpl, rpl, sizeof(rpl));
+			loadProgramBuffer(chip, payload, len);
+			if (ctl->quirks >= 0)
+				chip->quirks = ctl->quirks;
+			resetView(ctl);
+			break;
+		}
+		case CONTROL_RUN: {
+			if (len != 4) {
+				status = CONTROL_ERROR;
+				break;
+			}
+			unsigned long long frames = getLE(payload, 4);
+			/* Frames do not advance host time, so this is safe in the middle of a real-time frontend */
+			while (frames--)
+				schedulerRunFrame(sched, sched->window_start);
+			break;
+		}
+		case CONTROL_KEYS:
+			if (len != 2) {
+				status = CONTROL_ERROR;
+				break;
+			}
+			for (i = 0; i < 16; i++)
+				chip->keypad[i] = (getLE(payload, 2) >> i) & 1;
+			break;
+		case CONTROL_SAVE:
+			if (arg >= CONTROL_SLOTS) {
+				status = CONTROL_ERROR;
+				break;
+			}
+			if (ctl->used[arg])
+				chip8_release(&ctl->slots[arg]);
+			chip8_fork(&ctl->slots[arg], chip);
+			ctl->used[arg] = 1;
+			break;
+		case CONTROL_RESTORE:
+			if (arg >= CONTROL_SLOTS || !ctl->used[arg]) {
+				status = CONTROL_ERROR;
+				break;
+			}
+			chip8_release(chip);
+			chip8_fork(chip, &ctl->slots[arg]);
+			resetView(ctl);
+			break;
+		case CONTROL_SCREEN:
+			putLE(data, chip->width, 2);
+			putLE(data + 2, chip->height, 2);
+			data_len = 4;
+			for (i = 0; i < chip->width * chip->height; i += 8)
+				data[data_len++] = gfxByte(chip, i % chip->width, i / chip->width);
+			break;
+		case CONTROL_HASH:
+			putLE(data, sched->frames, 8);
+			putLE(data + 8, chip8_gfx_hash(chip), 8);
+			putLE(data + 16, chip8_hash(chip), 8);
+			data_len = 24;
+			break;
+		case CONTROL_QUIT:
+			ctl->quit = 1;
+			break;
+		default:
+			status = CONTROL_ERROR;
+			break;
+	}
+
+	response[0] = status;
+	response[1] = command;
+	putLE(response + 2, data_len, 2);
+	ctl->out_len += CONTROL_HEADER + data_len;
+}
+
+/* Executes every complete request, as long as there is room left for the responses */
+static void processRequests(Control *ctl) {
+	unsigned int pos = 0;
+	while (ctl->in_len - pos >= CONTROL_HEADER && !ctl->quit) {
+		unsigned int len = getLE(ctl->in + pos + 2, 2);
+		if (ctl->in_len - pos < CONTROL_HEADER + len)
+			break;
+		if (ctl->out_start + ctl->out_len + CONTROL_MAX_RESPONSE > CONTROL_BUFFER) {
+			if (ctl->out_start == 0)
+				break;	/* Client is not reading: wait until some responses went out */
+			memmove(ctl->out, ctl->out + ctl->out_start, ctl->out_len);
+			ctl->out_start = 0;
+			continue;
+		}
+		execute(ctl, ctl->in[pos], ctl->in[pos + 1], ctl->in + pos + CONTROL_HEADER, len);
+		pos += CONTROL_HEADER + len;
+	}
+	memmove(ctl->in, ctl->in + pos, ctl->in_len - pos);
+	ctl->in_len -= pos;
+}
+
+/* Sends as much as the socket takes (everything if wait is set), returns 0 if the client is gone */
+static int flushResponses(Control *ctl, int wait) {
+	while (ctl->out_len > 0) {
+		ssize_t sent = send(ctl->client_fd, ctl->out + ctl->out_start, ctl->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			struct pollfd pfd = { ctl->client_fd, POLLOUT, 0 };
+			if (!wait)
+				return 1;
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		if (sent <= 0)
+			return 0;
+		ctl->out_start += sent;
+		ctl->out_len -= sent;
+	}
+	ctl->out_start = 0;
+	return 1;
+}
+
+/* Alternates between executing requests and sending responses until the input is used up or the
+ * client stops reading (unless wait is set), returns 0 if the client is gone */
+static int serveRequests(Control *ctl, int wait) {
+	unsigned int left;
+	do {
+		left = ctl->in_len;
+		processRequests(ctl);
+		if (!flushResponses(ctl, wait))
+			return 0;
+	} while (ctl->out_len == 0 && ctl->in_len < left);
+	return 1;
+}
+
+int controlPoll(Control *ctl, int timeout_ms) {
+	struct pollfd pfd;
+	if (ctl->client_fd < 0) {
+		pfd.fd = ctl->listen_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return 1;
+		ctl->client_fd = accept(ctl->listen_fd, NULL, NULL);
+		if (ctl->client_fd < 0)
+			return 1;
+		fcntl(ctl->client_fd, F_SETFL, fcntl(ctl->client_fd, F_GETFL) | O_NONBLOCK);
+		timeout_ms = 0;	/* The first requests may already be there */
+	}
+
+	pfd.fd = ctl->client_fd;
+	pfd.events = POLLIN | (ctl->out_len > 0 ? POLLOUT : 0);
+	if (poll(&pfd, 1, timeout_ms) < 0)
+		return 1;
+
+	/* Read everything available in one go, then answer it all with as few sends as possible */
+	while (ctl->in_len < CONTROL_BUFFER) {
+		ssize_t received = recv(ctl->client_fd, ctl->in + ctl->in_len, CONTROL_BUFFER - ctl->in_len, 0);
+		if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			serveRequests(ctl, 1);	/* Still answer what was sent before the client shut down its side */
+			disconnect(ctl);
+			return !ctl->quit;
+		}
+		if (received < 0)
+			break;
+		ctl->in_len += received;
+	}
+	/* Let the last responses out before hanging up on a quit */
+	if (!serveRequests(ctl, ctl->quit) || ctl->quit)
+		disconnect(ctl);
+	return !ctl->quit;
+}
+
+void controlClose(Control *ctl) {
+	unsigned int i;
+	if (ctl->client_fd >= 0)
+		disconnect(ctl);
+	close(ctl->listen_fd);
+	unlink(ctl->path);
+	for (i = 0; i < CONTROL_SLOTS; i++) {
+		if (ctl->used[i])
+			chip8_release(&ctl->slots[i]);
+	}
+	free(ctl);
+}
@@ -0,0 +1,34 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "scheduler.h"
+
+/* Automation interface on a Unix-domain stream socket, one client at a time.
+ *
+ * Requests:  command (1 byte), argument (1 byte), payload length (2 bytes, little endian), payload
+ * Responses: status (1 byte), command (1 byte), payload length (2 bytes, little endian), payload
+ *
+ * Clients may pipeline any number of requests: they are executed in order and every request gets
+ * exactly one response, in the same order. Multi-byte values are little endian. */
+
+#define CONTROL_LOAD	0x01	/* Payload: ROM image (at most 64 KB). Resets the machine and loads it, keeping the RPL flags and the -q quirks */
+#define CONTROL_RUN	0x02	/* Payload: frame count (4 bytes). Emulates that many frames right away */
+#define CONTROL_KEYS	0x03	/* Payload: keypad state (2 bytes, bit n = key n pressed) */
+#define CONTROL_SAVE	0x04	/* Argument: slot. Snapshots the machine (copy-on-write fork) */
+#define CONTROL_RESTORE	0x05	/* Argument: slot. Returns to a snapshot */
+#define CONTROL_SCREEN	0x06	/* Response: width, height (2 bytes each), pixels packed 8 per byte, MSB first */
+#define CONTROL_HASH	0x07	/* Response: frame counter, screen hash, state hash (8 bytes each) */
+#define CONTROL_QUIT	0x08	/* Closes the connection and asks the frontend to exit */
+
+#define CONTROL_OK	0x00
+#define CONTROL_ERROR	0x01	/* Unknown command, bad slot or malformed payload */
+
+#define CONTROL_SLOTS 16
+
+typedef struct control Control;
+
+Control *controlOpen(const char *path, Scheduler *sched, int quirks);	/* quirks: -q override, -1 for none */
+int controlPoll(Control *ctl, int timeout_ms);	/* Serves pending requests, 0 once CONTROL_QUIT was received */
+void controlClose(Control *ctl);		/* Closes the socket, removes its path and drops the snapshots */
+
+#endif
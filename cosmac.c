@@ -0,0 +1,274 @@
+#include "cosmac.h"
+
+/* External flag n (EF1 to EF4) as the VIP wires it, count instructions into the call */
+static inline unsigned int externalFlag(const Cosmac *cpu, const Chip8 *chip, unsigned int n, unsigned int count) {
+	switch (n) {
+		case 1: /* Display status of the CDP1861 */
+			return count % COSMAC_FRAME >= COSMAC_FRAME - COSMAC_VBLANK;
+		case 3: /* Latched key pressed */
+			return chip->keypad[cpu->key & 0xF] != 0;
+		default: /* EF2 is the cassette input, EF4 the IN button */
+			return 0;
+	}
+}
+
+/* Condition tested by the short branches 3N, before N's bit 3 inverts it */
+static inline unsigned int branchCondition(const Cosmac *cpu, const Chip8 *chip, unsigned int n, unsigned int D, unsigned int DF, unsigned int count) {
+	switch (n & 7) {
+		case 0: return 1;
+		case 1: return cpu->Q;
+		case 2: return D == 0;
+		case 3: return DF;
+		default: return externalFlag(cpu, chip, (n & 7) - 3, count);
+	}
+}
+
+/* 9-bit result of the adder, DF being its carry: ADD, SD (M - D) and SM (D - M) for kind 0, 1 and
+ * 3. Subtractions add the complement, a carry meaning no borrow */
+static inline unsigned int adder(unsigned int D, unsigned int m, unsigned int kind, unsigned int carry) {
+	switch (kind) {
+		case 0: return D + m + carry;
+		case 1: return m + (D ^ 0xFF) + carry;
+		default: return D + (m ^ 0xFF) + carry;
+	}
+}
+
+/* Like the CHIP-8 interpreter, a single switch with the hot registers in locals: the high nibble of
+ * the opcode picks the instruction group, the low one is a register or a variant of it */
+unsigned int cosmacRun(Cosmac *cpu, Chip8 *chip, unsigned int max) {
+	unsigned short *R = cpu->R;
+	unsigned int D = cpu->D, DF = cpu->DF, P = cpu->P, X = cpu->X, count, t;
+
+	for (count = 0; count < max && P != 4; count++) {
+		unsigned int op = memRead(chip, R[P]++), n = op & 0xF;
+		switch (op >> 4) {
+			case 0x0: /* LDN -- D = M(R(N)); 00 is IDL, which waits for an interrupt or DMA that never comes */
+				if (n != 0)
+					D = memRead(chip, R[n]);
+				break;
+
+			case 0x1: /* INC */
+				R[n]++;
+				break;
+
+			case 0x2: /* DEC */
+				R[n]--;
+				break;
+
+			case 0x3: /* Short branches: the next byte replaces the low byte of R(P), or is skipped */
+				if (branchCondition(cpu, chip, n, D, DF, count) ^ (n >> 3))
+					R[P] = (R[P] & 0xFF00) | memRead(chip, R[P]);
+				else
+					R[P]++;
+				break;
+
+			case 0x4: /* LDA -- D = M(R(N)), R(N)++ */
+				D = memRead(chip, R[n]++);
+				break;
+
+			case 0x5: /* STR -- M(R(N)) = D */
+				memWrite(chip, R[n], D);
+				break;
+
+			case 0x6:
+				if (n == 0) { /* IRX */
+					R[X]++;
+				} else if (n < 8) { /* OUT N -- the byte at R(X) goes to port N: 2 latches the key EF3 tests */
+					t = memRead(chip, R[X]++);
+					if (n == 2)
+						cpu->key = t & 0xF;
+				} else if (n > 8) { /* INP N - 8 -- M(R(X)) = D = the port's byte, none of the VIP's drives the bus */
+					D = 0;
+					memWrite(chip, R[X], D);
+				}
+				break;
+
+			case 0x7:
+				switch (n) {
+					case 0x0: /* RET */
+					case 0x1: /* DIS -- X and P from M(R(X)), R(X)++, with interrupts enabled or not */
+						t = memRead(chip, R[X]++);
+						X = t >> 4;
+						P = t & 0xF;
+						cpu->IE = n == 0;
+						break;
+					case 0x2: /* LDXA -- D = M(R(X)), R(X)++ */
+						D = memRead(chip, R[X]++);
+						break;
+					case 0x3: /* STXD -- M(R(X)) = D, R(X)-- */
+						memWrite(chip, R[X]--, D);
+						break;
+					case 0x6: /* SHRC -- Rotate right through DF */
+						t = D & 1;
+						D = D >> 1 | DF << 7;
+						DF = t;
+						break;
+					case 0xE: /* SHLC -- Rotate left through DF */
+						t = D >> 7;
+						D = (D << 1 | DF) & 0xFF;
+						DF = t;
+						break;
+					case 0x8: /* SAV -- M(R(X)) = T */
+						memWrite(chip, R[X], cpu->T);
+						break;
+					case 0x9: /* MARK -- T = M(R(2)) = XP, R(2)--, X = P */
+						cpu->T = X << 4 | P;
+						memWrite(chip, R[2]--, cpu->T);
+						X = P;
+						break;
+					case 0xA: /* REQ */
+					case 0xB: /* SEQ */
+						cpu->Q = n & 1;
+						break;
+					default: /* ADC, SDB, SMB, and ADCI, SDBI, SMBI on the byte after the instruction */
+						t = adder(D, memRead(chip, (n & 8) ? R[P]++ : R[X]), n & 3, DF);
+						D = t & 0xFF;
+						DF = t >> 8;
+				}
+				break;
+
+			case 0x8: /* GLO -- D = R(N).0 */
+				D = R[n] & 0xFF;
+				break;
+
+			case 0x9: /* GHI -- D = R(N).1 */
+				D = R[n] >> 8;
+				break;
+
+			case 0xA: /* PLO -- R(N).0 = D */
+				R[n] = (R[n] & 0xFF00) | D;
+				break;
+
+			case 0xB: /* PHI -- R(N).1 = D */
+				R[n] = (R[n] & 0x00FF) | D << 8;
+				break;
+
+			case 0xC: { /* Long branches (bit 2 clear) to the next two bytes, and long skips over them */
+				unsigned int condition;
+				switch (n & 3) {
+					case 0: condition = (n & 0xC) == 0xC ? cpu->IE : 1; break;	/* LSIE, or LBR / NOP / LSKP */
+					case 1: condition = cpu->Q; break;
+					case 2: condition = D == 0; break;
+					default: condition = DF; break;
+				}
+				/* Bit 3 inverts branches, bit 2 clear inverts skips: C4 is NOP, C8 LSKP */
+				if (condition ^ ((n >> 3) & 1) ^ ((n >> 2) & 1)) {
+					if (n & 4)
+						R[P] += 2;
+					else
+						R[P] = memRead(chip, R[P]) << 8 | memRead(chip, R[P] + 1);
+				} else if (!(n & 4)) {
+					R[P] += 2;
+				}
+				break;
+			}
+
+			case 0xD: /* SEP -- P = N, SEP R4 returns to the CHIP-8 interpreter */
+				P = n;
+				break;
+
+			case 0xE: /* SEX -- X = N */
+				X = n;
+				break;
+
+			case 0xF:
+				if ((n & 7) == 6) { /* SHR, SHL */
+					if (n & 8) {
+						DF = D >> 7;
+						D = (D << 1) & 0xFF;
+					} else {
+						DF = D & 1;
+						D >>= 1;
+					}
+					break;
+				}
+				/* LDX, OR, AND, XOR, ADD, SD, SM on M(R(X)), their immediate forms on the byte after
+				 * the instruction */
+				t = memRead(chip, (n & 8) ? R[P]++ : R[X]);
+				switch (n & 7) {
+					case 0: D = t; break;
+					case 1: D |= t; break;
+					case 2: D &= t; break;
+					case 3: D ^= t; break;
+					default:
+						t = adder(D, t, n & 3, (n & 3) != 0);
+						D = t & 0xFF;
+						DF = t >> 8;
+				}
+				break;
+		}
+	}
+
+	cpu->D = D;
+	cpu->DF = DF;
+	cpu->P = P;
+	cpu->X = X;
+	return count;
+}
+
+/* The 64x32 screen is only shared in that mode and without XO-CHIP planes, the VIP's own */
+static int sharesDisplay(const Chip8 *chip) {
+	return chip->width == WIDTH && chip->height == HEIGHT && !(chip->variants & VARIANT_XOCHIP);
+}
+
+unsigned short machineCall(Chip8 *chip, unsigned short opcode, unsigned short pc) {
+	Cosmac cpu;
+	unsigned int i, y, b;
+	unsigned long long row;
+
+	/* Into the VIP interpreter's memory layout and registers */
+	for (i = 0; i < 16; i++) {
+		memWrite(chip, VIP_VARIABLES + i, chip->V[i]);
+	}
+	if (sharesDisplay(chip)) {
+		for (y = 0; y < HEIGHT; y++) {
+			for (b = 0; b < WIDTH / 8; b++) {
+				memWrite(chip, VIP_DISPLAY + y * (WIDTH / 8) + b, chip->gfx[0][y][0] >> (56 - 8 * b));
+			}
+		}
+	}
+	memset(&cpu, 0, sizeof(cpu));
+	cpu.R[2] = VIP_STACK;
+	cpu.R[3] = opcode & 0x0FFF;
+	cpu.R[5] = pc + 2;
+	cpu.R[6] = VIP_VARIABLES + ((opcode >> 8) & 0xF);
+	cpu.R[7] = VIP_VARIABLES + ((opcode >> 4) & 0xF);
+	cpu.R[8] = chip->delay_timer << 8 | chip->sound_timer;
+	cpu.R[9] = chip->rng;
+	cpu.R[0xA] = chip->index_reg;
+	cpu.R[0xB] = VIP_DISPLAY;
+	cpu.P = 3;
+	cpu.X = 2;
+
+	cosmacRun(&cpu, chip, COSMAC_MAX_INSTRUCTIONS);
+	if (cpu.P != 4) {
+		printf("[Error] Machine code at 0x%x did not return!\n", opcode & 0x0FFF);
+		cpu.R[5] = pc + 2;
+	}
+
+	/* And back, with what the machine code changed */
+	for (i = 0; i < 16; i++) {
+		chip->V[i] = memRead(chip, VIP_VARIABLES + i);
+	}
+	chip->index_reg = cpu.R[0xA] & indexMask(chip);
+	chip->delay_timer = cpu.R[8] >> 8;
+	chip->sound_timer = cpu.R[8] & 0xFF;
+	if (sharesDisplay(chip)) {
+		for (y = 0; y < HEIGHT; y++) {
+			row = 0;
+			for (b = 0; b < WIDTH / 8; b++) {
+				row = row << 8 | memRead(chip, VIP_DISPLAY + y * (WIDTH / 8) + b);
+			}
+			if (row == chip->gfx[0][y][0])
+				continue;
+			chip->plane_hash[0] ^= gfxRowHash(0, y, chip->gfx[0][y]);
+			chip->gfx[0][y][0] = row;
+			chip->plane_hash[0] ^= gfxRowHash(0, y, chip->gfx[0][y]);
+			chip->dirty_rows |= 1ULL << y;
+			chip->dirty_x0 = 0;
+			chip->dirty_x1 = WIDTH - 1;
+			chip->update_screen = 1;
+		}
+	}
+	return cpu.R[5];
+}
@@ -0,0 +1,45 @@
+#ifndef COSMAC_H
+#define COSMAC_H
+
+#include "chip8.h"
+
+/* RCA COSMAC 1802, the COSMAC VIP's processor, for the machine code hybrid programs call with 0MMM.
+ * The call runs like on the VIP: the CHIP-8 state is copied into the interpreter's memory layout
+ * below, the 1802 starts at MMM with P = 3 and X = 2 and the CHIP-8 interpreter resumes when the
+ * code returns with SEP R4 (D4), at the CHIP-8 address in R5. Machine code shares the program's
+ * memory, so the variables and the display it changed are copied back.
+ *
+ *   R2  1802 stack (VIP_STACK)             R5  CHIP-8 pc, after the 0MMM instruction
+ *   R6  address of VX, R7 of VY            R8  timers: delay in R8.1, sound in R8.0
+ *   R9  random number                      RA  I
+ *   RB  display page (VIP_DISPLAY)
+ *
+ * EF1 is the display status, set for the last lines before each frame; EF3 is set while the key
+ * latched by OUT 2 is pressed. Interrupts and DMA are not emulated: the timers do not run during a
+ * call and IDL does not wait */
+
+#define VIP_STACK 0x0ECF	/* Top of the 1802 stack, below the interpreter's work area */
+#define VIP_VARIABLES 0x0EF0	/* V0 to VF */
+#define VIP_DISPLAY 0x0F00	/* 64x32 screen, 8 bytes per row, leftmost pixel in the MSB */
+#define COSMAC_FRAME 1834	/* Instructions per VIP frame, most take 2 machine cycles of 8 clocks at 1.76 MHz */
+#define COSMAC_VBLANK 28	/* Instructions of each frame with EF1 set */
+#define COSMAC_MAX_INSTRUCTIONS 1000000	/* A call running longer than that never returns */
+
+typedef struct cosmac {
+	unsigned short R[16];	/* Scratchpad registers */
+	unsigned char D;	/* Accumulator */
+	unsigned char DF;	/* Carry */
+	unsigned char P, X;	/* Indices of the program counter and data pointer registers */
+	unsigned char T;	/* X and P saved by MARK or an interrupt */
+	unsigned char IE, Q;	/* Interrupt enable, output flip-flop (the VIP's tone) */
+	unsigned char key;	/* Keypad latch, from OUT 2 */
+} Cosmac;
+
+/* Runs from R(P) until P is 4 (returned to the CHIP-8 interpreter) or for max instructions, returns
+ * the number executed */
+unsigned int cosmacRun(Cosmac *cpu, Chip8 *chip, unsigned int max);
+
+/* 0MMM: calls the machine code at MMM from the CHIP-8 instruction at pc, returns the next pc */
+unsigned short machineCall(Chip8 *chip, unsigned short opcode, unsigned short pc);
+
+#endif
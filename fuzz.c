@@ -0,0 +1,361 @@
+#include "chip8.h"
+#include "megachip.h"
+#include "tier.h"
+#include <string.h>
+#include <unistd.h>
+
+/* Differential fuzzer: random and mutated programs are executed in lockstep on the
+ * reference interpreter (emulateCycle) and on another engine, and the first
+ * instruction after which both machine states differ is reported. Engines running
+ * whole blocks are compared after runs of random length instead */
+
+#define MAX_CORPUS 256
+
+typedef struct engine {
+	const char *name;
+	void (*step)(Chip8 *chip);	/* Execute a single instruction */
+	FrameFunction run;		/* or that many instructions, if step is NULL */
+} Engine;
+
+/* Every execution engine that has to behave exactly like the reference interpreter */
+static const Engine engines[] = {
+	{"reference", emulateCycle, NULL},
+	{"tiered", NULL, tieredFrame},
+};
+
+typedef struct program {
+	unsigned char data[MAX_XO_PROGRAM_SIZE];	/* XO-CHIP seeds fit, MegaChip's 16 MB would not for a whole corpus */
+	unsigned int size;
+} Program;
+
+static Program corpus[MAX_CORPUS];
+static unsigned int corpus_size = 0;
+
+/* Fuzzer's own random number generator, independent from the emulated one */
+static unsigned int fuzz_rng = 1;
+
+static unsigned int nextRandom(void) {
+	fuzz_rng ^= fuzz_rng << 13;
+	fuzz_rng ^= fuzz_rng >> 17;
+	fuzz_rng ^= fuzz_rng << 5;
+	return fuzz_rng;
+}
+
+static const Engine *findEngine(const char *name) {
+	unsigned int i;
+	for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+		if (strcmp(engines[i].name, name) == 0)
+			return &engines[i];
+	}
+	return NULL;
+}
+
+static int loadCorpusFile(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Program %s not found!\n", filename);
+		return 0;
+	}
+	if (corpus_size == MAX_CORPUS) {
+		fprintf(stderr, "Corpus is full, ignoring %s\n", filename);
+		fclose(fp);
+		return 1;
+	}
+	Program *prog = &corpus[corpus_size];
+	prog->size = fread(prog->data, 1, sizeof(prog->data), fp);
+	if (fgetc(fp) != EOF)
+		fprintf(stderr, "%s is larger than %u bytes, only its beginning is used\n", filename, (unsigned int)sizeof(prog->data));
+	fclose(fp);
+	if (prog->size > 0)
+		corpus_size++;
+	return 1;
+}
+
+/* Random opcode, biased towards well-formed instructions so that programs survive for more than a few cycles.
+ * The instructions of the given VARIANT_SCHIP and VARIANT_XOCHIP extensions are mixed in */
+static unsigned short randomOpcode(unsigned int variants) {
+	unsigned short r = nextRandom() & 0xFFFF;
+	switch (nextRandom() % 16) {
+		case 0x0: /* CLS, RET or (rarely) SYS */
+			if ((variants & VARIANT_XOCHIP) && (nextRandom() % 8) == 0)
+				return 0x00D0 | (r & 0xF);	/* Scroll up */
+			if ((variants & VARIANT_SCHIP) && (nextRandom() % 4) == 0) {
+				static const unsigned short ops[] = {0x00FB, 0x00FC, 0x00FE, 0x00FF};
+				return (nextRandom() & 1) ? 0x00C0 | (r & 0xF) : ops[nextRandom() % 4];	/* Scrolls, resolution */
+			}
+			return (nextRandom() % 8) ? ((nextRandom() & 1) ? 0x00E0 : 0x00EE) : r & 0x0FFF;
+		case 0x5: case 0x9: /* Register compares need a 0 low nibble, XO-CHIP's ranges a 2 or 3 */
+			if ((variants & VARIANT_XOCHIP) && (nextRandom() % 4) == 0)
+				return 0x5000 | (r & 0x0FF0) | (2 + (nextRandom() & 1));
+			return ((nextRandom() & 1) ? 0x5000 : 0x9000) | (r & 0x0FF0);
+		case 0x8: {
+			static const unsigned char ops[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+			return 0x8000 | (r & 0x0FF0) | ops[nextRandom() % sizeof(ops)];
+		}
+		case 0xE:
+			return 0xE000 | (r & 0x0F00) | ((nextRandom() & 1) ? 0x9E : 0xA1);
+		case 0xF: {
+			static const unsigned char ops[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+			static const unsigned char schip_ops[] = {0x30, 0x75, 0x85};
+			if ((variants & VARIANT_XOCHIP) && (nextRandom() % 4) == 0) {
+				switch (nextRandom() % 4) {
+					case 0: return 0xF000;	/* Long I load: the next opcode is its address, skips jump over both */
+					case 1: return 0xF002;	/* Audio pattern */
+					case 2: return 0xF001 | (r & 0x0300);	/* Bitplanes */
+					default: return 0xF03A | (r & 0x0F00);	/* Pitch */
+				}
+			}
+			if ((variants & VARIANT_SCHIP) && (nextRandom() % 4) == 0)
+				return 0xF000 | (r & 0x0F00) | schip_ops[nextRandom() % sizeof(schip_ops)];
+			return 0xF000 | (r & 0x0F00) | ops[nextRandom() % sizeof(ops)];
+		}
+		default: /* Jumps, calls and loads stay inside the program area most of the time */
+			if ((r >> 12) == 0x1 || (r >> 12) == 0x2 || (r >> 12) == 0xB)
+				return (r & 0xF000) | (0x200 + (nextRandom() % 0x100) * 2);
+			return r;
+	}
+}
+
+/* Half of the programs use an extension, and start with one of its instructions so that the analysis
+ * loads them as such: SUPER-CHIP's hires mode, or XO-CHIP drawing to both planes */
+static void generateProgram(Program *prog) {
+	static const unsigned short prefixes[] = {0x00FF, 0xF301};
+	unsigned int i = 0, variants = 0;
+	prog->size = 2 * (1 + nextRandom() % 128);
+	switch (nextRandom() % 4) {
+		case 0: variants = VARIANT_SCHIP; break;
+		case 1: variants = VARIANT_XOCHIP | VARIANT_SCHIP; break;
+	}
+	if (variants != 0) {
+		unsigned short prefix = prefixes[(variants & VARIANT_XOCHIP) != 0];
+		prog->data[0] = prefix >> 8;
+		prog->data[1] = prefix & 0xFF;
+		i = 2;
+	}
+	for (; i < prog->size; i += 2) {
+		unsigned short opcode = randomOpcode(variants);
+		prog->data[i] = opcode >> 8;
+		prog->data[i + 1] = opcode & 0xFF;
+	}
+}
+
+static void mutateProgram(Program *prog, const Program *seed) {
+	unsigned int i, mutations = 1 + nextRandom() % 8;
+	prog->size = seed->size;
+	memcpy(prog->data, seed->data, seed->size);
+	for (i = 0; i < mutations; i++) {
+		unsigned int pos = nextRandom() % prog->size;
+		switch (nextRandom() % 3) {
+			case 0: /* Bit flip */
+				prog->data[pos] ^= 1 << (nextRandom() % 8);
+				break;
+			case 1: /* Random byte */
+				prog->data[pos] = nextRandom() & 0xFF;
+				break;
+			case 2: { /* Replace a whole instruction */
+				unsigned short opcode = randomOpcode(nextRandom() & 1 ? VARIANT_XOCHIP | VARIANT_SCHIP : 0);
+				pos &= ~1u;
+				prog->data[pos] = opcode >> 8;
+				if (pos + 1 < prog->size)
+					prog->data[pos + 1] = opcode & 0xFF;
+				break;
+			}
+		}
+	}
+}
+
+static int memoryDiffers(const Chip8 *a, const Chip8 *b) {
+	unsigned int i;
+	if (a->mem_mask != b->mem_mask)
+		return 1;
+	for (i = 0; i < memPages(a); i++) {
+		/* Pages still shared between both forks are equal by construction */
+		if (a->pages[i] != b->pages[i] && memcmp(a->pages[i]->data, b->pages[i]->data, MEM_PAGE_SIZE) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns the name of the first field in which both states differ, or NULL if they are identical */
+static const char *compareStates(const Chip8 *a, const Chip8 *b) {
+	if (a->pc != b->pc) return "pc";
+	if (a->opcode != b->opcode) return "opcode";
+	if (a->index_reg != b->index_reg) return "index_reg";
+	if (memcmp(a->V, b->V, sizeof(a->V)) != 0) return "V";
+	if (memcmp(a->rpl, b->rpl, sizeof(a->rpl)) != 0) return "rpl";
+	if (memcmp(a->audio_pattern, b->audio_pattern, sizeof(a->audio_pattern)) != 0 || a->pitch != b->pitch) return "audio";
+	if (a->sp != b->sp) return "sp";
+	if (memcmp(a->stack, b->stack, sizeof(a->stack)) != 0) return "stack";
+	if (a->delay_timer != b->delay_timer) return "delay_timer";
+	if (a->sound_timer != b->sound_timer) return "sound_timer";
+	if (a->rng != b->rng) return "rng";
+	if (a->mem_hash != b->mem_hash) return "mem_hash";
+	if (a->width != b->width || a->height != b->height) return "screen mode";
+	if (a->planes != b->planes) return "planes";
+	if (a->background != b->background || memcmp(a->zone_colors, b->zone_colors, sizeof(a->zone_colors)) != 0) return "colors";
+	if (chip8_gfx_hash(a) != chip8_gfx_hash(b)) return "gfx_hash";
+	if (a->dirty_rows != b->dirty_rows || a->dirty_x0 != b->dirty_x0 || a->dirty_x1 != b->dirty_x1) return "dirty area";
+	if (memcmp(a->gfx, b->gfx, sizeof(a->gfx)) != 0) return "gfx";
+	if (memoryDiffers(a, b)) return "memory";
+	if (a->mega_on != b->mega_on || (a->mega == NULL) != (b->mega == NULL) ||
+			(a->mega != NULL && !megaEqual(a->mega, b->mega))) return "megachip";
+	return NULL;
+}
+
+static void dumpState(FILE *out, const char *name, const Chip8 *chip) {
+	unsigned int i;
+	fprintf(out, "[%s] pc=0x%03x opcode=0x%04x I=0x%03x sp=%u DT=%u ST=%u rng=0x%08x\n", name,
+			chip->pc, chip->opcode, chip->index_reg, chip->sp, chip->delay_timer, chip->sound_timer, chip->rng);
+	fprintf(out, "[%s] V:", name);
+	for (i = 0; i < 16; i++)
+		fprintf(out, " %02x", chip->V[i]);
+	fprintf(out, "\n[%s] stack:", name);
+	for (i = 0; i < chip->sp && i < 16; i++)
+		fprintf(out, " %03x", chip->stack[i]);
+	fprintf(out, "\n");
+}
+
+static void dumpDifferences(FILE *out, const Chip8 *a, const Chip8 *b) {
+	unsigned int i;
+	if (a->width != b->width || a->height != b->height)
+		fprintf(out, "screen mode: %ux%u != %ux%u\n", a->width, a->height, b->width, b->height);
+	for (i = 0; i < MAX_WIDTH * MAX_HEIGHT; i++) {
+		unsigned int x = i % MAX_WIDTH, y = i / MAX_WIDTH;
+		if (gfxColor(a, x, y) != gfxColor(b, x, y))
+			fprintf(out, "gfx (%u, %u): %u != %u\n", x, y, gfxColor(a, x, y), gfxColor(b, x, y));
+	}
+	if (a->mem_mask != b->mem_mask)
+		fprintf(out, "memory size: 0x%x != 0x%x\n", a->mem_mask + 1, b->mem_mask + 1);
+	for (i = 0; i <= a->mem_mask && i <= b->mem_mask; i++) {
+		if (memRead(a, i) != memRead(b, i))
+			fprintf(out, "memory[0x%03x]: %02x != %02x\n", i, memRead(a, i), memRead(b, i));
+	}
+}
+
+static void saveProgram(const Program *prog, const char *filename) {
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not write %s\n", filename);
+		return;
+	}
+	fwrite(prog->data, 1, prog->size, fp);
+	fclose(fp);
+	fprintf(stderr, "Program saved to %s\n", filename);
+}
+
+/* Runs one program on both engines, under a random quirk combination, returns 0 when they agree for all cycles */
+static int runLockstep(const Chip8 *base, const Program *prog, const Engine *engine, unsigned int cycles) {
+	Chip8 ref, fast, before;
+	unsigned int i, n;
+	int diverged = 0;
+	char quirks[64];
+
+	chip8_fork(&ref, base);	/* Fork the pristine instance instead of re-initializing it */
+	loadProgramBuffer(&ref, prog->data, prog->size);	/* Variants as the analysis finds them */
+	ref.variants &= ~VARIANT_MACHINE_CODE;	/* Random 0NNN calls would run garbage on the 1802 for its whole budget */
+	ref.quirks = nextRandom() % QUIRK_COMBINATIONS;
+	for (i = 0; i < 16; i++)
+		ref.keypad[i] = (nextRandom() % 4) == 0;
+	ref.rng = nextRandom() | 1;
+
+	chip8_fork(&fast, &ref);
+	for (i = 0; i < cycles && !diverged; i += n) {
+		chip8_fork(&before, &ref);
+		if (engine->step != NULL) {
+			n = 1;
+			emulateCycle(&ref);
+			engine->step(&fast);
+		} else {
+			n = 1 + nextRandom() % 64;
+			if (n > cycles - i)
+				n = cycles - i;
+			emulateFrame(&ref, n);
+			engine->run(&fast, n);
+		}
+
+		const char *field = compareStates(&ref, &fast);
+		if (field != NULL) {
+			formatQuirks(ref.quirks, quirks, sizeof(quirks));
+			fprintf(stderr, "Divergence in %s after cycle %u, in a run of %u from 0x%04x at 0x%03x (quirks %s)\n",
+					field, i + n - 1, n, memRead(&before, before.pc) << 8 | memRead(&before, before.pc + 1), before.pc, quirks);
+			dumpState(stderr, "before", &before);
+			dumpState(stderr, "reference", &ref);
+			dumpState(stderr, engine->name, &fast);
+			dumpDifferences(stderr, &ref, &fast);
+			diverged = 1;
+		}
+		chip8_release(&before);
+	}
+	chip8_release(&ref);
+	chip8_release(&fast);
+	return diverged;
+}
+
+static void usage(const char *name) {
+	unsigned int i;
+	printf("Usage: %s [-e engine] [-n runs] [-c cycles] [-s seed] [-v] [rom ...]\n", name);
+	printf("Given ROMs are used as mutation seeds, otherwise programs are fully random\n");
+	printf("Engines:");
+	for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+		printf(" %s", engines[i].name);
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	const Engine *engine = &engines[sizeof(engines) / sizeof(engines[0]) - 1];
+	unsigned long runs = 100000, run;
+	unsigned int cycles = 1000;
+	int verbose = 0, opt;
+
+	fuzz_rng = (unsigned int)time(NULL) | 1;
+	while ((opt = getopt(argc, argv, "e:n:c:s:vh")) != -1) {
+		switch (opt) {
+			case 'e':
+				engine = findEngine(optarg);
+				if (engine == NULL) {
+					fprintf(stderr, "Unknown engine %s\n", optarg);
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'n': runs = strtoul(optarg, NULL, 0); break;
+			case 'c': cycles = strtoul(optarg, NULL, 0); break;
+			case 's': fuzz_rng = strtoul(optarg, NULL, 0) | 1; break;
+			case 'v': verbose = 1; break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	for (; optind < argc; optind++) {
+		if (!loadCorpusFile(argv[optind]))
+			return -1;
+	}
+
+	/* The interpreters report errors on stdout: keep them quiet unless asked for */
+	if (!verbose && freopen("/dev/null", "w", stdout) == NULL)
+		fprintf(stderr, "Could not silence interpreter output\n");
+
+	fprintf(stderr, "Fuzzing engine %s against reference, seed 0x%08x\n", engine->name, fuzz_rng);
+
+	Chip8 base;
+	initialize(&base);
+	base.debug = 0;
+
+	Program prog;
+	clock_t start = clock();
+	for (run = 0; run < runs; run++) {
+		if (corpus_size > 0 && (nextRandom() % 4) != 0)
+			mutateProgram(&prog, &corpus[nextRandom() % corpus_size]);
+		else
+			generateProgram(&prog);
+
+		if (runLockstep(&base, &prog, engine, cycles)) {
+			saveProgram(&prog, "fuzz-divergence.ch8");
+			return 1;
+		}
+	}
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	fprintf(stderr, "%lu programs, no divergence (%.0f programs/s)\n", runs, elapsed > 0 ? runs / elapsed : 0.0);
+	return 0;
+}
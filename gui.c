@@ -1,68 +1,40 @@
 #include "gui.h"
-
-static const char keycodes[2][16] = {{'x','1', '2', '3', 'q', 'w', 'e', 'a', 's', 'd', 'z', 'c', '4', 'r', 'f', 'v'}, {'x','1','2','3','a','z','e','q','s','d','w','c','4','r','f','v'}};
-
-const char *vertexShaderSource = 
-	"#version 330 core\n"
-	"layout (location = 0) in vec3 aPos;\n"
-    	"void main()\n"
-    	"{\n"
-    	"   gl_Position = vec4(aPos.x, aPos.y, aPos.z, 1.0);\n"
-    	"}\0";
-
-const char *fragmentShaderSource = 
-	"#version 330 core\n"
-    	"out vec4 FragColor;\n"
-	"uniform vec4 color;\n"
-    	"void main()\n"
-    	"{\n"
-    	"   FragColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);\n"
-    	"}\n\0";
-
-int createVertices(unsigned char gfx[WIDTH*HEIGHT], unsigned int **indices) {
-	if (*indices != NULL) { 
-		free(*indices);
-	}
-	*indices = calloc(HEIGHT*WIDTH*6, sizeof(unsigned int));
-	unsigned int currentIndex = 0;
-	int i, j;
-	for (j = 0; j < HEIGHT ; j++) {
-		for (i = 0; i < WIDTH; i++) {
-			if (gfx[WIDTH*j+i]) { /* If the pixel is set to 1 */
-				/* Create the pixel (rectangle composed of 2 triangles) */
-
-				/* Triangle 1 */
-				(*indices)[currentIndex++] = (WIDTH+1)*j + i;		/* Top left  */
-				(*indices)[currentIndex++] = (WIDTH+1)*j + i + 1;	/* Top right */
-				(*indices)[currentIndex++] = (WIDTH+1)*(j + 1) + i;	/* Bottom left */
-
-				/* Triangle 2 */
-				(*indices)[currentIndex++] = (WIDTH+1)*(j + 1) + i;	/* Bottom left */
-				(*indices)[currentIndex++] = (WIDTH+1)*(j + 1) + i + 1;	/* Bottom right */
-				(*indices)[currentIndex++] = (WIDTH+1)*j + i + 1;	/* Top right */
-			}
-		}
+#include "latency.h"
+#include "record.h"
+#include "shm.h"
+#include "control.h"
+#include "render.h"
+
+/* Set when the window needs to be redrawn even if the framebuffer did not change */
+static int window_resized = 1;
+
+/* State shared with the GLFW callbacks through the window user pointer */
+typedef struct gui_context {
+	Scheduler sched;
+	Renderer renderer;
+	LatencyStats *latency;	/* NULL unless latency is measured */
+} GuiContext;
+
+/* Sleep until the given time, handling (and timestamping) events as they arrive */
+static void waitUntil(double time) {
+	double remaining;
+	while ((remaining = time - glfwGetTime()) > 0) {
+		glfwWaitEventsTimeout(remaining);
 	}
-	return currentIndex;
 }
 
-
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-	Chip8 *chip_ref = glfwGetWindowUserPointer(window);
-	chip_ref->update_screen = 1;
-	if (height >= width/2) {
-		glViewport(0, (height/2) - (width/4), width, width/2);
-		glScissor(0,(height/2)- (width/4), width, width/2);
-	} else {
-		glViewport(0,0, width, height);
-		glScissor(0,0, width, height);
-	}
+	GuiContext *context = glfwGetWindowUserPointer(window);
+	context->sched.chip->update_screen = 1;
+	window_resized = 1;
+	rendererResize(&context->renderer, width, height);
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	const char *key_name = glfwGetKeyName(key, scancode);
 	int i;
-	Chip8 *chip_ref = glfwGetWindowUserPointer(window);
+	GuiContext *context = glfwGetWindowUserPointer(window);
+	Chip8 *chip_ref = context ? context->sched.chip : NULL;
 
 	if (key == GLFW_KEY_TAB && action == GLFW_RELEASE) {
 		if (chip_ref == NULL)
@@ -72,25 +44,19 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	
 	} else if ((action == GLFW_PRESS || action == GLFW_RELEASE) && key_name != NULL) {
 		
+		if (chip_ref == NULL) {
+			return;
+		}	
+
 		/* Check which key was pressed or released */
-		for (i = 0; i < 16; i++) {
-			if (keycodes[chip_ref->key_layout][i] == key_name[0]) 
-				break;
-		}
-		if (i != 16) {
-			if (chip_ref == NULL) {
-				return;
-			}	
-
-			if (i > 0xF) {
-				printf("Invalid keycode!\n");
-				return;
-			}
+		i = keymapLookup(chip_ref->key_layout, key_name[0]);
+		if (i >= 0) {
 			
-			if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-				chip_ref->keypad[i] = 1;
-			} else {
-				chip_ref->keypad[i] = 0;
+			/* Applied by the scheduler at the emulated cycle matching the time of the event */
+			double now = glfwGetTime();
+			schedulerQueueKey(&context->sched, now, i, action == GLFW_PRESS || action == GLFW_REPEAT);
+			if (context->latency != NULL && action == GLFW_PRESS) {
+				latencyKeyPressed(context->latency, &context->sched, now);
 			}
 		}
 	}
@@ -102,7 +68,13 @@ void processInput(GLFWwindow *window) {
 		glfwSetWindowShouldClose(window, 1);
 }
 
-int runGUI(Chip8 *chip8) {
+int runGUI(Chip8 *chip8, const GuiOptions *options) {
+	GuiContext context;
+	LatencyStats latency;
+	Chip8 ahead;	/* Run-ahead fork being displayed */
+	memset(&ahead, 0, sizeof(ahead));
+	context.latency = options->measure_latency ? &latency : NULL;
+	latencyInit(&latency);
 	
 	/* GLFW Initialization and configuration */
 	glfwInit();
@@ -131,8 +103,8 @@ int runGUI(Chip8 *chip8) {
 	/* Call key_callback() each time a key is pressed or released */
 	glfwSetKeyCallback(window, key_callback);
 
-	/* Save chip struct to be used in other functions */
-	glfwSetWindowUserPointer(window, chip8);
+	/* Save the scheduler (and through it the chip struct) to be used in other functions */
+	glfwSetWindowUserPointer(window, &context);
 
 	/* GLAD: Load all OpenGL function pointers (Operating System specific) */
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -140,125 +112,85 @@ int runGUI(Chip8 *chip8) {
 		return -1;
 	}
 
-	/* Vertex shader */
-	unsigned int vertexShader;
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL); /* Attach shader source to the shader object */
-	glCompileShader(vertexShader); /* Compile shader */
-	
-	int success;
-	char infoLog[512];
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-
-	if (!success) {
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		printf("[ERROR] Vertex shader compilation failed!\n");
-		printf("%s\n", infoLog);
-	} else {
-		printf("Vertex shader compiled\n");
-	}
-
-	/* Fragment shader */ 
-	unsigned int fragmentShader;
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
-	
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		printf("[ERROR] Fragment shader compilation failed!\n");
-		printf("%s\n", infoLog);
-	} else {
-		printf("Fragment shader compiled\n");
-	}
-	
-	/* Shader program - linking vertex and fragment shaders together */
-	unsigned int shaderProgram;
-	shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-	
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, & success);
-	if (!success) {
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		printf("[ERROR] Shader program linking failed!\n");
-		printf("%s\n", infoLog);
-	} else {
-		printf("Shader program created\n");
-	}
-
-	/* Delete objects after linking */
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-
-	/* Calculate the normalized coordinates of each vertex */
-	/******************************************************/
-	int y, x;
-	int number_vertices = (WIDTH+1)*(HEIGHT+1);
-	float width = (float)WIDTH;
-	float height = (float)HEIGHT;
-	float points[ 2*number_vertices ]; /* 2 times the number of vertices to store the x and y coordinates */
-	for (y = 0; y < HEIGHT+1; y++) {
-		for(x = 0; x < WIDTH+1; x++) {
-			points[2*(WIDTH+1)*y + 2*x] = ( -1.0f + x * 2.0f / width );
-			points[2*(WIDTH+1)*y + 2*x + 1] = ( 1.0f  - y * 2.0f / height ); /* Only works if height <= width */
-		}
+	/* Shaders, vertex grid and the initial framebuffer, drawn in the area of the 800x600 window */
+	if (!rendererInit(&context.renderer, chip8, 800, 600)) {
+		glfwTerminate();
+		return -1;
 	}
-	unsigned int indices_len;
-	unsigned int *indices = NULL;
-	/* Data to send */
-	indices_len = createVertices(chip8->gfx, &indices);
-	/******************************************************/
-
-	/* Vertex Buffer Object (VBO), Vertex Array Object (VAO) and Element Buffer Object (EBO) */
-	unsigned int VBO, VAO, EBO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO); /* Generate 1 Buffer object and store its ID in VBO */
-	glGenBuffers(1, &EBO);
-	
-	glBindVertexArray(VAO); /* Bind VAO first */
-
-	/* Bind the vertex buffer to the GL_ARRAY_BUFFER target (type of a vertex buffer object) */
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	
-	/* Load data into the buffer's memory */
-	glBufferData(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW); 
-
-	/* Same with EBO */
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*indices_len, indices, GL_DYNAMIC_DRAW);
-
-	/* Telling OpenGL how to interpret the data */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2* sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0); /* Enable the vertex attribute */
 
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 
 	double previousTime = glfwGetTime();
 	unsigned int frameCount = 0;
-	unsigned int cycleCount = 0; 
 	
-	/* Enable V-Sync */
-	glfwSwapInterval(1);
+	/* Enable V-Sync, unless frames are presented as soon as they are ready */
+	glfwSwapInterval(options->low_latency ? 0 : 1);
 
 	/*glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);*/
+
+	schedulerInit(&context.sched, chip8, options->cycles_per_frame, glfwGetTime());
+	context.sched.immediate_input = options->jit_input;
+
+	Recorder *recorder = NULL;
+	if (options->record_path != NULL) {
+		unsigned int width, height;
+		largestScreenMode(chip8, &width, &height);
+		recorder = recorderOpen(options->record_path, width, height, FRAME_RATE);
+		if (recorder != NULL) {
+			schedulerAddObserver(&context.sched, recorderFrame, recorder);
+		}
+	}
+	ShmPublisher *publisher = NULL;
+	if (options->shm_name != NULL) {
+		publisher = shmOpen(options->shm_name);
+		if (publisher != NULL) {
+			schedulerAddObserver(&context.sched, shmPublish, publisher);
+		}
+	}
+	Control *control = NULL;
+	if (options->control_path != NULL) {
+		control = controlOpen(options->control_path, &context.sched, options->quirks);
+	}
+
+	const double period = 1.0 / FRAME_RATE;
+	double deadline = glfwGetTime() + period;	/* When the current frame is due */
+	double workTime = 0.0;				/* Average time spent emulating and rendering a frame */
 	
-	/* Initial settings */
-	glViewport(0, 100, 800, 400);
-	glScissor(0,100, 800, 400);
-	
-	/* Render loop */
+	/* Render loop: events are pumped once per host frame, then a whole emulated frame is run */
 	while(!glfwWindowShouldClose(window)) {
+		if (options->jit_input) {
+			/* Leave just enough time to emulate and draw the frame with the freshest input */
+			waitUntil(deadline - 1.5 * workTime - 0.001);
+		}
+		double frameStart = glfwGetTime();
+		int presented = 0;
 
-		emulateCycle(chip8);
-		cycleCount++;
-		/* Wait at least 15 cycles before updating the screen - if running at 60 fps, we are executing at least 900 operations per second */		
-		if (chip8->update_screen && cycleCount >= 15) {
-			indices_len = createVertices(chip8->gfx, &indices);
+		glfwPollEvents();
+		if (control != NULL && !controlPoll(control, 0)) {
+			glfwSetWindowShouldClose(window, 1);
+		}
+		schedulerRunFrame(&context.sched, frameStart);
+		if (context.latency != NULL) {
+			latencyFrame(context.latency, &context.sched, frameStart);
+		}
+
+		Chip8 *display = chip8;
+		if (options->run_ahead > 0) {
+			schedulerRunAhead(&context.sched, &ahead, options->run_ahead);
+			display = &ahead;
+			/* The previous prediction may differ from this one anywhere */
+			markAllDirty(display);
+			display->update_screen = 1;
+			clearDirty(chip8);
 			chip8->update_screen = 0;
-			cycleCount = 0;
+		}
+
+		if (display->update_screen) {
+			presented = rendererUpdate(&context.renderer, display) || window_resized;
+		}
+
+		if (presented) {
+			window_resized = 0;
 
  			/* Measure fps */
     			double currentTime = glfwGetTime();
@@ -274,38 +206,44 @@ int runGUI(Chip8 *chip8) {
         			previousTime = currentTime;
     			}
 
-			/* Draw background */
-			glDisable(GL_SCISSOR_TEST);
-			glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
-			glClear(GL_COLOR_BUFFER_BIT);
-			glEnable(GL_SCISSOR_TEST);
-
-			/* Rendering */
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices_len, indices, GL_DYNAMIC_DRAW);
-	
-			glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-			glClear(GL_COLOR_BUFFER_BIT);
-		
-			glUseProgram(shaderProgram);
-			glBindVertexArray(VAO);
-			glDrawElements(GL_TRIANGLES, indices_len, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
-
+			rendererDraw(&context.renderer);
 			glfwSwapBuffers(window);
+			if (options->low_latency || options->measure_latency) {
+				/* Do not let the driver queue frames ahead, and time the swap when it really happened */
+				glFinish();
+			}
+			if (context.latency != NULL) {
+				latencyPresented(context.latency, &context.sched, display, options->run_ahead, glfwGetTime());
+			}
+		}
+		workTime = 0.9 * workTime + 0.1 * (glfwGetTime() - frameStart);
+
+		if (!presented || options->low_latency) {
+			/* No swap waited for V-Sync: sleep for the rest of the frame, events are still queued as they come */
+			waitUntil(deadline);
+		}
+		deadline += period;
+		if (deadline < glfwGetTime()) {
+			deadline = glfwGetTime() + period; /* Fell behind (or waited on V-Sync): resynchronize */
 		}
-		glfwPollEvents();
 	}
 
-	/* Clear allocated memory */
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	
-	if (indices) {
-		free(indices);
-		indices = NULL;
+	if (context.latency != NULL) {
+		latencyReport(context.latency, stdout);
+		latencyRelease(context.latency);
+	}
+	chip8_release(&ahead);
+	if (recorder != NULL) {
+		recorderClose(recorder);
+	}
+	if (publisher != NULL) {
+		shmClose(publisher);
+	}
+	if (control != NULL) {
+		controlClose(control);
 	}
 
+	rendererFree(&context.renderer);
 	glfwTerminate();
 	return 0;
 
@@ -1,5 +1,23 @@
+#ifndef GUI_H
+#define GUI_H
+
 #include "chip8.h"
+#include "scheduler.h"
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 
-int runGUI(Chip8 *chip8);
+typedef struct gui_options {
+	unsigned int cycles_per_frame;	/* Instructions executed per 60 Hz frame, or VIP_TIMING */
+	unsigned char measure_latency;	/* Print a histogram of key press to screen latency on exit */
+	unsigned char low_latency;	/* No V-Sync queueing, frames are paced by a timer and presented as soon as they are emulated */
+	unsigned char jit_input;	/* Sleep through most of the frame and sample input just before emulating it */
+	unsigned int run_ahead;		/* Frames emulated ahead of the real state for display, 0 to disable */
+	const char *record_path;	/* Record every emulated frame to this file, NULL to disable */
+	const char *shm_name;		/* Publish the state of every frame in this shared-memory segment, NULL to disable */
+	const char *control_path;	/* Serve the control socket (see control.h) at this path, NULL to disable */
+	int quirks;			/* -q override of the ROM database's quirks, also for programs loaded through the socket, -1 for none */
+} GuiOptions;
+
+int runGUI(Chip8 *chip8, const GuiOptions *options);
+
+#endif
@@ -0,0 +1,132 @@
+#include "scheduler.h"
+#include "record.h"
+#include "shm.h"
+#include "control.h"
+#include "pack.h"
+#include <unistd.h>
+
+/* Runs a ROM without any display for a fixed number of frames, for regression runs, or serves
+ * the control socket (see control.h) until a client asks it to quit */
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-c cycles per frame|vip] [-n frames] [-r recording] [-m shm name] [-s socket] [-p pack] [-q quirks] <filename>\n", name);
+	printf("  -p  Look the ROM up in a ROM pack (see chip8-pack), by name or content hash\n");
+}
+
+int main(int argc, char *argv[]) {
+	Chip8 chip8;
+	Scheduler sched;
+	Recorder *recorder = NULL;
+	const char *record_path = NULL, *shm_name = NULL, *socket_path = NULL, *pack_path = NULL;
+	ShmPublisher *publisher = NULL;
+	Control *control = NULL;
+	unsigned int cycles = CYCLES_PER_FRAME;
+	unsigned long long frames = 600, frame;
+	int opt, quirks = -1;
+	double start, elapsed = 0;
+
+	while ((opt = getopt(argc, argv, "c:n:r:m:s:p:q:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				if ((cycles = parseCyclesPerFrame(optarg)) == 0) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'n': frames = strtoull(optarg, NULL, 0); break;
+			case 'r': record_path = optarg; break;
+			case 'm': shm_name = optarg; break;
+			case 's': socket_path = optarg; break;
+			case 'p': pack_path = optarg; break;
+			case 'q':
+				if ((quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc && socket_path == NULL) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	initialize(&chip8);
+	chip8.debug = 0;
+	if (optind < argc && pack_path != NULL) {
+		RomPack pack;
+		const PackEntry *entry;
+		if (!packOpen(&pack, pack_path)) {
+			return -1;
+		}
+		if ((entry = packFind(&pack, argv[optind])) == NULL) {
+			fprintf(stderr, "%s is not in %s\n", argv[optind], pack_path);
+			return -1;
+		}
+		packLoad(&pack, entry, &chip8);
+		packClose(&pack);
+	} else if (optind < argc && !loadProgram(&chip8, argv[optind])) {
+		return -1;
+	}
+	if (quirks >= 0) {
+		chip8.quirks = quirks;
+	}
+
+	schedulerInit(&sched, &chip8, cycles, 0.0);
+	if (record_path != NULL) {
+		unsigned int width, height;
+		largestScreenMode(&chip8, &width, &height);
+		recorder = recorderOpen(record_path, width, height, FRAME_RATE);
+		if (recorder == NULL) {
+			return -1;
+		}
+		schedulerAddObserver(&sched, recorderFrame, recorder);
+	}
+	if (shm_name != NULL) {
+		publisher = shmOpen(shm_name);
+		if (publisher == NULL) {
+			return -1;
+		}
+		schedulerAddObserver(&sched, shmPublish, publisher);
+	}
+
+	if (socket_path != NULL) {
+		control = controlOpen(socket_path, &sched, quirks);
+		if (control == NULL) {
+			return -1;
+		}
+		while (controlPoll(control, -1)) {
+			/* Frames are only run on request */
+		}
+		controlClose(control);
+		frames = sched.frames;
+	} else {
+		/* Emulated time only: run as fast as possible */
+		start = now();
+		for (frame = 1; frame <= frames; frame++) {
+			schedulerRunFrame(&sched, (double)frame / FRAME_RATE);
+		}
+		elapsed = now() - start;
+	}
+
+	if (recorder != NULL) {
+		recorderClose(recorder);
+	}
+	if (publisher != NULL) {
+		shmClose(publisher);
+	}
+	printf("%llu frames, screen hash %016llx, state hash %016llx\n", frames, chip8_gfx_hash(&chip8), chip8_hash(&chip8));
+	if (elapsed > 0) {
+		/* Throughput that does not depend on the instructions per frame */
+		printf("%.1f emulated seconds per host second\n", schedulerEmulatedSeconds(&sched) / elapsed);
+	}
+	chip8_release(&chip8);
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include "latency.h"
+#include "megachip.h"
+
+void latencyInit(LatencyStats *stats) {
+	unsigned int i;
+	stats->pending = -1.0;
+	memset(&stats->quiet, 0, sizeof(stats->quiet));
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		stats->histogram[i] = 0;
+	}
+	stats->count = 0;
+	stats->total = 0.0;
+	stats->max = 0.0;
+}
+
+void latencyRelease(LatencyStats *stats) {
+	chip8_release(&stats->quiet);
+}
+
+/* Called when the press is queued, before the scheduler runs the frame that applies it */
+void latencyKeyPressed(LatencyStats *stats, const Scheduler *sched, double time) {
+	/* Presses made while waiting for the screen to react are attributed to the first one */
+	if (stats->pending >= 0) {
+		return;
+	}
+	stats->pending = time;
+	chip8_release(&stats->quiet);
+	chip8_fork(&stats->quiet, sched->chip);
+	stats->quiet_credit = sched->vip_credit;
+	stats->quiet_waiting = sched->vip_waiting;
+}
+
+/* Called after every emulated frame: the fork follows the machine, without the press */
+void latencyFrame(LatencyStats *stats, const Scheduler *sched, double time) {
+	if (stats->pending < 0) {
+		return;
+	}
+	if (time - stats->pending > LATENCY_TIMEOUT) {
+		/* The program ignored the press (or drew the same thing anyway): not a sample */
+		stats->pending = -1.0;
+		return;
+	}
+	schedulerRunFork(sched, &stats->quiet, &stats->quiet_credit, &stats->quiet_waiting);
+}
+
+static int screenDiffers(const Chip8 *a, const Chip8 *b) {
+	if (a->width != b->width || a->height != b->height || a->mega_on != b->mega_on) {
+		return 1;
+	}
+	if (a->mega_on) {
+		unsigned int i;
+		for (i = 0; i < MEGA_BANDS; i++) {
+			if (memcmp(megaShownBand(a, i), megaShownBand(b, i), sizeof(a->mega->bands[0][0]->pixels)) != 0) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+	return memcmp(a->gfx, b->gfx, sizeof(a->gfx)) != 0;
+}
+
+/* Called once a frame with a changed framebuffer has been handed to the display. The press caused
+ * the change only if the machine that never saw it shows something else: a program animating on
+ * its own, or still drawing the frame before the press was read, does not close the sample. With
+ * run-ahead, display is ahead frames past the machine */
+void latencyPresented(LatencyStats *stats, const Scheduler *sched, const Chip8 *display, unsigned int ahead, double time) {
+	if (stats->pending < 0) {
+		return;
+	}
+	if (ahead > 0) {
+		/* display is run ahead of the machine: so is the fork it is compared with */
+		Chip8 quiet;
+		int credit = stats->quiet_credit;
+		unsigned char waiting = stats->quiet_waiting, differs;
+		chip8_fork(&quiet, &stats->quiet);
+		while (ahead--) {
+			schedulerRunFork(sched, &quiet, &credit, &waiting);
+		}
+		differs = screenDiffers(display, &quiet);
+		chip8_release(&quiet);
+		if (!differs) {
+			return;
+		}
+	} else if (!screenDiffers(display, &stats->quiet)) {
+		return;
+	}
+	double latency = time - stats->pending;
+	unsigned int bucket = (unsigned int)(latency * 1000.0 / LATENCY_BUCKET_MS);
+	if (bucket >= LATENCY_BUCKETS) {
+		bucket = LATENCY_BUCKETS - 1;
+	}
+	stats->histogram[bucket]++;
+	stats->count++;
+	stats->total += latency;
+	if (latency > stats->max) {
+		stats->max = latency;
+	}
+	stats->pending = -1.0;
+}
+
+void latencyReport(const LatencyStats *stats, FILE *out) {
+	unsigned int i, j, peak = 1;
+	if (stats->count == 0) {
+		fprintf(out, "Input latency: no samples\n");
+		return;
+	}
+	fprintf(out, "Input latency: %u samples, mean %.1f ms, max %.1f ms\n",
+			stats->count, stats->total * 1000.0 / stats->count, stats->max * 1000.0);
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (stats->histogram[i] > peak) {
+			peak = stats->histogram[i];
+		}
+	}
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (stats->histogram[i] == 0) {
+			continue;
+		}
+		if (i == LATENCY_BUCKETS - 1) {
+			fprintf(out, "   >=%3u ms %6u ", i * LATENCY_BUCKET_MS, stats->histogram[i]);
+		} else {
+			fprintf(out, "%3u-%3u ms %6u ", i * LATENCY_BUCKET_MS, (i + 1) * LATENCY_BUCKET_MS, stats->histogram[i]);
+		}
+		for (j = 0; j < stats->histogram[i] * 40 / peak; j++) {
+			fputc('#', out);
+		}
+		fputc('\n', out);
+	}
+}
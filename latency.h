@@ -0,0 +1,31 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include "scheduler.h"
+
+#define LATENCY_BUCKET_MS 2	/* Width of a histogram bucket */
+#define LATENCY_BUCKETS 50	/* The last bucket also counts everything slower */
+#define LATENCY_TIMEOUT 1.0	/* Seconds after which a press that changed nothing is dropped */
+
+/* Input-to-photon latency: time from a key press to the first presented frame whose framebuffer
+ * differs from the one the machine would have shown without the press */
+typedef struct latency_stats {
+	double pending;		/* Time of the oldest key press not yet followed by a visible change, < 0 if none */
+	Chip8 quiet;		/* Fork taken before the frame applying the pending press, emulated without any input */
+	int quiet_credit;	/* and its VIP timing state */
+	unsigned char quiet_waiting;
+	unsigned int histogram[LATENCY_BUCKETS];
+	unsigned int count;
+	double total;
+	double max;
+} LatencyStats;
+
+void latencyInit(LatencyStats *stats);
+void latencyRelease(LatencyStats *stats);
+void latencyKeyPressed(LatencyStats *stats, const Scheduler *sched, double time);
+void latencyFrame(LatencyStats *stats, const Scheduler *sched, double time);
+void latencyPresented(LatencyStats *stats, const Scheduler *sched, const Chip8 *display, unsigned int ahead, double time);
+void latencyReport(const LatencyStats *stats, FILE *out);
+
+#endif
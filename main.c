@@ -1,18 +1,64 @@
 #include "gui.h"
+#include <unistd.h>
 
 int main(int argc, char *argv[]) {
 	
 	Chip8 chip8;
-	initialize(&chip8);	
-	if (argc == 1) {
-		printf("Usage: %s <filename>\n", argv[0]);
+	GuiOptions options = { CYCLES_PER_FRAME, 0, 0, 0, 0, NULL, NULL, NULL, -1 };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:lLja:r:m:s:q:")) != -1) {
+		switch (opt) {
+			case 'c': /* Instructions per frame, or vip */
+				if ((options.cycles_per_frame = parseCyclesPerFrame(optarg)) == 0) {
+					printf("Usage: %s [-c cycles per frame|vip] [-l] [-L] [-j] [-a frames] [-r recording] [-m shm name] [-s socket] [-q quirks] <filename>\n", argv[0]);
+					return -1;
+				}
+				break;
+			case 'l': /* Measure input latency */
+				options.measure_latency = 1;
+				break;
+			case 'L': /* Low-latency presentation */
+				options.low_latency = 1;
+				break;
+			case 'j': /* Just-in-time input sampling */
+				options.jit_input = 1;
+				break;
+			case 'a': /* Run-ahead frames */
+				options.run_ahead = strtoul(optarg, NULL, 0);
+				break;
+			case 'r': /* Record frames */
+				options.record_path = optarg;
+				break;
+			case 'm': /* Shared-memory export */
+				options.shm_name = optarg;
+				break;
+			case 's': /* Control socket */
+				options.control_path = optarg;
+				break;
+			case 'q': /* Quirks, instead of the ROM database's */
+				if ((options.quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			default:
+				printf("Usage: %s [-c cycles per frame|vip] [-l] [-L] [-j] [-a frames] [-r recording] [-m shm name] [-s socket] [-q quirks] <filename>\n", argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc && options.control_path == NULL) {
+		printf("Usage: %s [-c cycles per frame|vip] [-l] [-L] [-j] [-a frames] [-r recording] [-m shm name] [-s socket] [-q quirks] <filename>\n", argv[0]);
 		return 0;
 	}	
- 	if (!loadProgram(chip8.memory, argv[1])) {
+
+	initialize(&chip8);	
+ 	if (optind < argc && !loadProgram(&chip8, argv[optind])) {
 		return-1;
 	}
+	if (options.quirks >= 0) {
+		chip8.quirks = options.quirks;
+	}
 
 	int exit_code = 0;
-	exit_code = runGUI(&chip8);	
+	exit_code = runGUI(&chip8, &options);	
 	return exit_code;
 }
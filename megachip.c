@@ -0,0 +1,417 @@
+#include "megachip.h"
+
+typedef unsigned char u8x16 __attribute__((vector_size(16)));
+typedef unsigned short u16x16 __attribute__((vector_size(32)));
+typedef unsigned int u32x4 __attribute__((vector_size(16)));
+
+/* Black band shared by every cleared screen; its own reference keeps it from being written or freed */
+static MegaBand black_band = { 1, 0, {{{0}}}, {{0}} };
+
+static void releaseBand(MegaBand *band) {
+	if (__atomic_sub_fetch(&band->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(band);
+}
+
+/* Points every band of the screen to the black one */
+static void clearScreen(MegaChip *mega, unsigned int screen) {
+	unsigned int b;
+	for (b = 0; b < MEGA_BANDS; b++) {
+		if (mega->bands[screen][b] == &black_band)
+			continue;
+		if (mega->bands[screen][b] != NULL)
+			releaseBand(mega->bands[screen][b]);
+		__atomic_add_fetch(&black_band.refs, 1, __ATOMIC_RELAXED);
+		mega->bands[screen][b] = &black_band;
+	}
+}
+
+/* Band b of a screen, copied first if another screen or fork shares it */
+static MegaBand *writableBand(MegaChip *mega, unsigned int screen, unsigned int b) {
+	MegaBand *band = mega->bands[screen][b];
+	if (__atomic_load_n(&band->refs, __ATOMIC_ACQUIRE) != 1) {
+		MegaBand *copy = malloc(sizeof(MegaBand));
+		if (copy == NULL) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(-1);
+		}
+		memcpy(copy, band, sizeof(MegaBand));
+		copy->refs = 1;
+		releaseBand(band);
+		mega->bands[screen][b] = band = copy;
+	}
+	band->hash = 0;
+	return band;
+}
+
+static unsigned long long paletteHash(const MegaChip *mega) {
+	const unsigned char *bytes = &mega->palette[0][0];
+	unsigned long long h = 0, word;
+	unsigned int i;
+	for (i = 0; i < sizeof(mega->palette); i += 8) {
+		memcpy(&word, bytes + i, 8);
+		h = mix64(h ^ word);
+	}
+	return h;
+}
+
+MegaChip *megaCreate(void) {
+	MegaChip *mega = calloc(1, sizeof(MegaChip));
+	if (mega == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	mega->sprite_width = 256;
+	mega->sprite_height = 256;
+	mega->alpha = 255;
+	mega->palette_hash = paletteHash(mega);
+	clearScreen(mega, 0);
+	clearScreen(mega, 1);
+	return mega;
+}
+
+MegaChip *megaClone(const MegaChip *src) {
+	unsigned int s, b;
+	MegaChip *mega = malloc(sizeof(MegaChip));
+	if (mega == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	memcpy(mega, src, sizeof(MegaChip));
+	for (s = 0; s < 2; s++) {
+		for (b = 0; b < MEGA_BANDS; b++)
+			__atomic_add_fetch(&mega->bands[s][b]->refs, 1, __ATOMIC_RELAXED);
+	}
+	return mega;
+}
+
+void megaRelease(MegaChip *mega) {
+	unsigned int s, b;
+	if (mega == NULL)
+		return;
+	for (s = 0; s < 2; s++) {
+		for (b = 0; b < MEGA_BANDS; b++)
+			releaseBand(mega->bands[s][b]);
+	}
+	free(mega);
+}
+
+/* Same registers and screens: bands still shared are equal by construction */
+int megaEqual(const MegaChip *a, const MegaChip *b) {
+	unsigned int s, i;
+	if (memcmp(a->palette, b->palette, sizeof(a->palette)) != 0 || a->sprite_width != b->sprite_width ||
+			a->sprite_height != b->sprite_height || a->blend != b->blend || a->collision != b->collision ||
+			a->alpha != b->alpha || a->drawing != b->drawing || a->frames != b->frames ||
+			a->sample_addr != b->sample_addr || a->sample_length != b->sample_length || a->sample_rate != b->sample_rate ||
+			a->sample_loop != b->sample_loop || a->sample_playing != b->sample_playing)
+		return 0;
+	for (s = 0; s < 2; s++) {
+		for (i = 0; i < MEGA_BANDS; i++) {
+			const MegaBand *x = a->bands[s][i], *y = b->bands[s][i];
+			if (x != y && (memcmp(x->pixels, y->pixels, sizeof(x->pixels)) != 0 || memcmp(x->indices, y->indices, sizeof(x->indices)) != 0))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* len bytes of memory from addr, a page at a time */
+static void memReadBlock(const Chip8 *chip, unsigned int addr, unsigned char *dst, unsigned int len) {
+	while (len > 0) {
+		unsigned int offset = (addr & chip->mem_mask) & (MEM_PAGE_SIZE - 1);
+		unsigned int chunk = MEM_PAGE_SIZE - offset < len ? MEM_PAGE_SIZE - offset : len;
+		memcpy(dst, chip->pages[(addr & chip->mem_mask) >> MEM_PAGE_SHIFT]->data + offset, chunk);
+		addr += chunk;
+		dst += chunk;
+		len -= chunk;
+	}
+}
+
+unsigned int megaInstruction(Chip8 *chip, unsigned short opcode, unsigned short pc) {
+	MegaChip *mega = chip->mega;
+	unsigned int nn = opcode & 0x00FF, i;
+
+	switch (opcode & 0xFF00) {
+		case 0x0000:
+			if (opcode == 0x0010 || opcode == 0x0011) { /* MEGAON / MEGAOFF -- Switch the MegaChip mode */
+				if (chip->debug) {
+					printf(opcode == 0x0010 ? "MEGAON\n" : "MEGAOFF\n");
+				}
+				chip->mega_on = opcode == 0x0010;
+				clearScreen(mega, 0);
+				clearScreen(mega, 1);
+				mega->frames++;
+				markAllDirty(chip);
+				chip->update_screen = 1;
+				return 2;
+			}
+			if ((opcode & 0xFFF0) == 0x00B0) { /* SCU N -- Scroll the MegaChip screen up by N lines */
+				if (chip->debug) {
+					printf("SCU %x\n", opcode & 0x000F);
+				}
+				if (chip->mega_on)
+					megaScroll(chip, 0, -(int)(opcode & 0x000F));
+				return 2;
+			}
+			return 0;
+
+		case 0x0100: /* LDHI I, NNNNNN -- I = the 24-bit NN followed by the next word */
+			chip->index_reg = nn << 16 | memRead(chip, pc + 2) << 8 | memRead(chip, pc + 3);
+			if (chip->debug) {
+				printf("LDHI I, %x\n", chip->index_reg);
+			}
+			return 4;
+
+		case 0x0200: /* LDPAL NN -- Palette entries 1 to NN from I, 4 bytes each in ARGB order */
+			if (chip->debug) {
+				printf("LDPAL %x\n", nn);
+			}
+			for (i = 0; i < nn; i++) {
+				unsigned char argb[4];
+				memReadBlock(chip, chip->index_reg + 4 * i, argb, 4);
+				mega->palette[i + 1][0] = argb[1];
+				mega->palette[i + 1][1] = argb[2];
+				mega->palette[i + 1][2] = argb[3];
+				mega->palette[i + 1][3] = argb[0];
+			}
+			mega->palette_hash = paletteHash(mega);
+			return 2;
+
+		case 0x0300: /* SPRW NN -- Sprite width, 0 is 256 */
+		case 0x0400: /* SPRH NN -- Sprite height, 0 is 256 */
+			if (chip->debug) {
+				printf((opcode & 0xFF00) == 0x0300 ? "SPRW %x\n" : "SPRH %x\n", nn);
+			}
+			if ((opcode & 0xFF00) == 0x0300) {
+				mega->sprite_width = nn ? nn : 256;
+			} else {
+				mega->sprite_height = nn ? nn : 256;
+			}
+			return 2;
+
+		case 0x0500: /* ALPHA NN -- Alpha of the whole screen */
+			if (chip->debug) {
+				printf("ALPHA %x\n", nn);
+			}
+			mega->alpha = nn;
+			markAllDirty(chip);
+			chip->update_screen = 1;
+			return 2;
+
+		case 0x0600: /* DIGISND N -- Play the sample at I, looped when N is 0 */
+			if (chip->debug) {
+				printf("DIGISND %x\n", opcode & 0x000F);
+			}
+			mega->sample_addr = chip->index_reg;
+			mega->sample_rate = memRead(chip, chip->index_reg) << 8 | memRead(chip, chip->index_reg + 1);
+			mega->sample_length = memRead(chip, chip->index_reg + 2) << 16 | memRead(chip, chip->index_reg + 3) << 8 |
+					memRead(chip, chip->index_reg + 4);
+			mega->sample_loop = (opcode & 0x000F) == 0;
+			mega->sample_playing = 1;
+			return 2;
+
+		case 0x0700: /* STOPSND -- Stop the sample */
+			if (chip->debug) {
+				printf("STOPSND\n");
+			}
+			mega->sample_playing = 0;
+			return 2;
+
+		case 0x0800: /* BMODE N -- Blend mode of the next sprites */
+			if (chip->debug) {
+				printf("BMODE %x\n", opcode & 0x000F);
+			}
+			mega->blend = (opcode & 0x000F) <= MEGA_BLEND_MULTIPLY ? opcode & 0x000F : MEGA_BLEND_NORMAL;
+			return 2;
+
+		case 0x0900: /* CCOL NN -- Collision color index */
+			if (chip->debug) {
+				printf("CCOL %x\n", nn);
+			}
+			mega->collision = nn;
+			return 2;
+	}
+	return 0;
+}
+
+void megaPresent(Chip8 *chip) {
+	MegaChip *mega = chip->mega;
+	mega->drawing = !mega->drawing;
+	clearScreen(mega, mega->drawing);
+	mega->frames++;
+	chip->update_screen = 1;
+}
+
+/* Moves the screen being drawn by dx columns and dy rows, the area uncovered is cleared */
+void megaScroll(Chip8 *chip, int dx, int dy) {
+	MegaChip *mega = chip->mega;
+	MegaBand *bands[MEGA_BANDS];
+	int y, b, adx = dx < 0 ? -dx : dx;
+	if (adx > MEGA_WIDTH)
+		adx = MEGA_WIDTH;
+	for (b = 0; b < MEGA_BANDS; b++)
+		bands[b] = writableBand(mega, mega->drawing, b);
+#define PIXELS(row) bands[(row) / MEGA_BAND_ROWS]->pixels[(row) % MEGA_BAND_ROWS]
+#define INDICES(row) bands[(row) / MEGA_BAND_ROWS]->indices[(row) % MEGA_BAND_ROWS]
+	for (y = dy > 0 ? MEGA_HEIGHT - 1 : 0; y >= 0 && y < MEGA_HEIGHT; y += dy > 0 ? -1 : 1) {
+		int src = y - dy;
+		if (src < 0 || src >= MEGA_HEIGHT) {
+			memset(PIXELS(y), 0, sizeof(PIXELS(y)));
+			memset(INDICES(y), 0, sizeof(INDICES(y)));
+			continue;
+		}
+		/* Rows never overlap unless dy is 0, memmove() handles that case */
+		if (dx >= 0) {
+			memmove(PIXELS(y)[adx], PIXELS(src)[0], (MEGA_WIDTH - adx) * 4);
+			memmove(&INDICES(y)[adx], &INDICES(src)[0], MEGA_WIDTH - adx);
+			memset(PIXELS(y)[0], 0, adx * 4);
+			memset(&INDICES(y)[0], 0, adx);
+		} else {
+			memmove(PIXELS(y)[0], PIXELS(src)[adx], (MEGA_WIDTH - adx) * 4);
+			memmove(&INDICES(y)[0], &INDICES(src)[adx], MEGA_WIDTH - adx);
+			memset(PIXELS(y)[MEGA_WIDTH - adx], 0, adx * 4);
+			memset(&INDICES(y)[MEGA_WIDTH - adx], 0, adx);
+		}
+	}
+#undef PIXELS
+#undef INDICES
+	chip->update_screen = 1;
+}
+
+/* Combines 4 sprite pixels with 4 screen pixels, RGBA bytes widened to 16 bits so that products fit */
+static inline __attribute__((always_inline)) u8x16 blendPixels(u8x16 src, u8x16 dst, const unsigned int mode) {
+	if (mode == MEGA_BLEND_NORMAL)
+		return src;
+	if (mode == MEGA_BLEND_ADD) {
+		u8x16 sum = src + dst;
+		return sum | (u8x16)(sum < src);	/* Saturate where the byte sum wrapped around */
+	}
+	u16x16 s = __builtin_convertvector(src, u16x16), d = __builtin_convertvector(dst, u16x16), out;
+	switch (mode) {
+		case MEGA_BLEND_25:
+			out = (s * 64 + d * 192) >> 8;
+			break;
+		case MEGA_BLEND_50:
+			out = (s + d) >> 1;
+			break;
+		case MEGA_BLEND_75:
+			out = (s * 192 + d * 64) >> 8;
+			break;
+		default:	/* MEGA_BLEND_MULTIPLY */
+			out = (s * d + 255) >> 8;
+			break;
+	}
+	return __builtin_convertvector(out, u8x16);
+}
+
+/* 16 pixels of a sprite row: index bytes are tested 16 at a time, colors are looked up in the
+ * palette and blended 4 pixels at a time. Returns the pixels that covered the collision color,
+ * non-zero bytes */
+static inline __attribute__((always_inline)) u8x16 drawPixels(MegaChip *mega, const unsigned char *sprite,
+		unsigned char *indices, unsigned char (*pixels)[4], const unsigned int mode) {
+	u8x16 idx, old, drawn, hits, src, dst, opaque;
+	unsigned int q, i, color[16];
+	memcpy(&idx, sprite, 16);
+	memcpy(&old, indices, 16);
+	drawn = (u8x16)(idx != 0);
+	hits = drawn & (u8x16)(old == mega->collision);
+	old = (idx & drawn) | (old & ~drawn);
+	memcpy(indices, &old, 16);
+	for (i = 0; i < 16; i++)
+		memcpy(&color[i], mega->palette[sprite[i]], 4);
+	for (q = 0; q < 4; q++) {
+		/* Built from whole lanes: 4-byte stores read back as one vector would stall store forwarding,
+		 * and spreading the index mask with a byte shuffle needs more than SSE2 */
+		u32x4 index = {sprite[4 * q], sprite[4 * q + 1], sprite[4 * q + 2], sprite[4 * q + 3]};
+		opaque = (u8x16)(index != 0);
+		src = (u8x16)(u32x4){color[4 * q], color[4 * q + 1], color[4 * q + 2], color[4 * q + 3]};
+		memcpy(&dst, pixels[4 * q], 16);
+		src = blendPixels(src, dst, mode);
+		dst = (src & opaque) | (dst & ~opaque);
+		memcpy(pixels[4 * q], &dst, 16);
+	}
+	return hits;
+}
+
+/* One specialized blitter per blend mode, like the interpreters per quirk set */
+static inline __attribute__((always_inline)) unsigned char drawSprite(Chip8 *chip, unsigned int x, unsigned int y, const unsigned int mode) {
+	MegaChip *mega = chip->mega;
+	unsigned int width = mega->sprite_width < MEGA_WIDTH - x ? mega->sprite_width : MEGA_WIDTH - x;
+	unsigned int height = mega->sprite_height < MEGA_HEIGHT - y ? mega->sprite_height : MEGA_HEIGHT - y;
+	unsigned int row, col, i;
+	unsigned char sprite[MEGA_WIDTH];
+	u8x16 hits = {0};
+
+	for (row = 0; row < height; row++) {
+		MegaBand *band = writableBand(mega, mega->drawing, (y + row) / MEGA_BAND_ROWS);
+		unsigned char *indices = band->indices[(y + row) % MEGA_BAND_ROWS];
+		unsigned char (*pixels)[4] = band->pixels[(y + row) % MEGA_BAND_ROWS];
+		memReadBlock(chip, chip->index_reg + row * mega->sprite_width, sprite, width);
+		for (col = 0; col + 16 <= width; col += 16)
+			hits |= drawPixels(mega, sprite + col, indices + x + col, pixels + x + col, mode);
+		if (col < width) {
+			/* Last partial group, through copies padded with transparent pixels */
+			unsigned char tail[16] = {0}, tail_indices[16], tail_pixels[16][4];
+			memcpy(tail, sprite + col, width - col);
+			memcpy(tail_indices, indices + x + col, width - col);
+			memcpy(tail_pixels, pixels + x + col, (width - col) * 4);
+			hits |= drawPixels(mega, tail, tail_indices, tail_pixels, mode);
+			memcpy(indices + x + col, tail_indices, width - col);
+			memcpy(pixels + x + col, tail_pixels, (width - col) * 4);
+		}
+	}
+	if (mega->collision == 0)	/* The background never collides */
+		return 0;
+	for (i = 0; i < 16; i++) {
+		if (hits[i])
+			return 1;
+	}
+	return 0;
+}
+
+#define BLITTER(m) \
+	static unsigned char drawSprite##m(Chip8 *chip, unsigned int x, unsigned int y) { \
+		return drawSprite(chip, x, y, m); \
+	}
+BLITTER(0) BLITTER(1) BLITTER(2) BLITTER(3) BLITTER(4) BLITTER(5)
+
+static unsigned char (*const blitters[MEGA_BLEND_MULTIPLY + 1])(Chip8 *chip, unsigned int x, unsigned int y) = {
+	drawSprite0, drawSprite1, drawSprite2, drawSprite3, drawSprite4, drawSprite5
+};
+
+unsigned char megaDraw(Chip8 *chip, unsigned int x, unsigned int y) {
+	if (x >= MEGA_WIDTH || y >= MEGA_HEIGHT)
+		return 0;
+	return blitters[chip->mega->blend](chip, x, y);
+}
+
+/* Computed once per band contents: forks sharing a band share its hash too. Threads racing on a
+ * shared band store the same value */
+static unsigned long long bandHash(MegaBand *band) {
+	unsigned long long h = __atomic_load_n(&band->hash, __ATOMIC_RELAXED), word;
+	const unsigned char *bytes = &band->pixels[0][0][0];
+	unsigned int i;
+	if (h != 0)
+		return h;
+	for (i = 0; i < sizeof(band->pixels) + sizeof(band->indices); i += 8) {	/* indices follow pixels */
+		memcpy(&word, bytes + i, 8);
+		h = mix64(h ^ word);
+	}
+	h |= h == 0;
+	__atomic_store_n(&band->hash, h, __ATOMIC_RELAXED);
+	return h;
+}
+
+unsigned long long megaHash(const MegaChip *mega) {
+	unsigned long long h = mega->palette_hash;
+	unsigned int s, b;
+	h = mix64(h ^ ((unsigned long long)mega->sprite_width << 48 | (unsigned long long)mega->sprite_height << 32 |
+			mega->blend << 24 | mega->collision << 16 | mega->alpha << 8 | mega->drawing));
+	h = mix64(h ^ mega->frames);
+	h = mix64(h ^ ((unsigned long long)mega->sample_addr << 32 | mega->sample_length));
+	h = mix64(h ^ (mega->sample_rate << 16 | mega->sample_loop << 8 | mega->sample_playing));
+	for (s = 0; s < 2; s++) {
+		for (b = 0; b < MEGA_BANDS; b++)
+			h = mix64(h ^ bandHash(mega->bands[s][b]));
+	}
+	return h;
+}
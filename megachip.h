@@ -0,0 +1,84 @@
+#ifndef MEGACHIP_H
+#define MEGACHIP_H
+
+#include "chip8.h"
+
+/* MegaChip8 (Revival Studios): a 256x192 true-color screen drawn with palettized sprites, on top of
+ * SUPER-CHIP. Its state is only allocated for programs of the variant (Chip8.mega), which start in
+ * the usual screen modes until 0010 switches to the MegaChip one (Chip8.mega_on).
+ *
+ *   0010 / 0011   MegaChip mode on / off        02NN   load NN palette colors (ARGB) from I into 1 to NN
+ *   01NN NNNN     I = NNNNNN (24-bit)           03NN   sprite width NN, 0 is 256
+ *   04NN          sprite height NN, 0 is 256    05NN   screen alpha NN
+ *   060N          play the sample at I, looped when N is 0      0700   stop the sample
+ *   080N          blend mode (MEGA_BLEND_*)     09NN   collision color index NN
+ *   00BN          scroll up N lines
+ *
+ * In MegaChip mode DXYN draws a sprite of one palette index per byte, index 0 being transparent,
+ * clipped at the screen edges; VF is set when it covers a pixel of the collision color. 00E0
+ * presents the screen drawn since the previous one and starts the next one from black */
+
+#define MEGA_WIDTH 256
+#define MEGA_HEIGHT 192
+#define MEGA_BAND_ROWS 8	/* Screens are split in bands of rows, shared copy-on-write between forks like memory pages */
+#define MEGA_BANDS (MEGA_HEIGHT / MEGA_BAND_ROWS)
+
+/* How sprite pixels combine with the screen (080N) */
+#define MEGA_BLEND_NORMAL 0
+#define MEGA_BLEND_25 1		/* Sprite at 25% opacity */
+#define MEGA_BLEND_50 2
+#define MEGA_BLEND_75 3
+#define MEGA_BLEND_ADD 4	/* Saturated sum */
+#define MEGA_BLEND_MULTIPLY 5
+
+/* Rows of a screen, with the palette index of each drawn pixel for collisions */
+typedef struct mega_band {
+	unsigned int refs;		/* Screens using this band (plus one for the shared black band) */
+	unsigned long long hash;	/* Of pixels and indices, 0 until computed: reset by every write */
+	unsigned char pixels[MEGA_BAND_ROWS][MEGA_WIDTH][4];	/* RGBA */
+	unsigned char indices[MEGA_BAND_ROWS][MEGA_WIDTH];
+} MegaBand;
+
+typedef struct megachip {
+	unsigned char palette[256][4];	/* RGBA, entry 0 is transparent */
+	unsigned long long palette_hash;	/* Updated by 02NN, the only instruction changing the palette */
+	unsigned short sprite_width, sprite_height;
+	unsigned char blend;		/* MEGA_BLEND_* */
+	unsigned char collision;	/* Palette index whose pixels collide */
+	unsigned char alpha;		/* Alpha of the whole screen, 255 is opaque */
+
+	/* Screens: bands[drawing] is drawn into, the other one is shown. Cleared bands all point to
+	 * one shared black band, so presenting a frame copies nothing */
+	MegaBand *bands[2][MEGA_BANDS];
+	unsigned char drawing;
+	unsigned long long frames;	/* Screens presented, frontends upload the shown one when it changes */
+
+	/* Digitized sample: 16-bit rate in Hz and 24-bit length header at sample_addr, 8-bit unsigned
+	 * data after it. Only the state is kept, nothing plays it yet */
+	unsigned int sample_addr, sample_length;
+	unsigned short sample_rate;
+	unsigned char sample_loop, sample_playing;
+} MegaChip;
+
+MegaChip *megaCreate(void);
+MegaChip *megaClone(const MegaChip *src);	/* Shares the screen bands */
+void megaRelease(MegaChip *mega);
+int megaEqual(const MegaChip *a, const MegaChip *b);
+
+/* Band b of the shown screen, for the frontends */
+static inline const unsigned char (*megaShownBand(const Chip8 *chip, unsigned int b))[MEGA_WIDTH][4] {
+	return chip->mega->bands[!chip->mega->drawing][b]->pixels;
+}
+
+/* 0NNN of a MegaChip program at pc: returns the instruction's length in bytes, 0 if it is not a
+ * MegaChip one */
+unsigned int megaInstruction(Chip8 *chip, unsigned short opcode, unsigned short pc);
+
+/* Instructions that differ in MegaChip mode, called with chip->mega_on set */
+void megaPresent(Chip8 *chip);		/* 00E0 */
+void megaScroll(Chip8 *chip, int dx, int dy);
+unsigned char megaDraw(Chip8 *chip, unsigned int x, unsigned int y);	/* DXYN, returns VF */
+
+unsigned long long megaHash(const MegaChip *mega);
+
+#endif
@@ -0,0 +1,363 @@
+#include "pack.h"
+#include "analyze.h"
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* Builds a ROM pack (see pack.h) from directories of ROMs and their .txt notes, and looks ROMs up
+ * in an existing pack */
+
+typedef struct rom {
+	char *path;
+	char *name, *title, *author, *description;
+	unsigned int year;
+	unsigned char *data;
+	unsigned int size;
+} Rom;
+
+typedef struct rom_list {
+	Rom *roms;
+	unsigned int count, cap;
+} RomList;
+
+/* Growable byte buffer for the string area */
+typedef struct buffer {
+	char *data;
+	unsigned int len, cap;
+} Buffer;
+
+static unsigned int addString(Buffer *buf, const char *str) {
+	unsigned int len = strlen(str) + 1, offset = buf->len;
+	while (buf->len + len > buf->cap) {
+		buf->cap = buf->cap ? 2 * buf->cap : 4096;
+		buf->data = realloc(buf->data, buf->cap);
+	}
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+	return offset;
+}
+
+static char *readText(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char *text = malloc(size + 1);
+	size = fread(text, 1, size, fp);
+	fclose(fp);
+	while (size > 0 && isspace((unsigned char)text[size - 1]))
+		size--;
+	text[size] = '\0';
+	return text;
+}
+
+static char *trimmed(const char *start, const char *end) {
+	while (start < end && isspace((unsigned char)*start))
+		start++;
+	while (end > start && isspace((unsigned char)end[-1]))
+		end--;
+	return strndup(start, end - start);
+}
+
+/* File names follow the "Title [Author, Year] (notes)" convention of the collection */
+static void parseName(Rom *rom) {
+	const char *open = strchr(rom->name, '['), *close = open ? strchr(open, ']') : NULL;
+	rom->year = 0;
+	if (open == NULL || close == NULL) {
+		rom->title = strdup(rom->name);
+		rom->author = strdup("");
+		return;
+	}
+	rom->title = trimmed(rom->name, open);
+	const char *comma = close;
+	while (comma > open && *comma != ',')
+		comma--;
+	const char *year = comma > open ? comma + 1 : open + 1;
+	while (*year == ' ')
+		year++;
+	if (close - year == 4 && isdigit((unsigned char)year[0]) && isdigit((unsigned char)year[3])) {
+		rom->year = strtoul(year, NULL, 10);
+		rom->author = trimmed(open + 1, comma > open ? comma : open + 1);
+	} else {
+		rom->author = trimmed(open + 1, close);
+	}
+}
+
+static int addRom(RomList *list, const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Program %s not found!\n", path);
+		return 0;
+	}
+	if (list->count == list->cap) {
+		list->cap = list->cap ? 2 * list->cap : 128;
+		list->roms = realloc(list->roms, list->cap * sizeof(Rom));
+	}
+	Rom *rom = &list->roms[list->count];
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (size > MAX_MEGA_PROGRAM_SIZE) {
+		fprintf(stderr, "%s does not fit in memory, truncated\n", path);
+		size = MAX_MEGA_PROGRAM_SIZE;
+	}
+	rom->data = malloc(size > 0 ? size : 1);
+	rom->size = fread(rom->data, 1, size, fp);
+	fclose(fp);
+
+	rom->path = strdup(path);
+	const char *base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+	const char *ext = strrchr(base, '.');
+	rom->name = strndup(base, ext ? (size_t)(ext - base) : strlen(base));
+	parseName(rom);
+
+	/* Notes: <name>.txt, shared by the "(alt)" versions of a ROM */
+	char txt[4096];
+	snprintf(txt, sizeof(txt), "%.*s.txt", (int)(strlen(path) - (ext ? strlen(ext) : 0)), path);
+	rom->description = readText(txt);
+	char *alt = strstr(txt, " (alt).txt");
+	if (rom->description == NULL && alt != NULL) {
+		strcpy(alt, ".txt");
+		rom->description = readText(txt);
+	}
+	if (rom->description == NULL)
+		rom->description = strdup("");
+	list->count++;
+	return 1;
+}
+
+static int scanPath(RomList *list, const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "%s not found!\n", path);
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return addRom(list, path);
+
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	if (dir == NULL) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return 0;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		char child[4096];
+		const char *ext = strrchr(entry->d_name, '.');
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+		if (stat(child, &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			scanPath(list, child);
+		else if (ext != NULL && strcasecmp(ext, ".ch8") == 0)
+			addRom(list, child);
+	}
+	closedir(dir);
+	return 1;
+}
+
+static int compareRoms(const void *a, const void *b) {
+	return strcmp(((const Rom *)a)->path, ((const Rom *)b)->path);
+}
+
+static unsigned int align(unsigned int offset) {
+	return (offset + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1);
+}
+
+static int writePack(RomList *list, const char *filename) {
+	PackHeader header;
+	Buffer strings = {0};
+	unsigned int i, kept = 0;
+
+	qsort(list->roms, list->count, sizeof(Rom), compareRoms);
+	header.bucket_count = 16;
+	while (header.bucket_count < 2 * list->count)
+		header.bucket_count *= 2;
+	PackEntry *entries = calloc(list->count, sizeof(PackEntry));
+	unsigned int *hash_buckets = calloc(header.bucket_count, sizeof(unsigned int));
+	unsigned int *name_buckets = calloc(header.bucket_count, sizeof(unsigned int));
+	unsigned int mask = header.bucket_count - 1;
+
+	for (i = 0; i < list->count; i++) {
+		Rom *rom = &list->roms[i];
+		PackEntry *entry = &entries[kept];
+		unsigned int slot = nameHash(rom->name) & mask;
+		while (name_buckets[slot] != 0 && strcmp(strings.data + entries[name_buckets[slot] - 1].name, rom->name) != 0)
+			slot = (slot + 1) & mask;
+		if (name_buckets[slot] != 0) {
+			fprintf(stderr, "Skipping %s: another ROM is already called %s\n", rom->path, rom->name);
+			continue;
+		}
+		name_buckets[slot] = kept + 1;
+
+		entry->hash = romHash(rom->data, rom->size);
+		entry->mem_hash = programHash(rom->data, rom->size);
+		entry->size = rom->size;
+		entry->name = addString(&strings, rom->name);
+		entry->title = addString(&strings, rom->title);
+		entry->author = addString(&strings, rom->author);
+		entry->description = addString(&strings, rom->description);
+		entry->year = rom->year;
+		entry->variants = programVariants(rom->data, rom->size);
+
+		/* Identical copies of a ROM are only found by name, the first one owns the hash */
+		slot = entry->hash & mask;
+		while (hash_buckets[slot] != 0 && entries[hash_buckets[slot] - 1].hash != entry->hash)
+			slot = (slot + 1) & mask;
+		if (hash_buckets[slot] == 0)
+			hash_buckets[slot] = kept + 1;
+		kept++;
+	}
+
+	/* Layout, then turn string indices into file offsets */
+	memcpy(header.magic, PACK_MAGIC, 4);
+	header.version = PACK_VERSION;
+	header.rom_count = kept;
+	header.entries = sizeof(PackHeader);
+	header.hash_buckets = header.entries + kept * sizeof(PackEntry);
+	header.name_buckets = header.hash_buckets + header.bucket_count * sizeof(unsigned int);
+	unsigned int string_base = header.name_buckets + header.bucket_count * sizeof(unsigned int);
+	unsigned int offset = align(string_base + strings.len);
+	for (i = 0; i < kept; i++) {
+		entries[i].name += string_base;
+		entries[i].title += string_base;
+		entries[i].author += string_base;
+		entries[i].description += string_base;
+		entries[i].data = offset;
+		offset = align(offset + entries[i].size);
+	}
+	header.size = offset;
+
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not create %s\n", filename);
+		return 0;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(entries, sizeof(PackEntry), kept, fp);
+	fwrite(hash_buckets, sizeof(unsigned int), header.bucket_count, fp);
+	fwrite(name_buckets, sizeof(unsigned int), header.bucket_count, fp);
+	fwrite(strings.data, 1, strings.len, fp);
+	for (i = 0; i < kept; i++) {
+		/* Entries were filled in ROM order, skipping duplicates: find the data back by name */
+		const Rom *rom = list->roms;
+		while (strcmp(rom->name, strings.data + entries[i].name - string_base) != 0)
+			rom++;
+		fseek(fp, entries[i].data, SEEK_SET);
+		fwrite(rom->data, 1, rom->size, fp);
+	}
+	if (ftell(fp) < (long)header.size) {	/* Padding of the last ROM */
+		fseek(fp, header.size - 1, SEEK_SET);
+		fputc(0, fp);
+	}
+	fclose(fp);
+	printf("%u ROMs, %u bytes written to %s\n", kept, header.size, filename);
+	free(entries);
+	free(hash_buckets);
+	free(name_buckets);
+	free(strings.data);
+	return 1;
+}
+
+static void printEntry(const RomPack *pack, const PackEntry *entry, int details) {
+	char variants[64];
+	formatVariants(entry->variants, variants, sizeof(variants));
+	printf("%016llx %5u %-12s %s\n", entry->hash, entry->size, variants, packString(pack, entry->name));
+	if (!details)
+		return;
+	printf("  Title:  %s\n", packString(pack, entry->title));
+	if (*packString(pack, entry->author) != '\0')
+		printf("  Author: %s\n", packString(pack, entry->author));
+	if (entry->year != 0)
+		printf("  Year:   %u\n", entry->year);
+	if (quirksForProgram(entry->mem_hash, entry->variants) != 0) {
+		char quirks[64];
+		formatQuirks(quirksForProgram(entry->mem_hash, entry->variants), quirks, sizeof(quirks));
+		printf("  Quirks: %s\n", quirks);
+	}
+	if (*packString(pack, entry->description) != '\0')
+		printf("\n%s\n", packString(pack, entry->description));
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Cost of starting a session from the pack, the case this file format exists for */
+static void benchmark(const RomPack *pack, const PackEntry *entry, unsigned long count) {
+	Chip8 chip;
+	unsigned long i;
+	double start = now();
+	for (i = 0; i < count; i++) {
+		initialize(&chip);
+		packLoad(pack, entry, &chip);
+		chip8_release(&chip);
+	}
+	double elapsed = now() - start;
+	printf("%lu sessions of %s in %.3f s (%.0f ns each)\n", count, packString(pack, entry->name), elapsed, elapsed / count * 1e9);
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s -o <pack> <rom or directory> ...   Build a pack\n", name);
+	printf("       %s [-s rom] [-b count] <pack>           List the pack, or show (and benchmark loading) one ROM\n", name);
+	printf("ROMs are looked up by file name without extension or by content hash\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *output = NULL, *show = NULL;
+	unsigned long bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:s:b:h")) != -1) {
+		switch (opt) {
+			case 'o': output = optarg; break;
+			case 's': show = optarg; break;
+			case 'b': bench = strtoul(optarg, NULL, 0); break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (output != NULL) {
+		RomList list = {0};
+		for (; optind < argc; optind++) {
+			if (!scanPath(&list, argv[optind]))
+				return -1;
+		}
+		return writePack(&list, output) ? 0 : -1;
+	}
+
+	RomPack pack;
+	unsigned int i;
+	if (!packOpen(&pack, argv[optind]))
+		return -1;
+	if (show == NULL) {
+		for (i = 0; i < pack.header->rom_count; i++)
+			printEntry(&pack, &pack.entries[i], 0);
+	} else {
+		const PackEntry *entry = packFind(&pack, show);
+		if (entry == NULL) {
+			fprintf(stderr, "%s is not in the pack\n", show);
+			packClose(&pack);
+			return -1;
+		}
+		printEntry(&pack, entry, 1);
+		if (bench > 0)
+			benchmark(&pack, entry, bench);
+	}
+	packClose(&pack);
+	return 0;
+}
@@ -0,0 +1,267 @@
+#include "render.h"
+#include "scheduler.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <unistd.h>
+
+/* Runs a ROM through the real GL pipeline (render.c) without any window or X server: the context
+ * comes from EGL on Mesa's surfaceless platform and frames are drawn into a framebuffer object.
+ * Captured frames are read back asynchronously through a ring of pixel buffer objects, so that the
+ * GPU keeps rendering while earlier frames are copied out, and are then hashed and optionally
+ * written as PPM screenshots to compare against references */
+
+#define PBO_COUNT 3	/* Readbacks in flight */
+
+typedef struct readback {
+	unsigned int pbo;
+	GLsync fence;
+	unsigned long long frame;	/* Frame being read back, 0 when the slot is free */
+} Readback;
+
+typedef struct offscreen {
+	EGLDisplay display;
+	EGLContext context;
+	unsigned int fbo, color;
+	int width, height;
+	Readback slots[PBO_COUNT];
+	unsigned int next_slot;
+	const char *prefix;	/* Screenshot file prefix, NULL to only print hashes */
+} Offscreen;
+
+static int createContext(Offscreen *off) {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	off->display = EGL_NO_DISPLAY;
+	if (getPlatformDisplay != NULL) {
+		off->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (off->display == EGL_NO_DISPLAY) {
+		off->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (off->display == EGL_NO_DISPLAY || !eglInitialize(off->display, NULL, NULL)) {
+		printf("Failed to initialize EGL\n");
+		return 0;
+	}
+
+	/* No surface is ever created, but the default (window) surface type would match no surfaceless config */
+	const EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint configs = 0;
+	if (!eglChooseConfig(off->display, config_attribs, &config, 1, &configs) || configs == 0) {
+		printf("No EGL configuration supports OpenGL\n");
+		return 0;
+	}
+	eglBindAPI(EGL_OPENGL_API);
+
+	/* Same context as the window: OpenGL 3.3 core */
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	off->context = eglCreateContext(off->display, config, EGL_NO_CONTEXT, context_attribs);
+	if (off->context == EGL_NO_CONTEXT || !eglMakeCurrent(off->display, EGL_NO_SURFACE, EGL_NO_SURFACE, off->context)) {
+		printf("Failed to create a surfaceless OpenGL 3.3 context\n");
+		return 0;
+	}
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+		printf("Failed to initialize GLAD\n");
+		return 0;
+	}
+	return 1;
+}
+
+/* Framebuffer object standing in for the window, and the readback buffers */
+static int createTargets(Offscreen *off) {
+	unsigned int i;
+	glGenRenderbuffers(1, &off->color);
+	glBindRenderbuffer(GL_RENDERBUFFER, off->color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, off->width, off->height);
+	glGenFramebuffers(1, &off->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, off->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, off->color);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Framebuffer object is incomplete\n");
+		return 0;
+	}
+
+	for (i = 0; i < PBO_COUNT; i++) {
+		glGenBuffers(1, &off->slots[i].pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, off->slots[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)off->width * off->height * 4, NULL, GL_STREAM_READ);
+		off->slots[i].fence = NULL;
+		off->slots[i].frame = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return 1;
+}
+
+static void writeScreenshot(const Offscreen *off, const unsigned char *pixels, unsigned long long frame) {
+	char filename[512];
+	int x, y;
+	snprintf(filename, sizeof(filename), "%s%06llu.ppm", off->prefix, frame);
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not create %s\n", filename);
+		return;
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", off->width, off->height);
+	for (y = off->height - 1; y >= 0; y--) {	/* GL rows start at the bottom */
+		const unsigned char *row = pixels + (size_t)y * off->width * 4;
+		for (x = 0; x < off->width; x++)
+			fwrite(row + 4 * x, 1, 3, fp);
+	}
+	fclose(fp);
+}
+
+/* Waits for a readback to land, then hashes (and saves) the image */
+static void finishReadback(Offscreen *off, Readback *slot) {
+	if (slot->frame == 0)
+		return;
+	glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+	glDeleteSync(slot->fence);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	const unsigned char *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)off->width * off->height * 4, GL_MAP_READ_BIT);
+	if (pixels != NULL) {
+		unsigned long long hash = 0;
+		size_t i, count = (size_t)off->width * off->height;
+		for (i = 0; i < count; i++) {
+			unsigned int rgb = pixels[4*i] | pixels[4*i + 1] << 8 | pixels[4*i + 2] << 16;
+			hash = mix64(hash ^ rgb);
+		}
+		printf("frame %llu image hash %016llx\n", slot->frame, hash);
+		if (off->prefix != NULL)
+			writeScreenshot(off, pixels, slot->frame);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot->frame = 0;
+}
+
+/* Queues a copy of the framebuffer object into the next PBO without waiting for it */
+static void startReadback(Offscreen *off, unsigned long long frame) {
+	Readback *slot = &off->slots[off->next_slot];
+	finishReadback(off, slot);	/* Oldest readback in flight, normally long done */
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	glReadPixels(0, 0, off->width, off->height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->frame = frame;
+	off->next_slot = (off->next_slot + 1) % PBO_COUNT;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-c cycles per frame|vip] [-n frames] [-g WIDTHxHEIGHT] [-e every] [-p prefix] [-s seed] [-q quirks] <filename>\n", name);
+	printf("  -e  Capture every given number of frames (the last frame is always captured)\n");
+	printf("  -p  Write captured frames to <prefix><frame>.ppm\n");
+	printf("  -s  Seed of the random number generator, for reproducible images\n");
+}
+
+int main(int argc, char *argv[]) {
+	Offscreen off;
+	Renderer renderer;
+	Chip8 chip8;
+	Scheduler sched;
+	unsigned int cycles = CYCLES_PER_FRAME, i;
+	unsigned long long frames = 600, every = 0, frame, drawn = 0;
+	unsigned int seed = 0;
+	int opt, quirks = -1;
+
+	memset(&off, 0, sizeof(off));
+	off.width = 800;
+	off.height = 600;
+	while ((opt = getopt(argc, argv, "c:n:g:e:p:s:q:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				if ((cycles = parseCyclesPerFrame(optarg)) == 0) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'n': frames = strtoull(optarg, NULL, 0); break;
+			case 'g':
+				if (sscanf(optarg, "%dx%d", &off.width, &off.height) != 2 || off.width <= 0 || off.height <= 0) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'e': every = strtoull(optarg, NULL, 0); break;
+			case 'p': off.prefix = optarg; break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'q':
+				if ((quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	initialize(&chip8);
+	chip8.debug = 0;
+	if (seed != 0) {
+		chip8.rng = seed;
+	}
+	if (!loadProgram(&chip8, argv[optind])) {
+		return -1;
+	}
+	if (quirks >= 0) {
+		chip8.quirks = quirks;
+	}
+	if (!createContext(&off) || !createTargets(&off) || !rendererInit(&renderer, &chip8, off.width, off.height)) {
+		return -1;
+	}
+	printf("Renderer: %s\n", (const char *)glGetString(GL_RENDERER));
+
+	schedulerInit(&sched, &chip8, cycles, 0.0);
+	double emulation = 0.0, rendering = 0.0;
+	for (frame = 1; frame <= frames; frame++) {
+		double start = now();
+		schedulerRunFrame(&sched, (double)frame / FRAME_RATE);
+		double emulated = now();
+
+		/* Same rule as the window: only draw frames in which the screen changed */
+		int capture = frame == frames || (every > 0 && frame % every == 0);
+		if ((chip8.update_screen && rendererUpdate(&renderer, &chip8)) || frame == 1) {
+			rendererDraw(&renderer);
+			drawn++;
+		}
+		if (capture) {
+			startReadback(&off, frame);
+		}
+		glFlush();
+		emulation += emulated - start;
+		rendering += now() - emulated;
+	}
+	double start = now();
+	for (i = 0; i < PBO_COUNT; i++) {
+		finishReadback(&off, &off.slots[(off.next_slot + i) % PBO_COUNT]);
+	}
+	rendering += now() - start;
+	printf("%llu frames (%llu drawn): %.1f us emulation and %.1f us rendering per frame\n",
+			frames, drawn, emulation / frames * 1e6, rendering / frames * 1e6);
+
+	rendererFree(&renderer);
+	for (i = 0; i < PBO_COUNT; i++) {
+		glDeleteBuffers(1, &off.slots[i].pbo);
+	}
+	glDeleteFramebuffers(1, &off.fbo);
+	glDeleteRenderbuffers(1, &off.color);
+	eglMakeCurrent(off.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(off.display, off.context);
+	eglTerminate(off.display);
+	chip8_release(&chip8);
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include "pack.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* FNV-1a, finalized so that the low bits used for bucket indices are well mixed */
+unsigned long long romHash(const unsigned char *data, unsigned int size) {
+	unsigned long long h = 0xCBF29CE484222325ULL;
+	unsigned int i;
+	for (i = 0; i < size; i++) {
+		h ^= data[i];
+		h *= 0x100000001B3ULL;
+	}
+	return mix64(h ^ size);
+}
+
+unsigned long long nameHash(const char *name) {
+	return romHash((const unsigned char *)name, strlen(name));
+}
+
+int packOpen(RomPack *pack, const char *filename) {
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Pack %s not found!\n", filename);
+		return 0;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PackHeader)) {
+		fprintf(stderr, "%s is not a ROM pack\n", filename);
+		close(fd);
+		return 0;
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s\n", filename);
+		return 0;
+	}
+
+	pack->base = base;
+	pack->size = st.st_size;
+	pack->header = base;
+	if (memcmp(pack->header->magic, PACK_MAGIC, 4) != 0 || pack->header->version != PACK_VERSION ||
+			pack->header->size != pack->size) {
+		fprintf(stderr, "%s is not a ROM pack of version %d\n", filename, PACK_VERSION);
+		munmap(base, st.st_size);
+		return 0;
+	}
+	pack->entries = (const PackEntry *)(pack->base + pack->header->entries);
+	pack->hash_buckets = (const unsigned int *)(pack->base + pack->header->hash_buckets);
+	pack->name_buckets = (const unsigned int *)(pack->base + pack->header->name_buckets);
+	return 1;
+}
+
+void packClose(RomPack *pack) {
+	munmap((void *)pack->base, pack->size);
+	pack->base = NULL;
+}
+
+const PackEntry *packFindHash(const RomPack *pack, unsigned long long hash) {
+	unsigned int mask = pack->header->bucket_count - 1, i = hash & mask, slot;
+	while ((slot = pack->hash_buckets[i]) != 0) {
+		if (pack->entries[slot - 1].hash == hash)
+			return &pack->entries[slot - 1];
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+const PackEntry *packFindName(const RomPack *pack, const char *name) {
+	unsigned int mask = pack->header->bucket_count - 1, i = nameHash(name) & mask, slot;
+	while ((slot = pack->name_buckets[i]) != 0) {
+		if (strcmp(packString(pack, pack->entries[slot - 1].name), name) == 0)
+			return &pack->entries[slot - 1];
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+const PackEntry *packFind(const RomPack *pack, const char *key) {
+	const PackEntry *entry = packFindName(pack, key);
+	char *end;
+	if (entry == NULL && strlen(key) == 16) {
+		unsigned long long hash = strtoull(key, &end, 16);
+		if (*end == '\0')
+			entry = packFindHash(pack, hash);
+	}
+	return entry;
+}
+
+void packLoad(const RomPack *pack, const PackEntry *entry, Chip8 *chip) {
+	loadProgramImage(chip, packData(pack, entry), entry->size, entry->mem_hash, entry->variants);
+}
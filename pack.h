@@ -0,0 +1,62 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "chip8.h"
+
+/* ROM library pack: every ROM of a collection with its metadata in one file, memory-mapped
+ * read-only and looked up through two open-addressing hash tables, by content hash or by name.
+ * The file is a host-local cache in native byte order:
+ *   header, entries[rom_count], hash_buckets[bucket_count], name_buckets[bucket_count],
+ *   strings (NUL-terminated), ROM data (each ROM aligned to PACK_ALIGN)
+ * A bucket holds an entry index plus one, 0 when empty */
+
+#define PACK_MAGIC "C8PK"
+#define PACK_VERSION 3
+#define PACK_ALIGN 64
+
+typedef struct pack_header {
+	char magic[4];
+	unsigned int version;
+	unsigned int rom_count;
+	unsigned int bucket_count;	/* Power of two, at least twice rom_count */
+	unsigned int entries, hash_buckets, name_buckets;	/* File offsets */
+	unsigned int size;		/* Whole file */
+} PackHeader;
+
+typedef struct pack_entry {
+	unsigned long long hash;	/* romHash() of the data */
+	unsigned long long mem_hash;	/* programHash() of the data, for loadProgramImage() */
+	unsigned int data, size;	/* File offset and length of the ROM */
+	unsigned int name;		/* File name without directory and extension, the lookup key */
+	unsigned int title, author, description;	/* Metadata strings, empty when unknown */
+	unsigned int year;		/* 0 when unknown */
+	unsigned int variants;		/* programVariants() of the data */
+} PackEntry;
+
+typedef struct rom_pack {
+	const unsigned char *base;
+	unsigned int size;
+	const PackHeader *header;
+	const PackEntry *entries;
+	const unsigned int *hash_buckets, *name_buckets;
+} RomPack;
+
+unsigned long long romHash(const unsigned char *data, unsigned int size);
+unsigned long long nameHash(const char *name);
+
+int packOpen(RomPack *pack, const char *filename);
+void packClose(RomPack *pack);
+const PackEntry *packFindHash(const RomPack *pack, unsigned long long hash);
+const PackEntry *packFindName(const RomPack *pack, const char *name);
+const PackEntry *packFind(const RomPack *pack, const char *key);	/* Name, or content hash in hexadecimal */
+void packLoad(const RomPack *pack, const PackEntry *entry, Chip8 *chip);	/* chip must be fresh from initialize() */
+
+static inline const char *packString(const RomPack *pack, unsigned int offset) {
+	return (const char *)pack->base + offset;
+}
+
+static inline const unsigned char *packData(const RomPack *pack, const PackEntry *entry) {
+	return pack->base + entry->data;
+}
+
+#endif
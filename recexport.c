@@ -0,0 +1,221 @@
+#include "record.h"
+#include <unistd.h>
+
+/* Converts a recording into an animated GIF or a sequence of PPM images */
+
+#define LZW_MAX_CODES 4096
+
+typedef struct gif_writer {
+	FILE *fp;
+	unsigned char block[255];	/* Data sub-block being filled */
+	unsigned int block_len;
+	unsigned int bits, bit_count;	/* Pending bits, LSB first */
+} GifWriter;
+
+static void gifFlushBlock(GifWriter *gif) {
+	if (gif->block_len > 0) {
+		fputc(gif->block_len, gif->fp);
+		fwrite(gif->block, 1, gif->block_len, gif->fp);
+		gif->block_len = 0;
+	}
+}
+
+static void gifPutCode(GifWriter *gif, unsigned int code, unsigned int size) {
+	gif->bits |= code << gif->bit_count;
+	gif->bit_count += size;
+	while (gif->bit_count >= 8) {
+		gif->block[gif->block_len++] = gif->bits & 0xFF;
+		if (gif->block_len == sizeof(gif->block))
+			gifFlushBlock(gif);
+		gif->bits >>= 8;
+		gif->bit_count -= 8;
+	}
+}
+
+static void putShort(FILE *fp, unsigned int value) {
+	fputc(value & 0xFF, fp);
+	fputc((value >> 8) & 0xFF, fp);
+}
+
+/* LZW-compress a 1-bit image (one byte per pixel, 0 or 1) as GIF image data */
+static void gifWriteImage(GifWriter *gif, const unsigned char *pixels, unsigned int count) {
+	static short table[LZW_MAX_CODES][2];	/* Code of (prefix, pixel), 0 if not in the dictionary */
+	const unsigned int min_size = 2, clear = 1 << min_size, end = clear + 1;
+	unsigned int size = min_size + 1, last = end, i;	/* last: highest code in use */
+	int prefix;
+
+	memset(table, 0, sizeof(table));
+	fputc(min_size, gif->fp);
+	gif->bits = 0;
+	gif->bit_count = 0;
+	gifPutCode(gif, clear, size);
+	prefix = pixels[0];
+	for (i = 1; i < count; i++) {
+		unsigned char pixel = pixels[i];
+		if (table[prefix][pixel] != 0) {
+			prefix = table[prefix][pixel];
+			continue;
+		}
+		gifPutCode(gif, prefix, size);
+		table[prefix][pixel] = ++last;
+		if (last >= (1u << size))
+			size++;
+		if (last == LZW_MAX_CODES - 1) {
+			/* Dictionary full: start over */
+			gifPutCode(gif, clear, size);
+			memset(table, 0, sizeof(table));
+			size = min_size + 1;
+			last = end;
+		}
+		prefix = pixel;
+	}
+	gifPutCode(gif, prefix, size);
+	gifPutCode(gif, end, size);
+	if (gif->bit_count > 0)
+		gifPutCode(gif, 0, 8 - gif->bit_count);
+	gifFlushBlock(gif);
+	fputc(0, gif->fp);	/* Block terminator */
+}
+
+static void scaleFrame(const Recording *rec, unsigned int scale, unsigned char *pixels) {
+	unsigned int x, y, width = rec->width * scale;
+	for (y = 0; y < rec->height * scale; y++) {
+		for (x = 0; x < width; x++)
+			pixels[y * width + x] = recordingPixel(rec, x / scale, y / scale);
+	}
+}
+
+static void gifWriteFrame(GifWriter *gif, const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int delay) {
+	fwrite("\x21\xF9\x04\x00", 1, 4, gif->fp);	/* Graphic control extension */
+	putShort(gif->fp, delay);
+	fwrite("\x00\x00", 1, 2, gif->fp);
+	fputc(0x2C, gif->fp);				/* Image descriptor */
+	putShort(gif->fp, 0);
+	putShort(gif->fp, 0);
+	putShort(gif->fp, width);
+	putShort(gif->fp, height);
+	fputc(0, gif->fp);
+	gifWriteImage(gif, pixels, width * height);
+}
+
+static int exportGif(Recording *rec, const char *filename, unsigned int scale, unsigned long long first, unsigned long long count) {
+	GifWriter gif = {0};
+	unsigned int width = rec->width * scale, height = rec->height * scale;
+	unsigned char *pixels = malloc(width * height), *pending = malloc(width * height);
+	unsigned long long frames = 0, pending_frames = 0;
+	double shown = 0.0;	/* Hundredths of a second written so far, to keep rounding errors from adding up */
+
+	gif.fp = fopen(filename, "wb");
+	if (gif.fp == NULL) {
+		fprintf(stderr, "Could not create %s\n", filename);
+		return 0;
+	}
+	fwrite("GIF89a", 1, 6, gif.fp);
+	putShort(gif.fp, width);
+	putShort(gif.fp, height);
+	fputc(0x80, gif.fp);	/* Global color table of 2 entries */
+	fputc(0, gif.fp);
+	fputc(0, gif.fp);
+	fwrite("\x00\x00\x00\xFF\xFF\xFF", 1, 6, gif.fp);
+	fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, gif.fp);	/* Loop forever */
+
+	while (recordingNext(rec)) {
+		if (rec->number <= first)
+			continue;
+		if (count > 0 && frames >= count)
+			break;
+		frames++;
+		scaleFrame(rec, scale, pixels);
+		if (pending_frames > 0 && memcmp(pixels, pending, width * height) == 0) {
+			pending_frames++;	/* Identical frames become one longer GIF frame */
+			continue;
+		}
+		if (pending_frames > 0) {
+			double until = shown + pending_frames * 100.0 / rec->fps;
+			gifWriteFrame(&gif, pending, width, height, (unsigned int)(until + 0.5) - (unsigned int)(shown + 0.5));
+			shown = until;
+		}
+		memcpy(pending, pixels, width * height);
+		pending_frames = 1;
+	}
+	if (pending_frames > 0) {
+		double until = shown + pending_frames * 100.0 / rec->fps;
+		gifWriteFrame(&gif, pending, width, height, (unsigned int)(until + 0.5) - (unsigned int)(shown + 0.5));
+	}
+	fputc(0x3B, gif.fp);
+	fclose(gif.fp);
+	free(pixels);
+	free(pending);
+	printf("%llu frames written to %s\n", frames, filename);
+	return 1;
+}
+
+static int exportPpm(Recording *rec, const char *prefix, unsigned int scale, unsigned long long first, unsigned long long count) {
+	unsigned int width = rec->width * scale, height = rec->height * scale, i;
+	unsigned char *pixels = malloc(width * height);
+	unsigned long long frames = 0;
+	char filename[512];
+
+	while (recordingNext(rec)) {
+		if (rec->number <= first)
+			continue;
+		if (count > 0 && frames >= count)
+			break;
+		snprintf(filename, sizeof(filename), "%s%06llu.ppm", prefix, rec->number - 1);
+		FILE *fp = fopen(filename, "wb");
+		if (fp == NULL) {
+			fprintf(stderr, "Could not create %s\n", filename);
+			free(pixels);
+			return 0;
+		}
+		scaleFrame(rec, scale, pixels);
+		fprintf(fp, "P6\n%u %u\n255\n", width, height);
+		for (i = 0; i < width * height; i++) {
+			unsigned char value = pixels[i] ? 0xFF : 0x00;
+			unsigned char rgb[3] = {value, value, value};
+			fwrite(rgb, 1, 3, fp);
+		}
+		fclose(fp);
+		frames++;
+	}
+	free(pixels);
+	printf("%llu frames written to %s*.ppm\n", frames, prefix);
+	return 1;
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-g out.gif | -p prefix] [-s scale] [-f first] [-n count] <recording>\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	const char *gif = NULL, *ppm = NULL;
+	unsigned int scale = 4;
+	unsigned long long first = 0, count = 0;
+	Recording rec;
+	int opt, ok;
+
+	while ((opt = getopt(argc, argv, "g:p:s:f:n:h")) != -1) {
+		switch (opt) {
+			case 'g': gif = optarg; break;
+			case 'p': ppm = optarg; break;
+			case 's': scale = strtoul(optarg, NULL, 0); break;
+			case 'f': first = strtoull(optarg, NULL, 0); break;
+			case 'n': count = strtoull(optarg, NULL, 0); break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc || (gif == NULL) == (ppm == NULL) || scale == 0) {
+		usage(argv[0]);
+		return 0;
+	}
+	if (!recordingOpen(&rec, argv[optind]))
+		return -1;
+	if (gif != NULL)
+		ok = exportGif(&rec, gif, scale, first, count);
+	else
+		ok = exportPpm(&rec, ppm, scale, first, count);
+	recordingClose(&rec);
+	return ok ? 0 : -1;
+}
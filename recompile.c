@@ -0,0 +1,443 @@
+#include "analyze.h"
+#include <unistd.h>
+
+/* Static recompiler: translates a ROM into a C file that runs it as native code, to build a dedicated
+ * binary for the ROMs run all the time (regression and benchmark runs).
+ *
+ * The code the analyzer reaches (see analyze.h) is cut into basic blocks at its leaders, and each
+ * block becomes a label in one big switch on the pc, with V0-VF, I and the timers as locals. Jumps,
+ * calls and skips to a block go straight to its label; returns and BNNN, whose targets are only known
+ * at run time, go through the switch. Anything else falls back to the interpreter one instruction at
+ * a time: addresses that do not start a block, the instructions with side effects beyond the
+ * registers (drawing, the screen modes, key waits, the variants' instructions, machine code), and the
+ * rest of a frame too short for the next block. Stores that change compiled code (FX33, FX55, 5XY2
+ * or machine code writing over it) hand the program to the interpreter for good.
+ *
+ * The output runs the ROM without a display like chip8-headless, with the same quirks, and prints
+ * the same hashes:
+ *
+ *   chip8-recompile -o brix.c roms/games/Brix.ch8
+ *   gcc brix.c analyze.c megachip.c cosmac.c chip8.c -I. -O2 -o brix
+ *   ./brix -n 3600 -c 1000 [-s seed] [-i]     (-i runs the interpreter instead, to compare) */
+
+typedef struct recompiler {
+	FILE *out;
+	Chip8 chip;		/* The program as loaded */
+	Analysis analysis;
+	unsigned int quirks;
+	unsigned char protect[ANALYSIS_SPACE / 8];	/* Bit set: byte of a compiled instruction */
+} Recompiler;
+
+static unsigned int word(const Recompiler *rc, unsigned int addr) {
+	return memRead(&rc->chip, addr) << 8 | memRead(&rc->chip, addr + 1);
+}
+
+static int isCode(const Recompiler *rc, unsigned int addr) {
+	return addr < ANALYSIS_SPACE && analysisBit(rc->analysis.code, addr);
+}
+
+/* Compiled blocks start at the leaders that are code */
+static int isBlock(const Recompiler *rc, unsigned int addr) {
+	return isCode(rc, addr) && analysisBit(rc->analysis.leaders, addr);
+}
+
+/* F000 NNNN, and MegaChip's 01NN NNNN, are 4 bytes long */
+static unsigned int instructionLength(const Recompiler *rc, unsigned int op) {
+	return op == 0xF000 || (rc->chip.mega != NULL && (op & 0xFF00) == 0x0100) ? 4 : 2;
+}
+
+static void jumpTo(const Recompiler *rc, FILE *f, unsigned int target) {
+	if (isBlock(rc, target))
+		fprintf(f, "goto L%03x;", target);
+	else
+		fprintf(f, "{ pc = 0x%x; goto dispatch; }", target);
+}
+
+/* skipTarget() of the interpreter, with the code as loaded */
+static unsigned int skipTarget(const Recompiler *rc, unsigned int addr) {
+	if ((rc->chip.variants & VARIANT_XOCHIP) && word(rc, addr + 2) == 0xF000)
+		return addr + 6;
+	return addr + 4;
+}
+
+static void skipIf(const Recompiler *rc, FILE *f, unsigned int addr, const char *condition) {
+	fprintf(f, "n++; if (%s) ", condition);
+	jumpTo(rc, f, skipTarget(rc, addr));
+}
+
+/* The instruction at addr on the interpreter, continuing with the block if it went on to next */
+static void step(FILE *f, unsigned int addr, unsigned int next, const char *check) {
+	fprintf(f, "STEP(0x%03x);%s%s if (pc != 0x%x || stale) goto dispatch;", addr, check ? " " : "", check ? check : "", next);
+}
+
+/* Emits the instruction at addr, returns 1 when it ends the block */
+static int emitInstruction(const Recompiler *rc, FILE *f, unsigned int addr, unsigned int op, unsigned int next) {
+	unsigned int x = (op >> 8) & 0xF, y = (op >> 4) & 0xF, nn = op & 0xFF, nnn = op & 0xFFF, i;
+	char condition[64];
+
+	fprintf(f, "\t\t/* %03x: %04x */ ", addr, op);
+	switch (op >> 12) {
+		case 0x0:
+			if (op == 0x00EE) {
+				fprintf(f, "if (chip->sp == 0) { STEP(0x%03x); goto dispatch; } n++; pc = (unsigned short)(chip->stack[--chip->sp] + 2); goto dispatch;", addr);
+				return 1;
+			}
+			if ((rc->chip.variants & VARIANT_MACHINE_CODE) && nnn >= 0x200)
+				step(f, addr, next, "stale |= !codeIntact(chip, 0, 0x1000);");
+			else
+				step(f, addr, next, NULL);
+			break;
+		case 0x1:
+			fprintf(f, "n++; ");
+			jumpTo(rc, f, nnn);
+			return 1;
+		case 0x2:
+			fprintf(f, "if (chip->sp >= 16) { STEP(0x%03x); goto dispatch; } chip->stack[chip->sp++] = 0x%03x; n++; ", addr, addr);
+			jumpTo(rc, f, nnn);
+			return 1;
+		case 0x3:
+		case 0x4:
+			snprintf(condition, sizeof(condition), "V%X %s 0x%02x", x, (op >> 12) == 0x3 ? "==" : "!=", nn);
+			skipIf(rc, f, addr, condition);
+			break;
+		case 0x5:
+			if ((op & 0xF) == 0) {
+				snprintf(condition, sizeof(condition), "V%X == V%X", x, y);
+				skipIf(rc, f, addr, condition);
+			} else if ((op & 0xF) == 2) {
+				snprintf(condition, sizeof(condition), "stale |= !codeIntact(chip, I, %u);", (x <= y ? y - x : x - y) + 1);
+				step(f, addr, next, condition);
+			} else {
+				step(f, addr, next, NULL);
+			}
+			break;
+		case 0x6:
+			fprintf(f, "V%X = 0x%02x; n++;", x, nn);
+			break;
+		case 0x7:
+			fprintf(f, "V%X += 0x%02x; n++;", x, nn);
+			break;
+		case 0x8: /* In the interpreter's order, VF may be X or Y */
+			switch (op & 0xF) {
+				case 0x0: fprintf(f, "V%X = V%X; n++;", x, y); break;
+				case 0x1: fprintf(f, "V%X |= V%X; n++;", x, y); break;
+				case 0x2: fprintf(f, "V%X &= V%X; n++;", x, y); break;
+				case 0x3: fprintf(f, "V%X ^= V%X; n++;", x, y); break;
+				case 0x4: fprintf(f, "VF = V%X > 0xFF - V%X; V%X += V%X; n++;", y, x, x, y); break;
+				case 0x5: fprintf(f, "VF = V%X > V%X; V%X -= V%X; n++;", x, y, x, y); break;
+				case 0x7: fprintf(f, "VF = V%X > V%X; V%X = V%X - V%X; n++;", y, x, x, y, x); break;
+				case 0x6:
+				case 0xE:
+					if (rc->quirks & QUIRK_SHIFT_VY)
+						fprintf(f, "V%X = V%X; ", x, y);
+					fprintf(f, "VF = V%X & 1; V%X %s= 1; n++;", x, x, (op & 0xF) == 0x6 ? ">>" : "<<");
+					break;
+				default: step(f, addr, next, NULL);
+			}
+			break;
+		case 0x9:
+			if ((op & 0xF) == 0) {
+				snprintf(condition, sizeof(condition), "V%X != V%X", x, y);
+				skipIf(rc, f, addr, condition);
+			} else {
+				step(f, addr, next, NULL);
+			}
+			break;
+		case 0xA:
+			fprintf(f, "I = 0x%03x; n++;", nnn);
+			break;
+		case 0xB:
+			if (rc->chip.variants & VARIANT_CHIP8X) {
+				step(f, addr, next, NULL);	/* Color zones */
+				break;
+			}
+			fprintf(f, "n++; pc = V%X + 0x%03x; goto dispatch;", (rc->quirks & QUIRK_JUMP_VX) ? x : 0, nnn);
+			return 1;
+		case 0xC:
+			fprintf(f, "chip->rng ^= chip->rng << 13; chip->rng ^= chip->rng >> 17; chip->rng ^= chip->rng << 5; V%X = chip->rng & 0x%02x; n++;", x, nn);
+			break;
+		case 0xE:
+			if (nn == 0x9E || nn == 0xA1) {
+				snprintf(condition, sizeof(condition), "chip->keypad[V%X & 0xF] == %d", x, nn == 0x9E);
+				skipIf(rc, f, addr, condition);
+			} else {
+				step(f, addr, next, NULL);
+			}
+			break;
+		case 0xF:
+			switch (nn) {
+				case 0x00:
+					if (op == 0xF000) {
+						fprintf(f, "I = 0x%04x; n++;", word(rc, addr + 2));
+						break;
+					}
+					step(f, addr, next, NULL);
+					break;
+				case 0x07: fprintf(f, "V%X = TIMER(dt); n++;", x); break;
+				case 0x15: fprintf(f, "SYNC(); dt = V%X; n++;", x); break;
+				case 0x18: fprintf(f, "SYNC(); st = V%X; n++;", x); break;
+				case 0x1E: fprintf(f, "I = (I + V%X) & indexMask(chip); n++;", x); break;
+				case 0x29: fprintf(f, "I = (V%X * 5) %% 80; n++;", x); break;
+				case 0x30: fprintf(f, "I = 0x%x + (V%X & 0xF) * 10; n++;", BIG_FONT_ADDR, x); break;
+				case 0x33:
+					fprintf(f, "memWrite(chip, I, V%X / 100); memWrite(chip, I + 1, V%X / 10 %% 10); memWrite(chip, I + 2, V%X %% 10); "
+							"stale |= !codeIntact(chip, I, 3); n++; if (stale) { pc = 0x%x; goto dispatch; }", x, x, x, next);
+					break;
+				case 0x55:
+					for (i = 0; i <= x; i++)
+						fprintf(f, "memWrite(chip, I + %u, V%X); ", i, i);
+					fprintf(f, "stale |= !codeIntact(chip, I, %u); ", x + 1);
+					if (rc->quirks & QUIRK_LOAD_STORE_I)
+						fprintf(f, "I = (I + %u) & indexMask(chip); ", x + 1);
+					fprintf(f, "n++; if (stale) { pc = 0x%x; goto dispatch; }", next);
+					break;
+				case 0x65:
+					for (i = 0; i <= x; i++)
+						fprintf(f, "V%X = memRead(chip, I + %u); ", i, i);
+					if (rc->quirks & QUIRK_LOAD_STORE_I)
+						fprintf(f, "I = (I + %u) & indexMask(chip); ", x + 1);
+					fprintf(f, "n++;");
+					break;
+				case 0x75:
+				case 0x85:
+					for (i = 0; i <= x; i++)
+						fprintf(f, nn == 0x75 ? "chip->rpl[%u] = V%X; " : "V%2$X = chip->rpl[%1$u]; ", i, i);
+					fprintf(f, "n++;");
+					break;
+				default: /* Key wait, planes, audio */
+					step(f, addr, next, NULL);
+			}
+			break;
+		default: /* DXYN */
+			step(f, addr, next, NULL);
+	}
+	return 0;
+}
+
+/* A block from its leader, as a case of the switch. It only runs when the frame has room for all of
+ * its instructions */
+static void emitBlock(Recompiler *rc, unsigned int start) {
+	unsigned int addr = start, count = 0, op, next, b;
+	char *body = NULL;
+	size_t size = 0;
+	FILE *f = open_memstream(&body, &size);
+
+	for (;;) {
+		op = word(rc, addr);
+		next = addr + instructionLength(rc, op);
+		for (b = addr; b < next; b++)
+			rc->protect[b >> 3] |= 1 << (b & 7);
+		count++;
+		if (emitInstruction(rc, f, addr, op, next)) {
+			fprintf(f, "\n");
+			break;
+		}
+		fprintf(f, "\n");
+		if (!isCode(rc, next) || isBlock(rc, next)) {
+			fprintf(f, "\t\t");
+			jumpTo(rc, f, next);
+			fprintf(f, "\n");
+			break;
+		}
+		addr = next;
+	}
+	fclose(f);
+	fprintf(rc->out, "\tcase 0x%03x: L%03x:\n", start, start);
+	fprintf(rc->out, "\t\tif (cycles - n < %u) { pc = 0x%03x; goto tail; }\n", count, start);
+	fwrite(body, 1, size, rc->out);
+	free(body);
+}
+
+static void emitRegisters(FILE *out, const char *format) {
+	unsigned int i;
+	for (i = 0; i < 16; i++)
+		fprintf(out, format, i, i);
+}
+
+static void recompile(Recompiler *rc, const unsigned char *program, unsigned int size, const char *source) {
+	FILE *out = rc->out;
+	unsigned int addr, i, base = programBase(rc->chip.variants), code_size;
+	char variants[64], quirks[64];
+
+	/* Only the first 4kiB are analyzed, past that the interpreter runs the code */
+	code_size = base + size < ANALYSIS_SPACE ? size : ANALYSIS_SPACE - base;
+	formatVariants(rc->chip.variants, variants, sizeof(variants));
+	formatQuirks(rc->quirks, quirks, sizeof(quirks));
+	fprintf(out, "/* %s recompiled by chip8-recompile (%s, %s quirks): %u instructions. Build with\n", source, variants, quirks, rc->analysis.instructions);
+	fprintf(out, " *   gcc <this file> analyze.c megachip.c cosmac.c chip8.c -I<chip8 sources> -O2 */\n\n");
+	fprintf(out, "#include \"chip8.h\"\n#include <unistd.h>\n\n");
+	fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-label\"\n\n");
+	fprintf(out, "#define QUIRKS 0x%x\n#define BASE 0x%x\n\n", rc->quirks, base);
+
+	fprintf(out, "static const unsigned char rom[%u] = {", size);
+	for (i = 0; i < size; i++)
+		fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n\t", program[i]);
+	fprintf(out, "\n};\n\n");
+
+	/* The blocks go to a buffer first, they fill protect */
+	char *blocks = NULL;
+	size_t blocks_size = 0;
+	rc->out = open_memstream(&blocks, &blocks_size);
+	for (addr = base; addr < base + code_size; addr++) {
+		if (isBlock(rc, addr))
+			emitBlock(rc, addr);
+	}
+	fclose(rc->out);
+	rc->out = out;
+
+	fprintf(out, "/* Bit set: byte of a compiled instruction */\nstatic const unsigned char compiled[%u] = {", ANALYSIS_SPACE / 8);
+	for (i = 0; i < ANALYSIS_SPACE / 8; i++)
+		fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n\t", rc->protect[i]);
+	fprintf(out, "\n};\n\n");
+	fprintf(out,
+		"static int stale;	/* Compiled code was changed, the interpreter runs the program */\n\n"
+		"static inline int codeIntact(const Chip8 *chip, unsigned int addr, unsigned int count) {\n"
+		"\tunsigned int i, a;\n"
+		"\tfor (i = 0; i < count; i++) {\n"
+		"\t\ta = (addr + i) & chip->mem_mask;\n"
+		"\t\tif (a < 0x%x && ((compiled[a >> 3] >> (a & 7)) & 1) && memRead(chip, a) != rom[a - BASE])\n"
+		"\t\t\treturn 0;\n"
+		"\t}\n"
+		"\treturn 1;\n"
+		"}\n\n", ANALYSIS_SPACE);
+
+	/* The timers tick after every instruction: they are kept as their value at instruction mark */
+	fprintf(out, "#define TIMER(t) ((t) > n - mark ? (t) - (n - mark) : 0)\n");
+	fprintf(out, "#define SYNC() do { dt = TIMER(dt); st = TIMER(st); mark = n; } while (0)\n");
+	fprintf(out, "#define FLUSH() do { SYNC(); chip->delay_timer = dt; chip->sound_timer = st; chip->index_reg = I;");
+	emitRegisters(out, " chip->V[%u] = V%X;");
+	fprintf(out, " } while (0)\n");
+	fprintf(out, "#define RELOAD() do { dt = chip->delay_timer; st = chip->sound_timer; mark = n; I = chip->index_reg;");
+	emitRegisters(out, " V%2$X = chip->V[%1$u];");
+	fprintf(out, " } while (0)\n");
+	/* An interpreted instruction may store over compiled code too: a changed memory hash is checked against the ROM */
+	fprintf(out, "#define CHECK(hash) do { if (chip->mem_hash != (hash)) stale |= !codeIntact(chip, 0, 0x%x); } while (0)\n", ANALYSIS_SPACE);
+	fprintf(out, "#define STEP(addr) do { FLUSH(); chip->pc = (addr); hash = chip->mem_hash; emulateCycle(chip); n++; CHECK(hash); RELOAD(); pc = chip->pc; } while (0)\n\n");
+
+	fprintf(out, "static void recompiledFrame(Chip8 *chip, unsigned int cycles) {\n\tunsigned char");
+	for (i = 0; i < 16; i++)
+		fprintf(out, "%s V%X", i ? "," : "", i);
+	fprintf(out, ";\n\tunsigned int I, dt, st, n = 0, mark = 0, pc = chip->pc;\n\tunsigned long long hash;\n\n");
+	fprintf(out,
+		"\tif (stale || chip->quirks != QUIRKS) {\n"
+		"\t\temulateFrame(chip, cycles);\n"
+		"\t\treturn;\n"
+		"\t}\n"
+		"\tRELOAD();\n"
+		"dispatch:\n"
+		"\tif (stale)\n"
+		"\t\tgoto tail;\n"
+		"\tswitch (pc) {\n");
+	fwrite(blocks, 1, blocks_size, out);
+	free(blocks);
+	fprintf(out,
+		"\t}\n"
+		"\t/* Not a compiled block */\n"
+		"\tif (n == cycles)\n"
+		"\t\tgoto tail;\n"
+		"\tSTEP(pc);\n"
+		"\tgoto dispatch;\n"
+		"tail:\n"
+		"\tFLUSH();\n"
+		"\tchip->pc = pc;\n"
+		"\thash = chip->mem_hash;\n"
+		"\temulateFrame(chip, cycles - n);\n"
+		"\tCHECK(hash);\n"
+		"}\n\n");
+
+	fprintf(out,
+		"static double now(void) {\n"
+		"\tstruct timespec ts;\n"
+		"\tclock_gettime(CLOCK_MONOTONIC, &ts);\n"
+		"\treturn ts.tv_sec + ts.tv_nsec / 1e9;\n"
+		"}\n\n"
+		"int main(int argc, char *argv[]) {\n"
+		"\tChip8 chip;\n"
+		"\tFrameFunction run = recompiledFrame;\n"
+		"\tunsigned int cycles = CYCLES_PER_FRAME, seed = 0;\n"
+		"\tunsigned long long frames = 600, frame;\n"
+		"\tint opt;\n\n"
+		"\twhile ((opt = getopt(argc, argv, \"c:n:s:ih\")) != -1) {\n"
+		"\t\tswitch (opt) {\n"
+		"\t\t\tcase 'c': cycles = strtoul(optarg, NULL, 0); break;\n"
+		"\t\t\tcase 'n': frames = strtoull(optarg, NULL, 0); break;\n"
+		"\t\t\tcase 's': seed = strtoul(optarg, NULL, 0); break;\n"
+		"\t\t\tcase 'i': run = emulateFrame; break;\n"
+		"\t\t\tdefault:\n"
+		"\t\t\t\tprintf(\"Usage: %%s [-c cycles per frame] [-n frames] [-s seed] [-i (interpreter)]\\n\", argv[0]);\n"
+		"\t\t\t\treturn 0;\n"
+		"\t\t}\n"
+		"\t}\n\n"
+		"\tinitialize(&chip);\n"
+		"\tchip.debug = 0;\n"
+		"\tloadProgramBuffer(&chip, rom, sizeof(rom));\n"
+		"\tchip.quirks = QUIRKS;\n"
+		"\tif (seed != 0)\n"
+		"\t\tchip.rng = seed;\n"
+		"\tdouble start = now();\n"
+		"\tfor (frame = 0; frame < frames; frame++) {\n"
+		"\t\trun(&chip, cycles);\n"
+		"\t}\n"
+		"\tdouble elapsed = now() - start;\n"
+		"\tprintf(\"%%llu frames, screen hash %%016llx, state hash %%016llx\\n\", frames, chip8_gfx_hash(&chip), chip8_hash(&chip));\n"
+		"\tprintf(\"%%.1f emulated seconds per host second\\n\", frames / 60.0 / elapsed);\n"
+		"\tchip8_release(&chip);\n"
+		"\treturn 0;\n"
+		"}\n");
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-o out.c] [-q quirks] <filename>\n", name);
+	printf("Translates the ROM into a C file (standard output by default), see recompile.c\n");
+}
+
+int main(int argc, char *argv[]) {
+	static Recompiler rc;
+	const char *output = NULL;
+	int opt, quirks = -1;
+
+	while ((opt = getopt(argc, argv, "o:q:h")) != -1) {
+		switch (opt) {
+			case 'o': output = optarg; break;
+			case 'q':
+				if ((quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	FILE *fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Program %s not found!\n", argv[optind]);
+		return -1;
+	}
+	unsigned char *program = malloc(MAX_MEGA_PROGRAM_SIZE);
+	unsigned int size = fread(program, 1, MAX_MEGA_PROGRAM_SIZE, fp);
+	fclose(fp);
+
+	/* Loaded like the output will, for its variants, quirks and code */
+	initialize(&rc.chip);
+	rc.chip.debug = 0;
+	loadProgramBuffer(&rc.chip, program, size);
+	rc.quirks = quirks >= 0 ? (unsigned int)quirks : rc.chip.quirks;
+	analyzeProgram(program, size, &rc.analysis);
+
+	rc.out = output != NULL ? fopen(output, "w") : stdout;
+	if (rc.out == NULL) {
+		fprintf(stderr, "Cannot write %s\n", output);
+		return -1;
+	}
+	recompile(&rc, program, size, argv[optind]);
+	if (output != NULL)
+		fclose(rc.out);
+	chip8_release(&rc.chip);
+	free(program);
+	return 0;
+}
@@ -0,0 +1,230 @@
+#include "record.h"
+#include <pthread.h>
+
+#define RING_FRAMES 256	/* Frames the emulator can be ahead of the writer thread */
+
+struct recorder {
+	FILE *fp;
+	unsigned int width, height, frame_bytes;
+
+	/* Ring of packed frames, filled by the emulation thread and drained by the writer thread */
+	unsigned char *ring;
+	unsigned int head, tail;
+	int closing;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t writer;
+
+	/* Writer thread only */
+	unsigned char *previous;
+	unsigned char *payload;
+};
+
+static unsigned int putVarint(unsigned char *out, unsigned int value) {
+	unsigned int len = 0;
+	while (value >= 0x80) {
+		out[len++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	out[len++] = value;
+	return len;
+}
+
+static int getVarint(const unsigned char *in, unsigned int len, unsigned int *pos, unsigned int *value) {
+	unsigned int shift = 0;
+	*value = 0;
+	while (*pos < len && shift < 32) {
+		unsigned char byte = in[(*pos)++];
+		*value |= (unsigned int)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return 0;
+}
+
+static int readVarint(FILE *fp, unsigned int *value) {
+	unsigned int shift = 0;
+	int byte;
+	*value = 0;
+	while ((byte = fgetc(fp)) != EOF && shift < 32) {
+		*value |= (unsigned int)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return 0;
+}
+
+/* XOR delta + run-length encoding of one frame, returns the payload length */
+static unsigned int encodeFrame(Recorder *rec, const unsigned char *frame) {
+	unsigned int i = 0, len = 0;
+	while (i < rec->frame_bytes) {
+		unsigned int zeros = 0, literals = 0;
+		while (i + zeros < rec->frame_bytes && (frame[i + zeros] ^ rec->previous[i + zeros]) == 0)
+			zeros++;
+		if (i + zeros == rec->frame_bytes)
+			break;	/* Only unchanged bytes left */
+		i += zeros;
+		/* A literal run ends at the first pair of unchanged bytes */
+		while (i + literals < rec->frame_bytes && ((frame[i + literals] ^ rec->previous[i + literals]) != 0 ||
+				(i + literals + 1 < rec->frame_bytes && (frame[i + literals + 1] ^ rec->previous[i + literals + 1]) != 0)))
+			literals++;
+		len += putVarint(rec->payload + len, zeros);
+		len += putVarint(rec->payload + len, literals);
+		while (literals--) {
+			rec->payload[len++] = frame[i] ^ rec->previous[i];
+			i++;
+		}
+	}
+	memcpy(rec->previous, frame, rec->frame_bytes);
+	return len;
+}
+
+static void *writerThread(void *arg) {
+	Recorder *rec = arg;
+	unsigned char header[8];
+	pthread_mutex_lock(&rec->lock);
+	for (;;) {
+		while (rec->head == rec->tail && !rec->closing)
+			pthread_cond_wait(&rec->cond, &rec->lock);
+		if (rec->head == rec->tail)
+			break;	/* Closing and drained */
+		unsigned char *frame = &rec->ring[rec->head * rec->frame_bytes];
+		pthread_mutex_unlock(&rec->lock);
+
+		/* The slot stays reserved until head moves, so it can be read without the lock */
+		unsigned int len = encodeFrame(rec, frame);
+		fwrite(header, 1, putVarint(header, len), rec->fp);
+		fwrite(rec->payload, 1, len, rec->fp);
+
+		pthread_mutex_lock(&rec->lock);
+		rec->head = (rec->head + 1) % RING_FRAMES;
+		pthread_cond_broadcast(&rec->cond);
+	}
+	pthread_mutex_unlock(&rec->lock);
+	return NULL;
+}
+
+Recorder *recorderOpen(const char *filename, unsigned int width, unsigned int height, unsigned int fps) {
+	Recorder *rec = calloc(1, sizeof(Recorder));
+	if (rec == NULL)
+		return NULL;
+	rec->fp = fopen(filename, "wb");
+	if (rec->fp == NULL) {
+		fprintf(stderr, "Could not create %s\n", filename);
+		free(rec);
+		return NULL;
+	}
+	rec->width = width;
+	rec->height = height;
+	rec->frame_bytes = (width * height + 7) / 8;
+	rec->ring = malloc(RING_FRAMES * rec->frame_bytes);
+	rec->previous = calloc(1, rec->frame_bytes);
+	rec->payload = malloc(rec->frame_bytes * 3 + 16);	/* Worst case: every byte changed */
+
+	unsigned char header[10] = { RECORD_MAGIC[0], RECORD_MAGIC[1], RECORD_MAGIC[2], RECORD_MAGIC[3], RECORD_VERSION,
+		width & 0xFF, width >> 8, height & 0xFF, height >> 8, fps };
+	fwrite(header, 1, sizeof(header), rec->fp);
+
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_cond_init(&rec->cond, NULL);
+	pthread_create(&rec->writer, NULL, writerThread, rec);
+	return rec;
+}
+
+void recorderFrame(void *ctx, const Chip8 *chip) {
+	Recorder *rec = ctx;
+	unsigned char packed[MAX_WIDTH * MAX_HEIGHT / 8];
+	unsigned int x, y, i = 0;
+
+	if (chip->width == rec->width && chip->height == rec->height) {
+		for (y = 0; y < rec->height; y++) {
+			for (x = 0; x < rec->width; x += 8)
+				packed[i++] = gfxByte(chip, x, y);
+		}
+	} else {
+		/* Smaller screen mode (SUPER-CHIP's 64x32 in a 128x64 recording): pixels are enlarged by
+		 * the integer factor that fits, the rest is recorded as unset */
+		unsigned int sx = rec->width / chip->width, sy = rec->height / chip->height;
+		if (sx == 0)
+			sx = 1;
+		if (sy == 0)
+			sy = 1;
+		memset(packed, 0, rec->frame_bytes);
+		for (y = 0; y < rec->height && y / sy < chip->height; y++) {
+			for (x = 0; x < rec->width && x / sx < chip->width; x++) {
+				if (gfxPixel(chip, x / sx, y / sy))
+					packed[(y * rec->width + x) >> 3] |= 0x80 >> (x & 7);
+			}
+		}
+	}
+
+	pthread_mutex_lock(&rec->lock);
+	unsigned int next = (rec->tail + 1) % RING_FRAMES;
+	while (next == rec->head)	/* Writer is more than RING_FRAMES behind: wait rather than lose frames */
+		pthread_cond_wait(&rec->cond, &rec->lock);
+	memcpy(&rec->ring[rec->tail * rec->frame_bytes], packed, rec->frame_bytes);
+	rec->tail = next;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+}
+
+void recorderClose(Recorder *rec) {
+	pthread_mutex_lock(&rec->lock);
+	rec->closing = 1;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+	pthread_join(rec->writer, NULL);
+
+	fclose(rec->fp);
+	free(rec->ring);
+	free(rec->previous);
+	free(rec->payload);
+	free(rec);
+}
+
+int recordingOpen(Recording *rec, const char *filename) {
+	unsigned char header[10];
+	memset(rec, 0, sizeof(Recording));
+	rec->fp = fopen(filename, "rb");
+	if (rec->fp == NULL) {
+		fprintf(stderr, "Recording %s not found!\n", filename);
+		return 0;
+	}
+	if (fread(header, 1, sizeof(header), rec->fp) != sizeof(header) || memcmp(header, RECORD_MAGIC, 4) != 0 || header[4] != RECORD_VERSION) {
+		fprintf(stderr, "%s is not a recording\n", filename);
+		fclose(rec->fp);
+		return 0;
+	}
+	rec->width = header[5] | header[6] << 8;
+	rec->height = header[7] | header[8] << 8;
+	rec->fps = header[9];
+	rec->frame_bytes = (rec->width * rec->height + 7) / 8;
+	rec->frame = calloc(1, rec->frame_bytes);
+	rec->payload = malloc(rec->frame_bytes * 3 + 16);
+	return 1;
+}
+
+int recordingNext(Recording *rec) {
+	unsigned int len, pos = 0, offset = 0, zeros, literals;
+	if (!readVarint(rec->fp, &len) || len > rec->frame_bytes * 3 + 16 || fread(rec->payload, 1, len, rec->fp) != len)
+		return 0;
+	while (pos < len) {
+		if (!getVarint(rec->payload, len, &pos, &zeros) || !getVarint(rec->payload, len, &pos, &literals))
+			return 0;
+		offset += zeros;
+		if (offset + literals > rec->frame_bytes || pos + literals > len)
+			return 0;	/* Corrupted */
+		while (literals--)
+			rec->frame[offset++] ^= rec->payload[pos++];
+	}
+	rec->number++;
+	return 1;
+}
+
+void recordingClose(Recording *rec) {
+	fclose(rec->fp);
+	free(rec->frame);
+	free(rec->payload);
+}
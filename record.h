@@ -0,0 +1,41 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "chip8.h"
+
+/* Compact 1-bit video format:
+ *   header:  "C8RV", version (1 byte), width and height (2 bytes each, little endian), frame rate (1 byte)
+ *   frames:  payload length (varint), payload
+ * A payload is the XOR of the frame with the previous one (packed 8 pixels per byte, MSB first,
+ * row-major), run-length encoded as pairs of (zero bytes to skip, literal count) varints each
+ * followed by the literal bytes. Trailing zeros are dropped, so an unchanged frame is one byte */
+
+#define RECORD_MAGIC "C8RV"
+#define RECORD_VERSION 1
+
+typedef struct recorder Recorder;
+
+Recorder *recorderOpen(const char *filename, unsigned int width, unsigned int height, unsigned int fps);
+void recorderFrame(void *rec, const Chip8 *chip);	/* FrameObserver: queue a copy of the framebuffer */
+void recorderClose(Recorder *rec);			/* Flush everything and stop the writer thread */
+
+/* Sequential reader for the exporters */
+typedef struct recording {
+	FILE *fp;
+	unsigned int width, height, fps;
+	unsigned int frame_bytes;
+	unsigned char *frame;		/* Current frame, packed like the payload */
+	unsigned char *payload;
+	unsigned long long number;	/* Frames read so far */
+} Recording;
+
+int recordingOpen(Recording *rec, const char *filename);
+int recordingNext(Recording *rec);	/* Decode the next frame into rec->frame, 0 at the end */
+void recordingClose(Recording *rec);
+
+static inline int recordingPixel(const Recording *rec, unsigned int x, unsigned int y) {
+	unsigned int bit = y * rec->width + x;
+	return (rec->frame[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+#endif
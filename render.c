@@ -0,0 +1,439 @@
+#include "render.h"
+#include "megachip.h"
+
+const char *vertexShaderSource =
+	"#version 330 core\n"
+	"layout (location = 0) in vec3 aPos;\n"
+    	"void main()\n"
+    	"{\n"
+    	"   gl_Position = vec4(aPos.x, aPos.y, aPos.z, 1.0);\n"
+    	"}\0";
+
+const char *fragmentShaderSource =
+	"#version 330 core\n"
+    	"out vec4 FragColor;\n"
+	"uniform vec4 color;\n"
+    	"void main()\n"
+    	"{\n"
+    	"   FragColor = color;\n"
+    	"}\n\0";
+
+/* MegaChip screen: the shown RGBA pixels as a texture, faded by the screen alpha (05NN). extent is
+ * the part of the texture in use */
+const char *megaVertexShaderSource =
+	"#version 330 core\n"
+	"layout (location = 0) in vec2 aPos;\n"
+	"layout (location = 1) in vec2 aTex;\n"
+	"out vec2 tex;\n"
+	"uniform vec2 extent;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_Position = vec4(aPos, 0.0, 1.0);\n"
+	"   tex = aTex * extent;\n"
+	"}\0";
+
+const char *megaFragmentShaderSource =
+	"#version 330 core\n"
+	"in vec2 tex;\n"
+	"out vec4 FragColor;\n"
+	"uniform sampler2D screen;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   vec4 texel = texture(screen, tex);\n"
+	"   FragColor = vec4(texel.rgb * texel.a * alpha, 1.0);\n"
+	"}\n\0";
+
+/* Colors of the pixels lit in the first plane only (every pixel of a program without XO-CHIP
+ * bitplanes), in the second plane only and in both */
+static const float colors[COLORS][4] = {
+	{1.0f, 1.0f, 1.0f, 1.0f},
+	{1.0f, 0.4f, 0.0f, 1.0f},
+	{0.4f, 0.133f, 0.0f, 1.0f},
+};
+
+/* Write the indices of the pixels set in row j of a screen width pixels wide, returns the number of
+ * indices written (at most width*6) */
+unsigned int createRowVertices(const unsigned long long *row, int j, unsigned int width, unsigned int *indices) {
+	unsigned int currentIndex = 0, w, stride = width + 1;
+	for (w = 0; w < width / 64; w++) {
+		unsigned long long bits = row[w];
+		while (bits) { /* For each pixel set to 1, from the left */
+			unsigned int i = 64 * w + __builtin_clzll(bits);
+			bits &= ~(0x8000000000000000ULL >> (i & 63));
+			/* Create the pixel (rectangle composed of 2 triangles) */
+
+			/* Triangle 1 */
+			indices[currentIndex++] = stride*j + i;		/* Top left  */
+			indices[currentIndex++] = stride*j + i + 1;		/* Top right */
+			indices[currentIndex++] = stride*(j + 1) + i;	/* Bottom left */
+
+			/* Triangle 2 */
+			indices[currentIndex++] = stride*(j + 1) + i;	/* Bottom left */
+			indices[currentIndex++] = stride*(j + 1) + i + 1;	/* Bottom right */
+			indices[currentIndex++] = stride*j + i + 1;		/* Top right */
+		}
+	}
+	return currentIndex;
+}
+
+/* The screen keeps its aspect ratio and is centered in the framebuffer */
+Viewport computeViewport(int width, int height, unsigned int screen_w, unsigned int screen_h) {
+	Viewport viewport;
+	if ((long long)height * screen_w >= (long long)width * screen_h) {
+		viewport.width = width;
+		viewport.height = (long long)width * screen_h / screen_w;
+	} else {
+		viewport.width = (long long)height * screen_w / screen_h;
+		viewport.height = height;
+	}
+	viewport.x = (width - viewport.width) / 2;
+	viewport.y = (height - viewport.height) / 2;
+	return viewport;
+}
+
+void rendererResize(Renderer *renderer, int width, int height) {
+	renderer->fb_width = width;
+	renderer->fb_height = height;
+	if (renderer->mega) {
+		renderer->viewport = computeViewport(width, height, MEGA_WIDTH, MEGA_HEIGHT);
+	} else if (renderer->chip8x) {
+		renderer->viewport = computeViewport(width, height, WIDTH, HEIGHT);
+	} else {
+		renderer->viewport = computeViewport(width, height, renderer->width, renderer->height);
+	}
+	glViewport(renderer->viewport.x, renderer->viewport.y, renderer->viewport.width, renderer->viewport.height);
+	glScissor(renderer->viewport.x, renderer->viewport.y, renderer->viewport.width, renderer->viewport.height);
+}
+
+/* Splits row y of the framebuffer by color and writes the indices of each color's pixels in its slot */
+static void buildRow(Renderer *renderer, const Chip8 *chip8, unsigned int y) {
+	unsigned long long bits[GFX_WORDS];
+	unsigned int c, i;
+	for (c = 0; c < COLORS; c++) {
+		for (i = 0; i < GFX_WORDS; i++) {
+			unsigned long long p0 = chip8->gfx[0][y][i], p1 = chip8->gfx[1][y][i];
+			bits[i] = c == 0 ? p0 & ~p1 : c == 1 ? p1 & ~p0 : p0 & p1;
+		}
+		renderer->row_counts[c][y] = createRowVertices(bits, y, chip8->width, &renderer->indices[MAX_WIDTH*6*(MAX_HEIGHT*c + y)]);
+	}
+}
+
+/* Lit pixels take the color of their zone, the others the background's */
+static void uploadChip8xScreen(Renderer *renderer, const Chip8 *chip8) {
+	unsigned char pixels[HEIGHT][WIDTH][4];
+	unsigned int x, y, color;
+	for (y = 0; y < HEIGHT; y++) {
+		for (x = 0; x < WIDTH; x++) {
+			color = gfxPixel(chip8, x, y) ? chip8->zone_colors[y][x / 8] : chip8->background;
+			pixels[y][x][0] = color & CHIP8X_RED ? 255 : 0;
+			pixels[y][x][1] = color & CHIP8X_GREEN ? 255 : 0;
+			pixels[y][x][2] = color & CHIP8X_BLUE ? 255 : 0;
+			pixels[y][x][3] = 255;
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, renderer->texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	memcpy(renderer->zone_colors, chip8->zone_colors, sizeof(renderer->zone_colors));
+	renderer->background = chip8->background;
+	renderer->drawn_hash = chip8_gfx_hash(chip8);
+}
+
+/* Uploads the vertex grid of the chip's screen mode and the indices of its whole framebuffer,
+ * with the VAO bound */
+static void buildScreen(Renderer *renderer, Chip8 *chip8) {
+	/* Calculate the normalized coordinates of each vertex */
+	/******************************************************/
+	unsigned int y, x, w = chip8->width, h = chip8->height;
+	float *points = malloc(2*(w+1)*(h+1)*sizeof(float)); /* 2 times the number of vertices to store the x and y coordinates */
+	for (y = 0; y < h+1; y++) {
+		for(x = 0; x < w+1; x++) {
+			points[2*(w+1)*y + 2*x] = ( -1.0f + x * 2.0f / w );
+			points[2*(w+1)*y + 2*x + 1] = ( 1.0f  - y * 2.0f / h );
+		}
+	}
+	for (y = 0; y < h; y++) {
+		buildRow(renderer, chip8, y);
+	}
+	memcpy(renderer->shown, chip8->gfx, sizeof(renderer->shown));
+	renderer->width = w;
+	renderer->height = h;
+	renderer->drawn_hash = chip8_gfx_hash(chip8);
+	clearDirty(chip8);
+	/******************************************************/
+
+	/* Load data into the buffers' memory */
+	glBufferData(GL_ARRAY_BUFFER, 2*(w+1)*(h+1)*sizeof(float), points, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*COLORS*MAX_HEIGHT*MAX_WIDTH*6, renderer->indices, GL_DYNAMIC_DRAW);
+	free(points);
+}
+
+/* Compiles and links a shader program, 0 on failure */
+static unsigned int createProgram(const char *vertexSource, const char *fragmentSource) {
+	/* Vertex shader */
+	unsigned int vertexShader;
+	vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &vertexSource, NULL); /* Attach shader source to the shader object */
+	glCompileShader(vertexShader); /* Compile shader */
+
+	int success;
+	char infoLog[512];
+	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+
+	if (!success) {
+		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+		printf("[ERROR] Vertex shader compilation failed!\n");
+		printf("%s\n", infoLog);
+	} else {
+		printf("Vertex shader compiled\n");
+	}
+
+	/* Fragment shader */
+	unsigned int fragmentShader;
+	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+	glCompileShader(fragmentShader);
+
+	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+		printf("[ERROR] Fragment shader compilation failed!\n");
+		printf("%s\n", infoLog);
+	} else {
+		printf("Fragment shader compiled\n");
+	}
+
+	/* Shader program - linking vertex and fragment shaders together */
+	unsigned int program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+
+	glGetProgramiv(program, GL_LINK_STATUS, & success);
+	if (!success) {
+		glGetProgramInfoLog(program, 512, NULL, infoLog);
+		printf("[ERROR] Shader program linking failed!\n");
+		printf("%s\n", infoLog);
+	} else {
+		printf("Shader program created\n");
+	}
+
+	/* Delete objects after linking */
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	if (!success) {
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+/* Textured quad covering the viewport, for the MegaChip screen */
+static void createMegaScreen(Renderer *renderer) {
+	static const float quad[] = {
+		/* Position, texture coordinates (the first row of the texture is the top one) */
+		-1.0f,  1.0f, 0.0f, 0.0f,
+		 1.0f,  1.0f, 1.0f, 0.0f,
+		-1.0f, -1.0f, 0.0f, 1.0f,
+		 1.0f, -1.0f, 1.0f, 1.0f,
+	};
+	glGenVertexArrays(1, &renderer->mega_VAO);
+	glGenBuffers(1, &renderer->mega_VBO);
+	glBindVertexArray(renderer->mega_VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->mega_VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+
+	glGenTextures(1, &renderer->texture);
+	glBindTexture(GL_TEXTURE_2D, renderer->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, MEGA_WIDTH, MEGA_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	renderer->alpha_location = glGetUniformLocation(renderer->mega_program, "alpha");
+	renderer->extent_location = glGetUniformLocation(renderer->mega_program, "extent");
+	renderer->mega = 0;
+	renderer->chip8x = 0;
+}
+
+int rendererInit(Renderer *renderer, Chip8 *chip8, int width, int height) {
+	renderer->program = createProgram(vertexShaderSource, fragmentShaderSource);
+	renderer->mega_program = createProgram(megaVertexShaderSource, megaFragmentShaderSource);
+	if (renderer->program == 0 || renderer->mega_program == 0) {
+		return 0;
+	}
+	createMegaScreen(renderer);
+	renderer->color_location = glGetUniformLocation(renderer->program, "color");
+
+	/* Vertex Buffer Object (VBO), Vertex Array Object (VAO) and Element Buffer Object (EBO) */
+	glGenVertexArrays(1, &renderer->VAO);
+	glGenBuffers(1, &renderer->VBO); /* Generate 1 Buffer object and store its ID in VBO */
+	glGenBuffers(1, &renderer->EBO);
+
+	glBindVertexArray(renderer->VAO); /* Bind VAO first */
+
+	/* Bind the vertex buffer to the GL_ARRAY_BUFFER target (type of a vertex buffer object) */
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->EBO);
+
+	renderer->indices = calloc(COLORS*MAX_HEIGHT*MAX_WIDTH*6, sizeof(unsigned int));
+	for (int c = 0; c < COLORS; c++) {
+		for (int y = 0; y < MAX_HEIGHT; y++) {
+			renderer->row_offsets[c][y] = (const void *)(sizeof(unsigned int)*MAX_WIDTH*6*(MAX_HEIGHT*c + y));
+		}
+	}
+	buildScreen(renderer, chip8);
+
+	/* Telling OpenGL how to interpret the data */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2* sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0); /* Enable the vertex attribute */
+
+	rendererResize(renderer, width, height);
+	return 1;
+}
+
+/* Upload only the rows that really changed, a frame whose net XOR is zero is skipped. A new screen mode
+ * rebuilds the whole grid */
+int rendererUpdate(Renderer *renderer, Chip8 *display) {
+	int changed = 0, y, c, p;
+	if (display->mega_on) {
+		/* The MegaChip screen is uploaded whole, a band at a time, once per presented frame */
+		const MegaChip *mega = display->mega;
+		if (!renderer->mega || mega->frames != renderer->mega_frames || mega->alpha != renderer->mega_alpha) {
+			glBindTexture(GL_TEXTURE_2D, renderer->texture);
+			for (p = 0; p < MEGA_BANDS; p++) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, p * MEGA_BAND_ROWS, MEGA_WIDTH, MEGA_BAND_ROWS, GL_RGBA, GL_UNSIGNED_BYTE, megaShownBand(display, p));
+			}
+			renderer->mega_frames = mega->frames;
+			renderer->mega_alpha = mega->alpha;
+			if (!renderer->mega) {
+				renderer->mega = 1;
+				renderer->chip8x = 0;
+				rendererResize(renderer, renderer->fb_width, renderer->fb_height);
+			}
+			changed = 1;
+		}
+	} else if (display->variants & VARIANT_CHIP8X) {
+		/* CHIP-8X pixels are colored by zone: uploaded whole when the pixels or colors change */
+		if (renderer->mega || !renderer->chip8x || chip8_gfx_hash(display) != renderer->drawn_hash ||
+				display->background != renderer->background ||
+				memcmp(display->zone_colors, renderer->zone_colors, sizeof(renderer->zone_colors)) != 0) {
+			uploadChip8xScreen(renderer, display);
+			if (renderer->mega || !renderer->chip8x) {
+				renderer->mega = 0;
+				renderer->chip8x = 1;
+				rendererResize(renderer, renderer->fb_width, renderer->fb_height);
+			}
+			changed = 1;
+		}
+	} else if (renderer->mega || renderer->chip8x || display->width != renderer->width || display->height != renderer->height) {
+		renderer->mega = 0;
+		renderer->chip8x = 0;
+		glBindVertexArray(renderer->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, renderer->VBO);
+		buildScreen(renderer, display);
+		rendererResize(renderer, renderer->fb_width, renderer->fb_height);
+		changed = 1;
+	} else if (chip8_gfx_hash(display) != renderer->drawn_hash) {
+		unsigned int w0 = display->dirty_x0 >> 6, w1 = display->dirty_x1 >> 6;
+		glBindVertexArray(renderer->VAO); /* The EBO binding is part of the VAO state */
+		for (y = 0; y < renderer->height; y++) {
+			int same = 1;
+			if (!((display->dirty_rows >> y) & 1))
+				continue;
+			for (p = 0; p < PLANES; p++) {
+				unsigned long long *row = display->gfx[p][y];
+				if (memcmp(row + w0, &renderer->shown[p][y][w0], (w1 - w0 + 1) * sizeof(row[0])) != 0) {
+					memcpy(renderer->shown[p][y], row, sizeof(renderer->shown[p][y]));
+					same = 0;
+				}
+			}
+			if (same)
+				continue;
+			buildRow(renderer, display, y);
+			for (c = 0; c < COLORS; c++) {
+				/* An empty slot is not drawn, whatever the EBO still holds there */
+				if (renderer->row_counts[c][y] > 0)
+					glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)renderer->row_offsets[c][y], sizeof(unsigned int)*renderer->row_counts[c][y], &renderer->indices[MAX_WIDTH*6*(MAX_HEIGHT*c + y)]);
+			}
+			changed = 1;
+		}
+		renderer->drawn_hash = chip8_gfx_hash(display);
+	}
+	clearDirty(display);
+	display->update_screen = 0;
+	return changed;
+}
+
+void rendererDraw(const Renderer *renderer) {
+	/* Draw background */
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glEnable(GL_SCISSOR_TEST);
+
+	/* Rendering */
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	/* One draw per color, with only the rows with pixels of that color: some drivers (Mesa's
+	 * llvmpipe) draw nothing at all when the first count of a multi-draw is zero */
+	GLsizei counts[MAX_HEIGHT];
+	const void *offsets[MAX_HEIGHT];
+	unsigned int y, c;
+
+	if (renderer->mega || renderer->chip8x) {
+		glUseProgram(renderer->mega_program);
+		if (renderer->mega) {
+			glUniform1f(renderer->alpha_location, renderer->mega_alpha / 255.0f);
+			glUniform2f(renderer->extent_location, 1.0f, 1.0f);
+		} else {
+			glUniform1f(renderer->alpha_location, 1.0f);
+			glUniform2f(renderer->extent_location, (float)WIDTH / MEGA_WIDTH, (float)HEIGHT / MEGA_HEIGHT);
+		}
+		glBindTexture(GL_TEXTURE_2D, renderer->texture);
+		glBindVertexArray(renderer->mega_VAO);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glBindVertexArray(0);
+		return;
+	}
+
+	glUseProgram(renderer->program);
+	glBindVertexArray(renderer->VAO);
+	for (c = 0; c < COLORS; c++) {
+		unsigned int draws = 0;
+		for (y = 0; y < renderer->height; y++) {
+			if (renderer->row_counts[c][y] > 0) {
+				counts[draws] = renderer->row_counts[c][y];
+				offsets[draws++] = renderer->row_offsets[c][y];
+			}
+		}
+		if (draws > 0) {
+			glUniform4fv(renderer->color_location, 1, colors[c]);
+			glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, draws);
+		}
+	}
+	glBindVertexArray(0);
+}
+
+void rendererFree(Renderer *renderer) {
+	/* Clear allocated memory */
+	glDeleteVertexArrays(1, &renderer->VAO);
+	glDeleteBuffers(1, &renderer->VBO);
+	glDeleteBuffers(1, &renderer->EBO);
+	glDeleteProgram(renderer->program);
+	glDeleteVertexArrays(1, &renderer->mega_VAO);
+	glDeleteBuffers(1, &renderer->mega_VBO);
+	glDeleteTextures(1, &renderer->texture);
+	glDeleteProgram(renderer->mega_program);
+
+	if (renderer->indices) {
+		free(renderer->indices);
+		renderer->indices = NULL;
+	}
+}
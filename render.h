@@ -0,0 +1,56 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "chip8.h"
+#include "glad/glad.h"
+
+/* OpenGL pipeline drawing the framebuffer, independent of how the context was created: the window
+ * (gui.c) and the offscreen renderer (offscreen.c) both drive it. A current GL 3.3 core context
+ * with loaded function pointers is required by everything but computeViewport().
+ * CHIP-8 screens are drawn as geometry, two triangles per lit pixel; the MegaChip screen, true
+ * color and 256x192, is uploaded as a texture instead, and so is the CHIP-8X one with its zone
+ * colors, in the top left corner of the same texture */
+
+typedef struct viewport {
+	int x, y, width, height;
+} Viewport;
+
+/* Pixel colors but the background (gfxColor() 1 to 3), each drawn with its own color uniform */
+#define COLORS ((1 << PLANES) - 1)
+
+typedef struct renderer {
+	unsigned int program, VAO, VBO, EBO;
+	int color_location;			/* Uniform of the fragment shader */
+	unsigned int *indices;			/* One slot of MAX_WIDTH*6 indices per color and row, so that rows can be updated separately */
+	GLsizei row_counts[COLORS][MAX_HEIGHT];
+	const void *row_offsets[COLORS][MAX_HEIGHT];
+	unsigned long long shown[PLANES][MAX_HEIGHT][GFX_WORDS];	/* Framebuffer as currently uploaded */
+	unsigned long long drawn_hash;		/* Framebuffer hash of the indices in the EBO */
+	unsigned int width, height;		/* Screen mode the vertex grid was built for */
+	int fb_width, fb_height;		/* Size of the framebuffer drawn into */
+	Viewport viewport;
+
+	/* MegaChip screen */
+	unsigned int mega_program, mega_VAO, mega_VBO, texture;
+	int alpha_location, extent_location;
+	int mega;				/* The texture is what is drawn */
+	unsigned long long mega_frames;		/* MegaChip frames counter of the uploaded screen */
+	unsigned char mega_alpha;
+
+	/* CHIP-8X screen, drawn with the texture too: the colors uploaded with it (drawn_hash being its
+	 * framebuffer's hash) */
+	int chip8x;
+	unsigned char zone_colors[HEIGHT][WIDTH / 8];
+	unsigned char background;
+} Renderer;
+
+unsigned int createRowVertices(const unsigned long long *row, int j, unsigned int width, unsigned int *indices);
+Viewport computeViewport(int width, int height, unsigned int screen_w, unsigned int screen_h);	/* Area of a width x height framebuffer a screen_w x screen_h screen is drawn in */
+
+int rendererInit(Renderer *renderer, Chip8 *chip, int width, int height);
+void rendererResize(Renderer *renderer, int width, int height);
+int rendererUpdate(Renderer *renderer, Chip8 *display);	/* Upload the rows that changed, returns 1 if any did */
+void rendererDraw(const Renderer *renderer);
+void rendererFree(Renderer *renderer);
+
+#endif
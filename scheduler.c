@@ -0,0 +1,150 @@
+#include "scheduler.h"
+
+const char chip8_keymap[2][16] = {{'x','1', '2', '3', 'q', 'w', 'e', 'a', 's', 'd', 'z', 'c', '4', 'r', 'f', 'v'}, {'x','1','2','3','a','z','e','q','s','d','w','c','4','r','f','v'}};
+
+int keymapLookup(unsigned char layout, char key) {
+	int i;
+	for (i = 0; i < 16; i++) {
+		if (chip8_keymap[layout & 1][i] == key)
+			return i;
+	}
+	return -1;
+}
+
+unsigned int parseCyclesPerFrame(const char *arg) {
+	char *end;
+	unsigned long cycles;
+	if (strcmp(arg, "vip") == 0)
+		return VIP_TIMING;
+	cycles = strtoul(arg, &end, 0);
+	if (end == arg || *end != '\0' || cycles >= VIP_TIMING)
+		return 0;
+	return cycles;
+}
+
+void schedulerInit(Scheduler *sched, Chip8 *chip, unsigned int cycles_per_frame, double now) {
+	sched->chip = chip;
+	sched->cycles_per_frame = cycles_per_frame;
+	sched->vip_credit = 0;
+	sched->vip_waiting = 0;
+	sched->immediate_input = 0;
+	sched->window_start = now;
+	sched->head = 0;
+	sched->tail = 0;
+	sched->frames = 0;
+	sched->observer_count = 0;
+}
+
+int schedulerAddObserver(Scheduler *sched, FrameObserver observer, void *ctx) {
+	if (sched->observer_count == MAX_OBSERVERS) {
+		fprintf(stderr, "Too many frame observers!\n");
+		return 0;
+	}
+	sched->observers[sched->observer_count] = observer;
+	sched->observer_ctx[sched->observer_count] = ctx;
+	sched->observer_count++;
+	return 1;
+}
+
+void schedulerQueueKey(Scheduler *sched, double time, unsigned char key, unsigned char pressed) {
+	unsigned int next = (sched->tail + 1) % KEY_QUEUE_SIZE;
+	if (next == sched->head) {
+		/* Queue is full: apply the oldest transition right away to make room */
+		KeyEvent *oldest = &sched->queue[sched->head];
+		sched->chip->keypad[oldest->key] = oldest->pressed;
+		sched->head = (sched->head + 1) % KEY_QUEUE_SIZE;
+	}
+	sched->queue[sched->tail].time = time;
+	sched->queue[sched->tail].key = key & 0xF;
+	sched->queue[sched->tail].pressed = pressed;
+	sched->tail = next;
+}
+
+/* Length of a frame in the units of cycles_per_frame */
+static unsigned int frameCycles(const Scheduler *sched) {
+	return sched->cycles_per_frame == VIP_TIMING ? VIP_INTERPRETER_CYCLES : sched->cycles_per_frame;
+}
+
+/* VIP timing: runs cycles more machine cycles of the frame, unless a DXYN waits for its end. An
+ * instruction overrunning the slice is paid for by the next one */
+static void vipSlice(Chip8 *chip, int *credit, unsigned char *waiting, unsigned int cycles) {
+	if (*waiting)
+		return;
+	*credit += cycles;
+	*waiting = emulateVipCycles(chip, credit);
+}
+
+/* And the vertical blank: the interrupt ticks the timers, a waiting DXYN's leftover cycles are lost */
+static void vipFrameEnd(Chip8 *chip, int *credit, unsigned char *waiting) {
+	if (*waiting)
+		*credit = 0;
+	*waiting = 0;
+	tickTimers(chip);
+}
+
+static void runSlice(Scheduler *sched, unsigned int cycles) {
+	if (sched->cycles_per_frame == VIP_TIMING)
+		vipSlice(sched->chip, &sched->vip_credit, &sched->vip_waiting, cycles);
+	else
+		emulateFrame(sched->chip, cycles);
+}
+
+/* Emulates one frame. The events of the input window [window_start, now) are replayed during it,
+ * each one at the cycle proportional to its timestamp, which delays input by one frame but keeps
+ * the spacing between transitions (a tap shorter than a frame is still seen by the ROM) */
+void schedulerRunFrame(Scheduler *sched, double now) {
+	Chip8 *chip = sched->chip;
+	double span = now - sched->window_start;
+	unsigned int done = 0, at;
+
+	while (sched->head != sched->tail && sched->queue[sched->head].time < now) {
+		KeyEvent *event = &sched->queue[sched->head];
+		at = 0;
+		if (!sched->immediate_input && span > 0 && event->time > sched->window_start) {
+			at = (unsigned int)((event->time - sched->window_start) / span * frameCycles(sched));
+		}
+		if (at > done) {
+			runSlice(sched, at - done);
+			done = at;
+		}
+		chip->keypad[event->key] = event->pressed;
+		sched->head = (sched->head + 1) % KEY_QUEUE_SIZE;
+	}
+	runSlice(sched, frameCycles(sched) - done);
+	if (sched->cycles_per_frame == VIP_TIMING)
+		vipFrameEnd(chip, &sched->vip_credit, &sched->vip_waiting);
+
+	sched->window_start = now;
+	sched->frames++;
+	for (at = 0; at < sched->observer_count; at++) {
+		sched->observers[at](sched->observer_ctx[at], chip);
+	}
+}
+
+/* Run-ahead: forks the machine into ahead and emulates some more frames with the current keypad,
+ * leaving the real state untouched. Showing ahead instead of the real machine hides the frames of
+ * lag that ROMs add by polling the keypad. ahead must hold a previous fork or no pages at all */
+void schedulerRunAhead(Scheduler *sched, Chip8 *ahead, unsigned int frames) {
+	chip8_release(ahead);
+	chip8_fork(ahead, sched->chip);
+	if (sched->cycles_per_frame == VIP_TIMING) {
+		int credit = sched->vip_credit;
+		unsigned char waiting = sched->vip_waiting;
+		while (frames--) {
+			schedulerRunFork(sched, ahead, &credit, &waiting);
+		}
+	} else {
+		emulateFrame(ahead, frames * sched->cycles_per_frame);
+	}
+}
+
+/* Emulates one frame of a fork of the machine, which sees no input: its keypad stays as it was
+ * forked. credit and waiting hold the fork's own VIP timing state */
+void schedulerRunFork(const Scheduler *sched, Chip8 *fork, int *credit, unsigned char *waiting) {
+	if (sched->cycles_per_frame == VIP_TIMING) {
+		vipSlice(fork, credit, waiting, VIP_INTERPRETER_CYCLES);
+		vipFrameEnd(fork, credit, waiting);
+	} else {
+		emulateFrame(fork, sched->cycles_per_frame);
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "chip8.h"
+#include <limits.h>
+
+#define KEY_QUEUE_SIZE 64
+#define MAX_OBSERVERS 8
+#define FRAME_RATE 60	/* Host frames per second */
+#define VIP_TIMING UINT_MAX	/* cycles_per_frame charging the COSMAC VIP's machine cycles instead of instructions */
+
+/* Keypad transition as seen by the frontend */
+typedef struct key_event {
+	double time;		/* Host time of the event, in seconds */
+	unsigned char key;	/* Keypad index (0x0 - 0xF) */
+	unsigned char pressed;
+} KeyEvent;
+
+/* Host key (lower case character) of every keypad key, for the QWERTY and AZERTY layouts */
+extern const char chip8_keymap[2][16];
+int keymapLookup(unsigned char layout, char key);	/* Keypad index of a host key, -1 if unmapped */
+
+/* Called after every emulated frame with the real (not run-ahead) machine state */
+typedef void (*FrameObserver)(void *ctx, const Chip8 *chip);
+
+/* Runs the emulator one host frame at a time. Frontends pump their events once per frame and
+ * queue key transitions with their timestamps; each transition is applied at the emulated
+ * cycle matching its position inside the frame in which it happened */
+typedef struct scheduler {
+	Chip8 *chip;
+	unsigned int cycles_per_frame;	/* Instructions, or VIP_TIMING */
+	int vip_credit;			/* VIP timing: machine cycles left, negative when the last instruction overran */
+	unsigned char vip_waiting;	/* VIP timing: a DXYN waits for the next frame */
+	unsigned char immediate_input;	/* Apply every pending transition at the start of the frame (lowest latency) */
+	double window_start;		/* Host time at which the current input window began */
+	KeyEvent queue[KEY_QUEUE_SIZE];
+	unsigned int head, tail;
+	unsigned long long frames;	/* Emulated frames since schedulerInit() */
+	FrameObserver observers[MAX_OBSERVERS];
+	void *observer_ctx[MAX_OBSERVERS];
+	unsigned int observer_count;
+} Scheduler;
+
+/* -c argument of the frontends: a number of instructions per frame, or "vip". 0 when it is neither */
+unsigned int parseCyclesPerFrame(const char *arg);
+
+void schedulerInit(Scheduler *sched, Chip8 *chip, unsigned int cycles_per_frame, double now);
+int schedulerAddObserver(Scheduler *sched, FrameObserver observer, void *ctx);
+void schedulerQueueKey(Scheduler *sched, double time, unsigned char key, unsigned char pressed);
+void schedulerRunFrame(Scheduler *sched, double now);
+void schedulerRunAhead(Scheduler *sched, Chip8 *ahead, unsigned int frames);
+void schedulerRunFork(const Scheduler *sched, Chip8 *fork, int *credit, unsigned char *waiting);
+
+static inline double schedulerEmulatedSeconds(const Scheduler *sched) {
+	return (double)sched->frames / FRAME_RATE;
+}
+
+#endif
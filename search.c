@@ -0,0 +1,435 @@
+#include "chip8.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* State-space search over keypad inputs: starting from the ROM's initial state, every
+ * allowed key (or no key) is held for one step of a few frames, identical resulting states
+ * are pruned through a shared lock-free visited set, and every distinct screen reached is
+ * written out with the input sequence that produced it */
+
+#define NO_KEY 16
+#define MAX_THREADS 64
+
+typedef struct trail {
+	unsigned int parent;		/* Index of the previous step, the root points to itself */
+	unsigned char key;		/* Key held during this step, NO_KEY for none */
+} Trail;
+
+typedef struct node {
+	Chip8 *state;
+	unsigned int trail;
+	unsigned int depth;
+	unsigned int stale;		/* Steps since this branch last produced a new screen (best-first priority) */
+} Node;
+
+typedef struct node_list {
+	Node *nodes;
+	unsigned int len, cap;
+} NodeList;
+
+/* Open addressing set of 64-bit hashes, insertions use compare-and-swap only */
+typedef struct visited_set {
+	unsigned long long *slots;
+	unsigned long long mask;
+} VisitedSet;
+
+typedef struct search {
+	/* Options */
+	unsigned char keys[17];
+	unsigned int key_count;
+	unsigned int cycles_per_step;
+	unsigned int max_depth;
+	unsigned int max_states;
+	unsigned int threads;
+	int best_first;
+	const char *out_dir;
+
+	VisitedSet states, screens;
+	Trail *trail;
+	unsigned int trail_len;		/* Atomic */
+	unsigned int screen_count;	/* Atomic */
+	unsigned long long expanded;	/* Atomic */
+	int full;			/* Atomic, set once max_states or the visited set is exhausted */
+
+	/* Best-first: shared priority queue */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	NodeList heap;
+	unsigned int busy;
+
+	/* Breadth-first: current level */
+	NodeList *frontier;
+	unsigned int next;		/* Atomic */
+} Search;
+
+static int visitedInit(VisitedSet *set, unsigned int log2_size) {
+	set->slots = calloc(1ULL << log2_size, sizeof(unsigned long long));
+	set->mask = (1ULL << log2_size) - 1;
+	return set->slots != NULL;
+}
+
+/* Returns 1 if the hash was added, 0 if it was already there and -1 if the set is full */
+static int visitedInsert(VisitedSet *set, unsigned long long hash) {
+	unsigned long long i, probes;
+	if (hash == 0)	/* 0 marks empty slots */
+		hash = 1;
+	for (probes = 0, i = hash & set->mask; probes <= set->mask; probes++, i = (i + 1) & set->mask) {
+		unsigned long long slot = __atomic_load_n(&set->slots[i], __ATOMIC_RELAXED);
+		if (slot == 0) {
+			if (__atomic_compare_exchange_n(&set->slots[i], &slot, hash, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return 1;
+			/* Lost the race: slot now holds the other thread's hash */
+		}
+		if (slot == hash)
+			return 0;
+	}
+	return -1;
+}
+
+static void listPush(NodeList *list, const Node *node) {
+	if (list->len == list->cap) {
+		list->cap = list->cap ? list->cap * 2 : 64;
+		list->nodes = realloc(list->nodes, list->cap * sizeof(Node));
+		if (list->nodes == NULL) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(-1);
+		}
+	}
+	list->nodes[list->len++] = *node;
+}
+
+static int nodeBefore(const Node *a, const Node *b) {
+	return a->stale != b->stale ? a->stale < b->stale : a->depth < b->depth;
+}
+
+static void heapPush(NodeList *heap, const Node *node) {
+	unsigned int i = heap->len;
+	listPush(heap, node);
+	while (i > 0 && nodeBefore(&heap->nodes[i], &heap->nodes[(i - 1) / 2])) {
+		Node tmp = heap->nodes[i];
+		heap->nodes[i] = heap->nodes[(i - 1) / 2];
+		heap->nodes[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+}
+
+static Node heapPop(NodeList *heap) {
+	Node top = heap->nodes[0];
+	unsigned int i = 0;
+	heap->nodes[0] = heap->nodes[--heap->len];
+	for (;;) {
+		unsigned int best = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < heap->len && nodeBefore(&heap->nodes[l], &heap->nodes[best]))
+			best = l;
+		if (r < heap->len && nodeBefore(&heap->nodes[r], &heap->nodes[best]))
+			best = r;
+		if (best == i)
+			break;
+		Node tmp = heap->nodes[i];
+		heap->nodes[i] = heap->nodes[best];
+		heap->nodes[best] = tmp;
+		i = best;
+	}
+	return top;
+}
+
+static void writeScreen(Search *search, const Chip8 *chip, unsigned int trail, unsigned int depth) {
+	unsigned int number = __atomic_fetch_add(&search->screen_count, 1, __ATOMIC_RELAXED);
+	char filename[512];
+	unsigned int x, y, i;
+
+	if (search->out_dir == NULL)
+		return;
+
+	/* Framebuffer as a binary PBM */
+	snprintf(filename, sizeof(filename), "%s/screen-%05u.pbm", search->out_dir, number);
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not write %s\n", filename);
+		return;
+	}
+	fprintf(fp, "P4\n%d %d\n", chip->width, chip->height);
+	for (y = 0; y < chip->height; y++) {
+		for (x = 0; x < chip->width; x += 8)
+			fputc(gfxByte(chip, x, y), fp);
+	}
+	fclose(fp);
+
+	/* Input sequence leading to it, one key per step ('-' for none) */
+	char *keys = malloc(depth + 1);
+	keys[depth] = '\0';
+	for (i = depth; i > 0; i--) {
+		keys[i - 1] = search->trail[trail].key == NO_KEY ? '-' : "0123456789ABCDEF"[search->trail[trail].key];
+		trail = search->trail[trail].parent;
+	}
+	pthread_mutex_lock(&search->lock);
+	snprintf(filename, sizeof(filename), "%s/index.txt", search->out_dir);
+	fp = fopen(filename, "a");
+	if (fp != NULL) {
+		fprintf(fp, "screen-%05u.pbm %u %s\n", number, depth, keys);
+		fclose(fp);
+	}
+	pthread_mutex_unlock(&search->lock);
+	free(keys);
+}
+
+/* Runs every allowed input from a node, new states are handed to push() */
+static void expandNode(Search *search, const Node *node, void (*push)(Search *, void *, const Node *), void *ctx) {
+	unsigned int k;
+	__atomic_add_fetch(&search->expanded, 1, __ATOMIC_RELAXED);
+	for (k = 0; k < search->key_count && !__atomic_load_n(&search->full, __ATOMIC_RELAXED); k++) {
+		Chip8 *child = chip8_clone(node->state);
+		unsigned char key = search->keys[k];
+
+		memset(child->keypad, 0, sizeof(child->keypad));
+		if (key != NO_KEY)
+			child->keypad[key] = 1;
+		emulateFrame(child, search->cycles_per_step);
+
+		int inserted = visitedInsert(&search->states, chip8_hash(child));
+		if (inserted != 1) {
+			if (inserted < 0)
+				__atomic_store_n(&search->full, 1, __ATOMIC_RELAXED);
+			chip8_free(child);
+			continue;
+		}
+
+		unsigned int index = __atomic_fetch_add(&search->trail_len, 1, __ATOMIC_RELAXED);
+		if (index >= search->max_states) {
+			__atomic_store_n(&search->full, 1, __ATOMIC_RELAXED);
+			chip8_free(child);
+			continue;
+		}
+		search->trail[index].parent = node->trail;
+		search->trail[index].key = key;
+
+		Node next = {child, index, node->depth + 1, node->stale + 1};
+		if (visitedInsert(&search->screens, chip8_gfx_hash(child)) == 1) {
+			writeScreen(search, child, index, next.depth);
+			next.stale = 0;
+		}
+
+		if (next.depth < search->max_depth)
+			push(search, ctx, &next);
+		else
+			chip8_free(child);
+	}
+}
+
+static void pushLocal(Search *search, void *ctx, const Node *node) {
+	listPush((NodeList *)ctx, node);
+}
+
+static void *bfsWorker(void *arg) {
+	Search *search = ((void **)arg)[0];
+	NodeList *out = ((void **)arg)[1];
+	unsigned int i;
+	while ((i = __atomic_fetch_add(&search->next, 1, __ATOMIC_RELAXED)) < search->frontier->len) {
+		expandNode(search, &search->frontier->nodes[i], pushLocal, out);
+		chip8_free(search->frontier->nodes[i].state);
+	}
+	return NULL;
+}
+
+static void runBreadthFirst(Search *search, Node *root) {
+	NodeList frontier = {0}, local[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	void *args[MAX_THREADS][2];
+	unsigned int t, i, depth = 0;
+
+	listPush(&frontier, root);
+	while (frontier.len > 0) {
+		memset(local, 0, sizeof(local));
+		search->frontier = &frontier;
+		search->next = 0;
+		for (t = 0; t < search->threads; t++) {
+			args[t][0] = search;
+			args[t][1] = &local[t];
+			pthread_create(&threads[t], NULL, bfsWorker, args[t]);
+		}
+		for (t = 0; t < search->threads; t++)
+			pthread_join(threads[t], NULL);
+
+		/* The next level is the concatenation of what every thread found */
+		frontier.len = 0;
+		for (t = 0; t < search->threads; t++) {
+			for (i = 0; i < local[t].len; i++)
+				listPush(&frontier, &local[t].nodes[i]);
+			free(local[t].nodes);
+		}
+		depth++;
+		fprintf(stderr, "Depth %u: %u new states, %u states, %u screens\n", depth, frontier.len,
+				search->trail_len, search->screen_count);
+		if (search->full) {
+			for (i = 0; i < frontier.len; i++)
+				chip8_free(frontier.nodes[i].state);
+			break;
+		}
+	}
+	free(frontier.nodes);
+}
+
+static void pushShared(Search *search, void *ctx, const Node *node) {
+	pthread_mutex_lock(&search->lock);
+	heapPush(&search->heap, node);
+	pthread_cond_signal(&search->cond);
+	pthread_mutex_unlock(&search->lock);
+}
+
+static void *bestFirstWorker(void *arg) {
+	Search *search = arg;
+	for (;;) {
+		pthread_mutex_lock(&search->lock);
+		while (search->heap.len == 0 && search->busy > 0 && !search->full)
+			pthread_cond_wait(&search->cond, &search->lock);
+		if (search->heap.len == 0 || search->full) {
+			/* Nothing left to explore and nobody can produce more */
+			pthread_cond_broadcast(&search->cond);
+			pthread_mutex_unlock(&search->lock);
+			return NULL;
+		}
+		Node node = heapPop(&search->heap);
+		search->busy++;
+		pthread_mutex_unlock(&search->lock);
+
+		expandNode(search, &node, pushShared, NULL);
+		chip8_free(node.state);
+
+		pthread_mutex_lock(&search->lock);
+		search->busy--;
+		if (search->busy == 0)
+			pthread_cond_broadcast(&search->cond);
+		pthread_mutex_unlock(&search->lock);
+	}
+}
+
+static void runBestFirst(Search *search, Node *root) {
+	pthread_t threads[MAX_THREADS];
+	unsigned int t;
+
+	heapPush(&search->heap, root);
+	for (t = 0; t < search->threads; t++)
+		pthread_create(&threads[t], NULL, bestFirstWorker, search);
+	for (t = 0; t < search->threads; t++)
+		pthread_join(threads[t], NULL);
+
+	while (search->heap.len > 0)
+		chip8_free(heapPop(&search->heap).state);
+	free(search->heap.nodes);
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [options] <filename>\n", name);
+	printf("  -k keys     Keys to try, as hex digits (default: all 16), no key is always tried\n");
+	printf("  -f frames   Frames each input is held for (default: 4)\n");
+	printf("  -c cycles   Cycles per frame (default: %d)\n", CYCLES_PER_FRAME);
+	printf("  -d depth    Maximum number of inputs (default: 64)\n");
+	printf("  -n states   Maximum number of distinct states (default: 1000000)\n");
+	printf("  -j threads  Worker threads (default: all cores)\n");
+	printf("  -b          Best-first search, preferring branches that recently reached a new screen\n");
+	printf("  -o dir      Write every distinct screen and its input sequence into dir\n");
+	printf("  -q quirks   Quirk profile or list (default: from the ROM database)\n");
+}
+
+int main(int argc, char *argv[]) {
+	Search search;
+	unsigned int frames = 4, cycles = CYCLES_PER_FRAME, log2_size;
+	int opt, quirks = -1;
+	const char *keys = "0123456789ABCDEF";
+
+	memset(&search, 0, sizeof(search));
+	search.max_depth = 64;
+	search.max_states = 1000000;
+	search.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "k:f:c:d:n:j:bo:q:h")) != -1) {
+		switch (opt) {
+			case 'k': keys = optarg; break;
+			case 'f': frames = strtoul(optarg, NULL, 0); break;
+			case 'c': cycles = strtoul(optarg, NULL, 0); break;
+			case 'd': search.max_depth = strtoul(optarg, NULL, 0); break;
+			case 'n': search.max_states = strtoul(optarg, NULL, 0); break;
+			case 'j': search.threads = strtoul(optarg, NULL, 0); break;
+			case 'b': search.best_first = 1; break;
+			case 'o': search.out_dir = optarg; break;
+			case 'q':
+				if ((quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 0;
+	}
+	if (search.threads < 1)
+		search.threads = 1;
+	if (search.threads > MAX_THREADS)
+		search.threads = MAX_THREADS;
+
+	for (; *keys; keys++) {
+		char digit[2] = {*keys, '\0'};
+		char *end;
+		unsigned long key = strtoul(digit, &end, 16);
+		if (*end != '\0' || search.key_count >= 16) {
+			fprintf(stderr, "Invalid key list\n");
+			return -1;
+		}
+		search.keys[search.key_count++] = key;
+	}
+	search.keys[search.key_count++] = NO_KEY;
+	search.cycles_per_step = frames * cycles;
+
+	/* Every inserted hash is a state of the trail: max_states, plus the children of one expansion per
+	 * thread past the limit. Visited sets are sized to stay at most half full */
+	unsigned long long trail_cap = search.max_states + (unsigned long long)search.key_count * search.threads;
+	for (log2_size = 10; (1ULL << log2_size) < 2 * trail_cap; log2_size++);
+	search.trail = malloc(trail_cap * sizeof(Trail));
+	if (search.trail == NULL || !visitedInit(&search.states, log2_size) || !visitedInit(&search.screens, log2_size)) {
+		fprintf(stderr, "Out of memory!\n");
+		return -1;
+	}
+	pthread_mutex_init(&search.lock, NULL);
+	pthread_cond_init(&search.cond, NULL);
+
+	Chip8 start;
+	initialize(&start);
+	start.debug = 0;
+	if (!loadProgram(&start, argv[optind]))
+		return -1;
+	if (quirks >= 0)
+		start.quirks = quirks;
+
+	Node root = {chip8_clone(&start), 0, 0, 0};
+	search.trail[0].parent = 0;
+	search.trail[0].key = NO_KEY;
+	search.trail_len = 1;
+	visitedInsert(&search.states, chip8_hash(&start));
+	if (visitedInsert(&search.screens, chip8_gfx_hash(&start)) == 1)
+		writeScreen(&search, &start, 0, 0);
+	chip8_release(&start);
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (search.best_first)
+		runBestFirst(&search, &root);
+	else
+		runBreadthFirst(&search, &root);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	unsigned int states = search.trail_len < search.max_states ? search.trail_len : search.max_states;
+	printf("%llu states expanded, %u distinct states, %u distinct screens in %.2fs (%.0f steps/s)%s\n",
+			search.expanded, states, search.screen_count, elapsed,
+			elapsed > 0 ? search.expanded * search.key_count / elapsed : 0.0,
+			search.full ? " - state limit reached" : "");
+
+	free(search.trail);
+	free(search.states.slots);
+	free(search.screens.slots);
+	return 0;
+}
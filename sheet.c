@@ -0,0 +1,396 @@
+#include "chip8.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* Contact sheet: every ROM found under the given paths is run headless, spread over all cores, and
+ * its screen is captured at a few frame numbers. The captures are assembled into a single PNG with
+ * one tile per ROM (captures side by side, in the window's colors) and the tile of every ROM is
+ * listed on stdout */
+
+#define MAX_CAPTURES 16
+#define MAX_THREADS 64
+#define TILE_GAP 6	/* Background pixels around tiles */
+#define CAPTURE_GAP 2	/* Background pixels between the captures of a tile */
+
+/* Palette indices of the PNG, 2 bits per pixel */
+#define COLOR_OFF 0
+#define COLOR_ON 1
+#define COLOR_BACKGROUND 2
+
+typedef struct capture {
+	unsigned char width, height;	/* Screen mode, 0x0 when the ROM could not be run */
+	unsigned long long gfx[PLANES][MAX_HEIGHT][GFX_WORDS];
+} Capture;
+
+typedef struct sheet {
+	char **roms;
+	unsigned int rom_count, rom_cap;
+
+	/* Options */
+	unsigned long long captures[MAX_CAPTURES];	/* Frame numbers, increasing */
+	unsigned int capture_count;
+	unsigned int cycles_per_frame;
+	unsigned int scale, columns, threads;
+	unsigned int seed;
+	int quirks;			/* -1 for the ROM database's */
+
+	Capture *screens;		/* capture_count framebuffers per ROM */
+	unsigned int next;		/* Atomic, next ROM to run */
+} Sheet;
+
+static int addRom(Sheet *sheet, const char *path) {
+	if (sheet->rom_count == sheet->rom_cap) {
+		sheet->rom_cap = sheet->rom_cap ? 2 * sheet->rom_cap : 128;
+		sheet->roms = realloc(sheet->roms, sheet->rom_cap * sizeof(char *));
+	}
+	sheet->roms[sheet->rom_count++] = strdup(path);
+	return 1;
+}
+
+/* Adds path if it is a ROM, or every .ch8 file below it if it is a directory */
+static int scanPath(Sheet *sheet, const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "%s not found!\n", path);
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return addRom(sheet, path);
+
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	if (dir == NULL) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return 0;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		char child[4096];
+		const char *ext = strrchr(entry->d_name, '.');
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+		if (stat(child, &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			scanPath(sheet, child);
+		else if (ext != NULL && strcasecmp(ext, ".ch8") == 0)
+			addRom(sheet, child);
+	}
+	closedir(dir);
+	return 1;
+}
+
+static int compareNames(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void runRom(Sheet *sheet, unsigned int rom) {
+	Capture *screens = sheet->screens + (size_t)rom * sheet->capture_count;
+	unsigned long long frame = 0;
+	unsigned int i;
+	Chip8 chip;
+
+	FILE *fp = fopen(sheet->roms[rom], "rb");
+	if (fp == NULL) {
+		/* Its captures stay 0x0, and its tile background */
+		fprintf(stderr, "Could not open %s\n", sheet->roms[rom]);
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (length > MAX_MEGA_PROGRAM_SIZE)
+		length = MAX_MEGA_PROGRAM_SIZE;
+	unsigned char *program = malloc(length > 0 ? length : 1);
+	unsigned int size = fread(program, 1, length, fp);
+	fclose(fp);
+
+	initialize(&chip);
+	chip.debug = 0;
+	chip.rng = sheet->seed;
+	loadProgramBuffer(&chip, program, size);
+	free(program);
+	if (sheet->quirks >= 0)
+		chip.quirks = sheet->quirks;
+	for (i = 0; i < sheet->capture_count; i++) {
+		emulateFrame(&chip, (sheet->captures[i] - frame) * sheet->cycles_per_frame);
+		frame = sheet->captures[i];
+		screens[i].width = chip.width;
+		screens[i].height = chip.height;
+		memcpy(screens[i].gfx, chip.gfx, sizeof(chip.gfx));
+	}
+	chip8_release(&chip);
+}
+
+static void *worker(void *arg) {
+	Sheet *sheet = arg;
+	unsigned int rom;
+	while ((rom = __atomic_fetch_add(&sheet->next, 1, __ATOMIC_RELAXED)) < sheet->rom_count)
+		runRom(sheet, rom);
+	return NULL;
+}
+
+/* PNG output: the image data is stored in uncompressed deflate blocks, no compression library needed */
+
+static unsigned int crc_table[256];
+
+static void initCrc(void) {
+	unsigned int n, k;
+	for (n = 0; n < 256; n++) {
+		unsigned int c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+static unsigned int updateCrc(unsigned int crc, const unsigned char *data, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++)
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void putBE(unsigned char *out, unsigned int value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+}
+
+static void writeChunk(FILE *fp, const char *type, const unsigned char *data, size_t len) {
+	unsigned char bytes[4];
+	putBE(bytes, len);
+	fwrite(bytes, 1, 4, fp);
+	fwrite(type, 1, 4, fp);
+	fwrite(data, 1, len, fp);
+	unsigned int crc = updateCrc(updateCrc(0xFFFFFFFFu, (const unsigned char *)type, 4), data, len);
+	putBE(bytes, crc ^ 0xFFFFFFFFu);
+	fwrite(bytes, 1, 4, fp);
+}
+
+/* rows: height rows of (1 + stride) bytes, each starting with its filter type */
+static int writePng(const char *filename, unsigned int width, unsigned int height, const unsigned char *rows, size_t len) {
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not create %s\n", filename);
+		return 0;
+	}
+	fwrite("\x89PNG\r\n\x1A\n", 1, 8, fp);
+
+	unsigned char header[13];
+	putBE(header, width);
+	putBE(header + 4, height);
+	header[8] = 2;		/* Bit depth */
+	header[9] = 3;		/* Palette */
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+	writeChunk(fp, "IHDR", header, sizeof(header));
+	/* Same colors as the window */
+	writeChunk(fp, "PLTE", (const unsigned char *)"\x00\x00\x00\xFF\xFF\xFF\x00\x00\xFF", 9);
+
+	/* zlib stream made of stored blocks */
+	size_t blocks = (len + 0xFFFE) / 0xFFFF, pos = 0, out = 0;
+	unsigned char *zlib = malloc(2 + len + 5 * (blocks ? blocks : 1) + 4);
+	unsigned int a = 1, b = 0;
+	zlib[out++] = 0x78;
+	zlib[out++] = 0x01;
+	do {
+		size_t block = len - pos > 0xFFFF ? 0xFFFF : len - pos;
+		zlib[out++] = pos + block == len;	/* Final block flag, stored type */
+		zlib[out++] = block & 0xFF;
+		zlib[out++] = block >> 8;
+		zlib[out++] = ~block & 0xFF;
+		zlib[out++] = (~block >> 8) & 0xFF;
+		memcpy(zlib + out, rows + pos, block);
+		out += block;
+		pos += block;
+	} while (pos < len);
+	for (pos = 0; pos < len; pos++) {	/* Adler-32 */
+		a = (a + rows[pos]) % 65521;
+		b = (b + a) % 65521;
+	}
+	putBE(zlib + out, b << 16 | a);
+	out += 4;
+	writeChunk(fp, "IDAT", zlib, out);
+	writeChunk(fp, "IEND", NULL, 0);
+	free(zlib);
+	fclose(fp);
+	return 1;
+}
+
+static void setPixel(unsigned char *rows, size_t stride, unsigned int x, unsigned int y, unsigned char color) {
+	unsigned char *byte = rows + y * (stride + 1) + 1 + x / 4;
+	unsigned int shift = 6 - 2 * (x % 4);
+	*byte = (*byte & ~(3 << shift)) | color << shift;
+}
+
+/* A capture fills a MAX_WIDTH x MAX_HEIGHT area, smaller screen modes are enlarged by the largest
+ * integer factor that fits and centered, with the rest of the area unset. ROMs that could not be
+ * run keep a background tile */
+static int writeSheet(const Sheet *sheet, const char *filename) {
+	unsigned int capture_w = MAX_WIDTH * sheet->scale, capture_h = MAX_HEIGHT * sheet->scale;
+	unsigned int tile_w = sheet->capture_count * (capture_w + CAPTURE_GAP) - CAPTURE_GAP;
+	unsigned int rows_of_tiles = (sheet->rom_count + sheet->columns - 1) / sheet->columns;
+	unsigned int width = sheet->columns * (tile_w + TILE_GAP) + TILE_GAP;
+	unsigned int height = rows_of_tiles * (capture_h + TILE_GAP) + TILE_GAP;
+	size_t stride = (width + 3) / 4;
+	unsigned char *rows = malloc((stride + 1) * height);
+	unsigned int rom, i, x, y;
+
+	/* Background everywhere (0b10 in every 2-bit pixel), filter type 0 on every row */
+	memset(rows, 0xAA, (stride + 1) * height);
+	for (y = 0; y < height; y++)
+		rows[y * (stride + 1)] = 0;
+
+	for (rom = 0; rom < sheet->rom_count; rom++) {
+		unsigned int tile_x = TILE_GAP + (rom % sheet->columns) * (tile_w + TILE_GAP);
+		unsigned int tile_y = TILE_GAP + (rom / sheet->columns) * (capture_h + TILE_GAP);
+		const Capture *first = &sheet->screens[(size_t)rom * sheet->capture_count];
+		if (first->width == 0 || first->height == 0) {
+			printf("%u %u %s (failed)\n", rom / sheet->columns, rom % sheet->columns, sheet->roms[rom]);
+			continue;
+		}
+		for (i = 0; i < sheet->capture_count; i++) {
+			const Capture *capture = &sheet->screens[(size_t)rom * sheet->capture_count + i];
+			unsigned int factor_x = MAX_WIDTH / capture->width, factor_y = MAX_HEIGHT / capture->height;
+			unsigned int scale = sheet->scale * (factor_x < factor_y ? factor_x : factor_y);
+			unsigned int shown_w = capture->width * scale, shown_h = capture->height * scale;
+			unsigned int capture_x = tile_x + i * (capture_w + CAPTURE_GAP);
+			for (y = 0; y < capture_h; y++) {
+				for (x = 0; x < capture_w; x++) {
+					unsigned int px = x - (capture_w - shown_w) / 2, py = y - (capture_h - shown_h) / 2;
+					unsigned char on = 0;
+					if (px < shown_w && py < shown_h) {
+						px /= scale;
+						py /= scale;
+						on = ((capture->gfx[0][py][px >> 6] | capture->gfx[1][py][px >> 6]) >> (63 - (px & 63))) & 1;
+					}
+					setPixel(rows, stride, capture_x + x, tile_y + y, on ? COLOR_ON : COLOR_OFF);
+				}
+			}
+		}
+		printf("%u %u %s\n", rom / sheet->columns, rom % sheet->columns, sheet->roms[rom]);
+	}
+
+	int ok = writePng(filename, width, height, rows, (stride + 1) * height);
+	free(rows);
+	return ok;
+}
+
+static int parseCaptures(Sheet *sheet, const char *list) {
+	char *end;
+	sheet->capture_count = 0;
+	while (*list != '\0') {
+		unsigned long long frame = strtoull(list, &end, 0);
+		if (end == list || frame == 0 || sheet->capture_count == MAX_CAPTURES ||
+				(sheet->capture_count > 0 && frame <= sheet->captures[sheet->capture_count - 1]))
+			return 0;
+		sheet->captures[sheet->capture_count++] = frame;
+		list = *end == ',' ? end + 1 : end;
+	}
+	return sheet->capture_count > 0;
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-f frames] [-c cycles per frame] [-s scale] [-w columns] [-j threads] [-r seed] [-q quirks] [-o out.png] <rom or directory> ...\n", name);
+	printf("  -f  Increasing, comma separated frame numbers to capture (default: 60,300,1200)\n");
+	printf("Prints the row, column and path of every tile\n");
+}
+
+int main(int argc, char *argv[]) {
+	Sheet sheet;
+	const char *output = "contact-sheet.png";
+	pthread_t threads[MAX_THREADS];
+	unsigned int t;
+	int opt;
+
+	memset(&sheet, 0, sizeof(sheet));
+	parseCaptures(&sheet, "60,300,1200");
+	sheet.cycles_per_frame = CYCLES_PER_FRAME;
+	sheet.scale = 2;
+	sheet.columns = 4;
+	sheet.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	sheet.seed = 1;
+	sheet.quirks = -1;
+	while ((opt = getopt(argc, argv, "f:c:s:w:j:r:q:o:h")) != -1) {
+		switch (opt) {
+			case 'f':
+				if (!parseCaptures(&sheet, optarg)) {
+					fprintf(stderr, "Invalid frame list %s\n", optarg);
+					return -1;
+				}
+				break;
+			case 'c': {
+				char *end;
+				sheet.cycles_per_frame = strtoul(optarg, &end, 0);
+				if (strcmp(optarg, "vip") == 0) {
+					/* Tiles run on the bare interpreter, without the scheduler */
+					fprintf(stderr, "The VIP timing is not supported here\n");
+					return -1;
+				}
+				if (end == optarg || *end != '\0' || sheet.cycles_per_frame == 0) {
+					fprintf(stderr, "Invalid cycles per frame %s\n", optarg);
+					return -1;
+				}
+				break;
+			}
+			case 's': sheet.scale = strtoul(optarg, NULL, 0); break;
+			case 'w': sheet.columns = strtoul(optarg, NULL, 0); break;
+			case 'j': sheet.threads = strtoul(optarg, NULL, 0); break;
+			case 'r': sheet.seed = strtoul(optarg, NULL, 0) | 1; break;
+			case 'q':
+				if ((sheet.quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			case 'o': output = optarg; break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc || sheet.scale == 0 || sheet.columns == 0) {
+		usage(argv[0]);
+		return 0;
+	}
+	if (sheet.threads == 0)
+		sheet.threads = 1;
+	if (sheet.threads > MAX_THREADS)
+		sheet.threads = MAX_THREADS;
+
+	for (; optind < argc; optind++) {
+		if (!scanPath(&sheet, argv[optind]))
+			return -1;
+	}
+	if (sheet.rom_count == 0) {
+		fprintf(stderr, "No ROM found\n");
+		return -1;
+	}
+	qsort(sheet.roms, sheet.rom_count, sizeof(char *), compareNames);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sheet.screens = calloc((size_t)sheet.rom_count * sheet.capture_count, sizeof(Capture));
+	for (t = 0; t < sheet.threads; t++)
+		pthread_create(&threads[t], NULL, worker, &sheet);
+	for (t = 0; t < sheet.threads; t++)
+		pthread_join(threads[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	initCrc();
+	if (!writeSheet(&sheet, output))
+		return -1;
+	fprintf(stderr, "%u ROMs run for %llu frames on %u threads in %.3f s, sheet written to %s\n", sheet.rom_count,
+			sheet.captures[sheet.capture_count - 1], sheet.threads,
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, output);
+
+	for (t = 0; t < sheet.rom_count; t++)
+		free(sheet.roms[t]);
+	free(sheet.roms);
+	free(sheet.screens);
+	return 0;
+}
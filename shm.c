@@ -0,0 +1,114 @@
+#include "shm.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct shm_publisher {
+	char name[256];
+	SharedSegment *seg;
+	unsigned long long frame;
+	unsigned long long gfx_hash;	/* Hash of the framebuffer already in the segment */
+};
+
+ShmPublisher *shmOpen(const char *name) {
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Could not create shared memory %s\n", name);
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(SharedSegment)) != 0) {
+		fprintf(stderr, "Could not resize shared memory %s\n", name);
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	SharedSegment *seg = mmap(NULL, sizeof(SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) {
+		fprintf(stderr, "Could not map shared memory %s\n", name);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	ShmPublisher *pub = calloc(1, sizeof(ShmPublisher));
+	snprintf(pub->name, sizeof(pub->name), "%s", name);
+	pub->seg = seg;
+	memset(seg, 0, sizeof(SharedSegment));
+	seg->width = MAX_WIDTH;
+	seg->height = MAX_HEIGHT;
+	seg->version = SHM_VERSION;
+	__atomic_store_n(&seg->magic, SHM_MAGIC, __ATOMIC_RELEASE);	/* Last: readers check it before anything else */
+	return pub;
+}
+
+void shmPublish(void *ctx, const Chip8 *chip) {
+	ShmPublisher *pub = ctx;
+	SharedSegment *seg = pub->seg;
+	SharedState *state = &seg->state;
+	unsigned int seq = seg->seq;
+
+	__atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);	/* The odd sequence number is visible before any new data */
+
+	state->frame = ++pub->frame;
+	state->pc = chip->pc;
+	state->index_reg = chip->index_reg;
+	memcpy(state->stack, chip->stack, sizeof(state->stack));
+	memcpy(state->V, chip->V, sizeof(state->V));
+	state->sp = chip->sp;
+	state->delay_timer = chip->delay_timer;
+	state->sound_timer = chip->sound_timer;
+	memcpy(state->keypad, chip->keypad, sizeof(state->keypad));
+	/* Most frames leave the screen alone: only copy it when its hash changed */
+	if (chip8_gfx_hash(chip) != pub->gfx_hash || chip->width != state->width || chip->height != state->height) {
+		state->width = chip->width;
+		state->height = chip->height;
+		memcpy(state->gfx, chip->gfx, sizeof(state->gfx));
+		state->gfx_hash = pub->gfx_hash = chip8_gfx_hash(chip);
+	}
+
+	__atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void shmClose(ShmPublisher *pub) {
+	munmap(pub->seg, sizeof(SharedSegment));
+	shm_unlink(pub->name);
+	free(pub);
+}
+
+const SharedSegment *shmAttach(const char *name) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Shared memory %s not found!\n", name);
+		return NULL;
+	}
+	const SharedSegment *seg = mmap(NULL, sizeof(SharedSegment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) {
+		fprintf(stderr, "Could not map shared memory %s\n", name);
+		return NULL;
+	}
+	if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || seg->version != SHM_VERSION ||
+			seg->width != MAX_WIDTH || seg->height != MAX_HEIGHT) {
+		fprintf(stderr, "Shared memory %s has an unknown layout\n", name);
+		munmap((void *)seg, sizeof(SharedSegment));
+		return NULL;
+	}
+	return seg;
+}
+
+void shmSnapshot(const SharedSegment *seg, SharedState *out) {
+	unsigned int before, after;
+	do {
+		while ((before = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE)) & 1) {
+			/* Writer in progress: it finishes within one copy */
+		}
+		memcpy(out, &seg->state, sizeof(SharedState));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);	/* The copy completes before the sequence number is read again */
+		after = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+	} while (before != after);
+}
+
+void shmDetach(const SharedSegment *seg) {
+	munmap((void *)seg, sizeof(SharedSegment));
+}
@@ -0,0 +1,46 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "chip8.h"
+
+/* Live machine state published in a POSIX shared-memory segment (shm_open name, e.g. "/chip8")
+ * for external readers. The emulator is the only writer and never waits: it makes the sequence
+ * number odd, copies the state and makes it even again. Readers copy the state and retry when
+ * the sequence number was odd or changed in the meantime */
+
+#define SHM_MAGIC 0x38504843u	/* "CHP8" */
+#define SHM_VERSION 5
+
+typedef struct shared_state {
+	unsigned long long frame;	/* Emulated frames since the emulator started */
+	unsigned long long gfx_hash;	/* chip8_gfx_hash() of gfx */
+	unsigned short pc;
+	unsigned int index_reg;		/* 24 bits for MegaChip */
+	unsigned short stack[16];
+	unsigned char V[16];
+	unsigned char sp, delay_timer, sound_timer;
+	unsigned char keypad[16];
+	unsigned char width, height;	/* Screen mode, the top left part of gfx in use */
+	unsigned long long gfx[PLANES][MAX_HEIGHT][GFX_WORDS];	/* One bit per pixel and plane, leftmost pixel in the most significant bit */
+} SharedState;
+
+typedef struct shared_segment {
+	unsigned int magic, version;
+	unsigned int width, height;	/* Largest screen mode, the size of gfx */
+	unsigned int seq;		/* Odd while the writer is updating state */
+	SharedState state;
+} SharedSegment;
+
+typedef struct shm_publisher ShmPublisher;
+
+/* Writer side */
+ShmPublisher *shmOpen(const char *name);
+void shmPublish(void *pub, const Chip8 *chip);	/* FrameObserver */
+void shmClose(ShmPublisher *pub);		/* Unmaps and unlinks the segment */
+
+/* Reader side */
+const SharedSegment *shmAttach(const char *name);
+void shmSnapshot(const SharedSegment *seg, SharedState *out);	/* Consistent copy of the latest frame */
+void shmDetach(const SharedSegment *seg);
+
+#endif
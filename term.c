@@ -0,0 +1,288 @@
+#include "scheduler.h"
+#include "record.h"
+#include "shm.h"
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <ctype.h>
+
+/* Terminal frontend: the framebuffer is drawn with Unicode half blocks (1x2 pixels per cell) or
+ * braille patterns (2x4 pixels per cell), and only the cells that changed since the previous
+ * frame are written. Keys come from raw stdin; terminals only report presses, so a key is
+ * released again when it has not been repeated for a few frames */
+
+#define KEY_HOLD_FRAMES 8	/* About the delay before a held key starts auto-repeating */
+#define MAX_CELLS (MAX_WIDTH * MAX_HEIGHT)
+
+typedef struct term_renderer {
+	int braille;
+	unsigned int cell_w, cell_h;		/* Pixels per cell */
+	unsigned int cols, rows;		/* Cells */
+	unsigned short cells[MAX_CELLS];	/* Pattern currently shown in every cell */
+	char out[MAX_CELLS * 16 + 64];		/* Escape sequences of one frame */
+	unsigned long long bytes, frames;	/* Output statistics */
+} TermRenderer;
+
+static struct termios saved_termios;
+static volatile sig_atomic_t quit = 0;
+
+static void onSignal(int sig) {
+	quit = 1;
+}
+
+static void restoreTerminal(void) {
+	const char *reset = "\x1b[0m\x1b[?25h\x1b[?1049l";	/* Show cursor, leave the alternate screen */
+	if (write(STDOUT_FILENO, reset, strlen(reset)) < 0) {
+		/* Nothing left to do about it */
+	}
+	tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+
+static int setupTerminal(void) {
+	struct termios raw;
+	if (tcgetattr(STDIN_FILENO, &saved_termios) != 0) {
+		fprintf(stderr, "stdin is not a terminal\n");
+		return 0;
+	}
+	raw = saved_termios;
+	raw.c_lflag &= ~(ICANON | ECHO);	/* Keep ISIG so that Ctrl-C still quits */
+	raw.c_iflag &= ~(IXON | ICRNL);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	atexit(restoreTerminal);
+
+	const char *init = "\x1b[?1049h\x1b[?25l\x1b[2J";	/* Alternate screen, hide cursor, clear */
+	if (write(STDOUT_FILENO, init, strlen(init)) < 0) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Bit pattern of the pixels covered by a cell */
+static unsigned short cellPattern(const TermRenderer *term, const Chip8 *chip, unsigned int col, unsigned int row) {
+	unsigned int x0 = col * term->cell_w, y0 = row * term->cell_h;
+	if (!term->braille) {
+		return gfxPixel(chip, x0, y0) | gfxPixel(chip, x0, y0 + 1) << 1;
+	}
+	/* Braille dot numbering: left column 1, 2, 3, 7 and right column 4, 5, 6, 8 */
+	static const unsigned char dots[4][2] = {{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+	unsigned short pattern = 0;
+	unsigned int x, y;
+	for (y = 0; y < 4; y++) {
+		for (x = 0; x < 2; x++) {
+			if (gfxPixel(chip, x0 + x, y0 + y))
+				pattern |= dots[y][x];
+		}
+	}
+	return pattern;
+}
+
+static unsigned int putCell(const TermRenderer *term, char *out, unsigned short pattern) {
+	if (term->braille) {
+		/* U+2800 + pattern in UTF-8 */
+		out[0] = (char)0xE2;
+		out[1] = (char)(0xA0 | (pattern >> 6));
+		out[2] = (char)(0x80 | (pattern & 0x3F));
+		return 3;
+	}
+	static const char *blocks[4] = {" ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88"};	/* Empty, upper, lower, full */
+	unsigned int len = strlen(blocks[pattern]);
+	memcpy(out, blocks[pattern], len);
+	return len;
+}
+
+static void renderInit(TermRenderer *term, int braille) {
+	term->braille = braille;
+	term->cell_w = braille ? 2 : 1;
+	term->cell_h = braille ? 4 : 2;
+	term->cols = 0;	/* No screen mode yet: the first frame draws everything */
+	term->rows = 0;
+	term->bytes = 0;
+	term->frames = 0;
+}
+
+/* Writes the cells that changed, only looking at the rows marked dirty by the core */
+static void renderFrame(TermRenderer *term, Chip8 *chip, int full) {
+	unsigned int row, col, len = 0;
+	int cursor_row = -1, cursor_col = -1;
+
+	if (term->cols != chip->width / term->cell_w || term->rows != chip->height / term->cell_h) {
+		/* New screen mode: start over from a clear terminal */
+		unsigned int i;
+		term->cols = chip->width / term->cell_w;
+		term->rows = chip->height / term->cell_h;
+		for (i = 0; i < MAX_CELLS; i++) {
+			term->cells[i] = 0xFFFF;	/* Not a valid pattern */
+		}
+		len += sprintf(term->out + len, "\x1b[2J");
+		full = 1;
+	}
+
+	for (row = 0; row < term->rows; row++) {
+		unsigned long long rows_mask = ((1ULL << term->cell_h) - 1) << (row * term->cell_h);
+		if (!full && !(chip->dirty_rows & rows_mask))
+			continue;
+		for (col = 0; col < term->cols; col++) {
+			unsigned short pattern = cellPattern(term, chip, col, row);
+			if (pattern == term->cells[row * term->cols + col])
+				continue;
+			term->cells[row * term->cols + col] = pattern;
+			if ((int)row != cursor_row || (int)col != cursor_col) {
+				len += sprintf(term->out + len, "\x1b[%u;%uH", row + 1, col + 1);
+			}
+			len += putCell(term, term->out + len, pattern);
+			cursor_row = row;
+			cursor_col = col + 1;
+		}
+	}
+	clearDirty(chip);
+	chip->update_screen = 0;
+
+	if (len > 0 && write(STDOUT_FILENO, term->out, len) < 0) {
+		quit = 1;
+	}
+	term->bytes += len;
+	term->frames++;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleepUntil(double time) {
+	double remaining = time - now();
+	if (remaining > 0) {
+		struct timespec ts = { (time_t)remaining, (long)((remaining - (time_t)remaining) * 1e9) };
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* Reads every pending byte of stdin and queues the corresponding presses */
+static void readKeys(Scheduler *sched, unsigned long long *held_until, double time) {
+	char buffer[64];
+	ssize_t len, i;
+	while ((len = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+		for (i = 0; i < len; i++) {
+			if (buffer[i] == '\t') {
+				sched->chip->key_layout = !sched->chip->key_layout;
+				continue;
+			}
+			int key = keymapLookup(sched->chip->key_layout, tolower((unsigned char)buffer[i]));
+			if (key < 0)
+				continue;
+			if (held_until[key] <= sched->frames)
+				schedulerQueueKey(sched, time, key, 1);
+			held_until[key] = sched->frames + KEY_HOLD_FRAMES;
+		}
+	}
+	for (i = 0; i < 16; i++) {
+		if (held_until[i] != 0 && held_until[i] <= sched->frames) {
+			schedulerQueueKey(sched, time, i, 0);
+			held_until[i] = 0;
+		}
+	}
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-c cycles per frame|vip] [-b] [-r recording] [-m shm name] [-q quirks] <filename>\n", name);
+	printf("  -b  Braille cells (2x4 pixels) instead of half blocks (1x2 pixels)\n");
+}
+
+int main(int argc, char *argv[]) {
+	static TermRenderer term;
+	Chip8 chip8;
+	Scheduler sched;
+	Recorder *recorder = NULL;
+	const char *record_path = NULL, *shm_name = NULL;
+	ShmPublisher *publisher = NULL;
+	unsigned int cycles = CYCLES_PER_FRAME;
+	unsigned long long held_until[16] = {0};	/* Frame at which a key counts as released */
+	int braille = 0, opt, quirks = -1;
+
+	while ((opt = getopt(argc, argv, "c:br:m:q:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				if ((cycles = parseCyclesPerFrame(optarg)) == 0) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'b': braille = 1; break;
+			case 'r': record_path = optarg; break;
+			case 'm': shm_name = optarg; break;
+			case 'q':
+				if ((quirks = parseQuirks(optarg)) < 0)
+					return -1;
+				break;
+			default:
+				usage(argv[0]);
+				return 0;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	initialize(&chip8);
+	chip8.debug = 0;
+	if (!loadProgram(&chip8, argv[optind])) {
+		return -1;
+	}
+	if (quirks >= 0) {
+		chip8.quirks = quirks;
+	}
+	if (!setupTerminal()) {
+		return -1;
+	}
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	renderInit(&term, braille);
+	schedulerInit(&sched, &chip8, cycles, now());
+	if (record_path != NULL) {
+		unsigned int width, height;
+		largestScreenMode(&chip8, &width, &height);
+		recorder = recorderOpen(record_path, width, height, FRAME_RATE);
+		if (recorder != NULL) {
+			schedulerAddObserver(&sched, recorderFrame, recorder);
+		}
+	}
+	if (shm_name != NULL) {
+		publisher = shmOpen(shm_name);
+		if (publisher != NULL) {
+			schedulerAddObserver(&sched, shmPublish, publisher);
+		}
+	}
+
+	double deadline = now();
+	renderFrame(&term, &chip8, 1);
+	while (!quit) {
+		double frameStart = now();
+		readKeys(&sched, held_until, frameStart);
+		schedulerRunFrame(&sched, frameStart);
+		if (chip8.update_screen) {
+			renderFrame(&term, &chip8, 0);
+		}
+
+		deadline += 1.0 / FRAME_RATE;
+		if (deadline < now()) {
+			deadline = now();	/* Fell behind: do not try to catch up */
+		}
+		sleepUntil(deadline);
+	}
+
+	if (recorder != NULL) {
+		recorderClose(recorder);
+	}
+	if (publisher != NULL) {
+		shmClose(publisher);
+	}
+	restoreTerminal();
+	printf("%llu frames drawn, %.1f bytes per frame\n", term.frames, term.frames ? (double)term.bytes / term.frames : 0.0);
+	chip8_release(&chip8);
+	return 0;
+}
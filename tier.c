@@ -0,0 +1,743 @@
+#include "tier.h"
+
+#define TIER_SLOTS (MEMORY_MASK + 1)	/* Blocks and counters by address, XO-CHIP's larger memory shares them */
+#define LIVE_I (1 << 16)		/* Liveness bit of I, V0 to VF being bits 0 to 15 */
+#define LIVE_ALL (LIVE_I | 0xFFFF)
+
+/* Operations of the compiled blocks: VX op= VY, or op= imm */
+enum {
+	OP_NONE,	/* Eliminated */
+	OP_SET, OP_ADD_IMM, OP_MOV, OP_OR, OP_AND, OP_XOR, OP_OR_IMM, OP_AND_IMM, OP_XOR_IMM,
+	OP_ADD, OP_ADD_NF, OP_ADD_IMM_F, OP_SUB, OP_SUB_NF, OP_SUB_IMM_F, OP_SUBN, OP_SUBN_NF,	/* _NF: VF dead, not set */
+	OP_SHR, OP_SHR_NF, OP_SHL, OP_SHL_NF,	/* VY is the register shifted into VX: VX itself, or VY with QUIRK_SHIFT_VY */
+	OP_SET_I, OP_ADD_I, OP_FONT, OP_BIG_FONT, OP_RND, OP_GET_DT, OP_SET_DT, OP_SET_ST,
+	OP_LOAD, OP_STORE, OP_BCD, OP_SAVE_FLAGS, OP_LOAD_FLAGS,	/* Y set: I moves past the registers */
+	OP_SIDE_EXIT,	/* Leaves the block by sides[pos] when the skip condition holds */
+	OP_SKIP,	/* Jumps over the span ops of the next instruction when the skip condition holds */
+	OP_INTERPRET	/* DXYN or 00E0 at address imm, handed to the interpreter */
+};
+
+/* How a block ends: a skip takes its taken path when the condition holds, the others take fall.
+ * The skips are also the conditions of side exits */
+enum {
+	EXIT_FALL,
+	EXIT_EQ_IMM, EXIT_NE_IMM, EXIT_EQ, EXIT_NE, EXIT_KEY, EXIT_NO_KEY,
+	EXIT_CALL,	/* taken when the stack is full */
+	EXIT_RET, EXIT_JUMP_V	/* pc computed at run time */
+};
+
+typedef struct tier_op {
+	unsigned char kind, x, y;
+	unsigned char pos;	/* Instruction of the block it comes from, for the timers */
+	unsigned char condition;	/* EXIT_* of a side exit or skip */
+	unsigned char span;	/* Ops a skip jumps over */
+	unsigned char guarded;	/* Of an instruction a skip may jump over */
+	unsigned short imm;
+} TierOp;
+
+/* Where an exit leads, the last instruction executed and how many were */
+typedef struct tier_path {
+	unsigned short pc, opcode;
+	unsigned char count;
+} TierPath;
+
+typedef struct tier_block {
+	unsigned short start;
+	unsigned char quirks, variants;	/* Compiled for */
+	unsigned char length;		/* Instructions of the longest path, 0 when the first one is not compiled */
+	unsigned short code_len;
+	unsigned char code[MEM_PAGE_SIZE];	/* Code compiled, with the words skipped, within one page */
+	unsigned long long mem_hash;	/* Memory the code was last found in */
+	unsigned char exit, ex, ey;
+	unsigned short eimm;
+	TierPath taken, fall;
+	TierPath sides[TIER_MAX_BLOCK];	/* Skips over the rest of the block, by instruction */
+	unsigned short tail_skip;	/* Skip before the last instruction of fall if there is one: last executed when it skips */
+	unsigned int op_count;
+	TierOp ops[2 * TIER_MAX_BLOCK];	/* A folded instruction can set VX and VF */
+} TierBlock;
+
+typedef struct tier {
+	TierBlock *blocks[TIER_SLOTS];
+	unsigned short counters[TIER_SLOTS];
+} Tier;
+
+static __thread Tier *tier;
+
+typedef struct compiler {
+	TierBlock *block;
+	unsigned int known;	/* Bit x: VX holds value[x] */
+	unsigned char value[16];
+	unsigned char guard;	/* Compiling an instruction a skip may jump over */
+} Compiler;
+
+static inline const unsigned char *codeAt(const Chip8 *chip, unsigned int addr) {
+	return chip->pages[addr >> MEM_PAGE_SHIFT]->data + (addr & (MEM_PAGE_SIZE - 1));
+}
+
+static TierPath path(unsigned int pc, unsigned int opcode, unsigned int count) {
+	TierPath p = {pc, opcode, count};
+	return p;
+}
+
+/* Instructions blocks run, the others stay on the interpreter */
+static int compilable(const Chip8 *chip, unsigned int op) {
+	switch (op >> 12) {
+		case 0x0:
+			return op == 0x00EE || op == 0x00E0;
+		case 0x5: case 0x9:
+			return (op & 0xF) == 0;
+		case 0x8:
+			return (op & 0xF) <= 0x7 || (op & 0xF) == 0xE;
+		case 0xB:
+			return !(chip->variants & VARIANT_CHIP8X);
+		case 0xE:
+			return (op & 0xFF) == 0x9E || (op & 0xFF) == 0xA1;
+		case 0xF:
+			switch (op & 0xFF) {
+				case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x30:
+				case 0x33: case 0x55: case 0x65: case 0x75: case 0x85:
+					return 1;
+			}
+			return 0;
+	}
+	return 1;
+}
+
+/* Instructions after which a block starts: control flow, stores and what blocks do not run */
+static int endsBlock(const Chip8 *chip, unsigned int op) {
+	switch (op >> 12) {
+		case 0x0:
+			return op != 0x00E0;
+		case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB: case 0xE:
+			return 1;
+		case 0xF:
+			if ((op & 0xFF) == 0x33 || (op & 0xFF) == 0x55)
+				return 1;
+	}
+	return !compilable(chip, op);
+}
+
+static void emit(Compiler *c, unsigned int kind, unsigned int x, unsigned int y, unsigned int imm, unsigned int pos) {
+	TierOp *o = &c->block->ops[c->block->op_count++];
+	o->kind = kind;
+	o->x = x;
+	o->y = y;
+	o->imm = imm;
+	o->pos = pos;
+	o->condition = 0;
+	o->span = 0;
+	o->guarded = c->guard;
+}
+
+static void setConstant(Compiler *c, unsigned int x, unsigned int value, unsigned int pos) {
+	emit(c, OP_SET, x, 0, value & 0xFF, pos);
+	c->known |= 1 << x;
+	c->value[x] = value;
+}
+
+static inline int isKnown(const Compiler *c, unsigned int x) {
+	return (c->known >> x) & 1;
+}
+
+/* 8XYN on known registers, in the interpreter's order (VF may be X or Y) */
+static void foldArithmetic(unsigned char *V, unsigned int op, unsigned int quirks) {
+	unsigned int x = (op >> 8) & 0xF, y = (op >> 4) & 0xF;
+	switch (op & 0xF) {
+		case 0x0: V[x] = V[y]; break;
+		case 0x1: V[x] |= V[y]; break;
+		case 0x2: V[x] &= V[y]; break;
+		case 0x3: V[x] ^= V[y]; break;
+		case 0x4: V[0xF] = V[y] > 0xFF - V[x]; V[x] += V[y]; break;
+		case 0x5: V[0xF] = V[x] > V[y]; V[x] -= V[y]; break;
+		case 0x7: V[0xF] = V[y] > V[x]; V[x] = V[y] - V[x]; break;
+		case 0x6:
+		case 0xE:
+			if (quirks & QUIRK_SHIFT_VY)
+				V[x] = V[y];
+			V[0xF] = V[x] & 1;
+			if ((op & 0xF) == 0x6)
+				V[x] >>= 1;
+			else
+				V[x] <<= 1;
+			break;
+	}
+}
+
+static void arithmetic(Compiler *c, unsigned int quirks, unsigned int op, unsigned int pos) {
+	unsigned int x = (op >> 8) & 0xF, y = (op >> 4) & 0xF, n = op & 0xF, flag = n >= 0x4;
+	unsigned int shifted = (quirks & QUIRK_SHIFT_VY) ? y : x;
+	unsigned int needs = n == 0x0 ? 1u << y : (n == 0x6 || n == 0xE) ? 1u << shifted : (1u << x) | (1u << y);
+
+	if ((c->known & needs) == needs) {
+		unsigned char V[16];
+		memcpy(V, c->value, sizeof(V));
+		foldArithmetic(V, op, quirks);
+		if (flag)
+			setConstant(c, 0xF, V[0xF], pos);
+		setConstant(c, x, V[x], pos);
+		return;
+	}
+
+	/* VY known: an immediate operand, when VF is not one of them */
+	int immediate = isKnown(c, y) && x != y && x != 0xF && y != 0xF;
+	switch (n) {
+		case 0x0: emit(c, OP_MOV, x, y, 0, pos); break;
+		case 0x1: emit(c, immediate ? OP_OR_IMM : OP_OR, x, y, c->value[y], pos); break;
+		case 0x2: emit(c, immediate ? OP_AND_IMM : OP_AND, x, y, c->value[y], pos); break;
+		case 0x3: emit(c, immediate ? OP_XOR_IMM : OP_XOR, x, y, c->value[y], pos); break;
+		case 0x4: emit(c, immediate ? OP_ADD_IMM_F : OP_ADD, x, y, c->value[y], pos); break;
+		case 0x5: emit(c, immediate ? OP_SUB_IMM_F : OP_SUB, x, y, c->value[y], pos); break;
+		case 0x7: emit(c, OP_SUBN, x, y, 0, pos); break;
+		case 0x6: emit(c, OP_SHR, x, shifted, 0, pos); break;
+		case 0xE: emit(c, OP_SHL, x, shifted, 0, pos); break;
+	}
+	c->known &= ~((1u << x) | (flag ? 1u << 0xF : 0));
+}
+
+/* Straight-line instruction at addr and position pos, returns 1 when the block ends after it */
+static int translate(Compiler *c, unsigned int quirks, unsigned int op, unsigned int addr, unsigned int pos) {
+	unsigned int x = (op >> 8) & 0xF, nn = op & 0xFF, store_i = (quirks & QUIRK_LOAD_STORE_I) != 0;
+
+	switch (op >> 12) {
+		case 0x6:
+			setConstant(c, x, nn, pos);
+			break;
+		case 0x7:
+			if (isKnown(c, x)) {
+				setConstant(c, x, c->value[x] + nn, pos);
+			} else {
+				emit(c, OP_ADD_IMM, x, 0, nn, pos);
+			}
+			break;
+		case 0x8:
+			arithmetic(c, quirks, op, pos);
+			break;
+		case 0xA:
+			emit(c, OP_SET_I, 0, 0, op & 0xFFF, pos);
+			break;
+		case 0x0: /* 00E0 */
+			emit(c, OP_INTERPRET, 0, 0, addr, pos);
+			break;
+		case 0xD:
+			emit(c, OP_INTERPRET, 0, 0, addr, pos);
+			c->known &= ~(1u << 0xF);
+			break;
+		case 0xC:
+			emit(c, OP_RND, x, 0, nn, pos);
+			c->known &= ~(1u << x);
+			break;
+		case 0xF:
+			switch (nn) {
+				case 0x07:
+					emit(c, OP_GET_DT, x, 0, 0, pos);
+					c->known &= ~(1u << x);
+					break;
+				case 0x15: emit(c, OP_SET_DT, x, 0, 0, pos); break;
+				case 0x18: emit(c, OP_SET_ST, x, 0, 0, pos); break;
+				case 0x1E: emit(c, OP_ADD_I, x, 0, 0, pos); break;
+				case 0x29:
+					if (isKnown(c, x))
+						emit(c, OP_SET_I, 0, 0, (c->value[x] * 5) % 80, pos);
+					else
+						emit(c, OP_FONT, x, 0, 0, pos);
+					break;
+				case 0x30:
+					if (isKnown(c, x))
+						emit(c, OP_SET_I, 0, 0, BIG_FONT_ADDR + (c->value[x] & 0xF) * 10, pos);
+					else
+						emit(c, OP_BIG_FONT, x, 0, 0, pos);
+					break;
+				case 0x33:
+					emit(c, OP_BCD, x, 0, 0, pos);
+					return 1;
+				case 0x55:
+					emit(c, OP_STORE, x, store_i, 0, pos);
+					return 1;
+				case 0x65:
+					emit(c, OP_LOAD, x, store_i, 0, pos);
+					c->known &= ~((2u << x) - 1);
+					break;
+				case 0x75:
+					emit(c, OP_SAVE_FLAGS, x, 0, 0, pos);
+					break;
+				case 0x85:
+					emit(c, OP_LOAD_FLAGS, x, 0, 0, pos);
+					c->known &= ~((2u << x) - 1);
+					break;
+			}
+			break;
+	}
+	return 0;
+}
+
+/* What a skip compiles to */
+enum {
+	SKIP_END,	/* The conditional exit ending the block */
+	SKIP_NEVER, SKIP_ALWAYS,	/* Nothing, its operands being constants */
+	SKIP_SIDE_EXIT,	/* A side exit, the block going on with the next instruction */
+	SKIP_GUARD	/* An OP_SKIP over the next instruction, compiled next */
+};
+
+/* A skip at addr. A jump right after it is taken along, the pair being one branch that ends the block
+ * with a conditional exit; a straight-line instruction after it is guarded by an OP_SKIP, and the
+ * others leave the block by a side exit. Skips on constants are resolved */
+static int skipExit(Compiler *c, const Chip8 *chip, unsigned int op, unsigned int next, unsigned int addr, unsigned int pos) {
+	TierBlock *block = c->block;
+	unsigned int x = (op >> 8) & 0xF, y = (op >> 4) & 0xF, imm = op & 0xFF, equal = (op >> 12) == 0x3 || (op >> 12) == 0x5;
+	unsigned int condition = 0;
+	int resolved = -1;
+	/* Over the whole F000 NNNN for XO-CHIP, like the interpreter's skipTarget() */
+	TierPath taken = path((chip->variants & VARIANT_XOCHIP) && next == 0xF000 ? addr + 6 : addr + 4, op, pos + 1);
+
+	switch (op >> 12) {
+		case 0x3:
+		case 0x4:
+			condition = equal ? EXIT_EQ_IMM : EXIT_NE_IMM;
+			if (isKnown(c, x))
+				resolved = (c->value[x] == imm) == equal;
+			break;
+		case 0x5:
+		case 0x9:
+			if (isKnown(c, x) && isKnown(c, y)) {
+				resolved = (c->value[x] == c->value[y]) == equal;
+			} else if (isKnown(c, x) || isKnown(c, y)) {
+				condition = equal ? EXIT_EQ_IMM : EXIT_NE_IMM;
+				imm = c->value[isKnown(c, x) ? x : y];
+				x = isKnown(c, x) ? y : x;
+			} else {
+				condition = equal ? EXIT_EQ : EXIT_NE;
+			}
+			break;
+		case 0xE:
+			condition = imm == 0x9E ? EXIT_KEY : EXIT_NO_KEY;
+			break;
+	}
+
+	if ((next >> 12) == 0x1 && pos + 2 <= TIER_MAX_BLOCK) {
+		block->taken = taken;
+		block->fall = path(next & 0xFFF, next, pos + 2);
+		if (resolved == 1)
+			block->fall = taken;
+		block->exit = resolved >= 0 ? EXIT_FALL : condition;
+		block->ex = x;
+		block->ey = y;
+		block->eimm = imm;
+		return SKIP_END;
+	}
+	if (resolved == 1) {
+		block->fall = taken;
+		return SKIP_ALWAYS;
+	}
+	if (resolved == 0)
+		return SKIP_NEVER;
+	if (compilable(chip, next) && !endsBlock(chip, next) && pos + 2 <= TIER_MAX_BLOCK) {
+		emit(c, OP_SKIP, x, y, imm, pos);
+		block->ops[block->op_count - 1].condition = condition;
+		return SKIP_GUARD;
+	}
+	emit(c, OP_SIDE_EXIT, x, y, imm, pos);
+	block->ops[block->op_count - 1].condition = condition;
+	block->sides[pos] = taken;
+	return SKIP_SIDE_EXIT;
+}
+
+/* Registers an operation writes and reads, as LIVE_* bits, returns 1 if it has other effects */
+static int operands(const TierOp *o, unsigned int *def, unsigned int *use) {
+	unsigned int x = 1u << o->x, y = 1u << o->y, f = 1u << 0xF, range = (2u << o->x) - 1;
+	*def = 0;
+	*use = 0;
+	switch (o->kind) {
+		case OP_SET: *def = x; break;
+		case OP_ADD_IMM: case OP_OR_IMM: case OP_AND_IMM: case OP_XOR_IMM: *def = x; *use = x; break;
+		case OP_MOV: *def = x; *use = y; break;
+		case OP_OR: case OP_AND: case OP_XOR: case OP_ADD_NF: case OP_SUB_NF: case OP_SUBN_NF: *def = x; *use = x | y; break;
+		case OP_ADD: case OP_SUB: case OP_SUBN: *def = x | f; *use = x | y; break;
+		case OP_ADD_IMM_F: case OP_SUB_IMM_F: *def = x | f; *use = x; break;
+		case OP_SHR: case OP_SHL: *def = x | f; *use = y; break;
+		case OP_SHR_NF: case OP_SHL_NF: *def = x; *use = y; break;
+		case OP_SET_I: *def = LIVE_I; break;
+		case OP_ADD_I: *def = LIVE_I; *use = LIVE_I | x; break;
+		case OP_FONT: case OP_BIG_FONT: *def = LIVE_I; *use = x; break;
+		case OP_GET_DT: *def = x; break;
+		case OP_LOAD: *def = range | (o->y ? LIVE_I : 0); *use = LIVE_I; break;
+		case OP_LOAD_FLAGS: *def = range; break;
+		case OP_RND: *def = x; return 1;
+		case OP_SET_DT: case OP_SET_ST: *use = x; return 1;
+		case OP_STORE: *def = o->y ? LIVE_I : 0; *use = range | LIVE_I; return 1;
+		case OP_BCD: *use = x | LIVE_I; return 1;
+		case OP_SAVE_FLAGS: *use = range; return 1;
+		case OP_SKIP:
+			*use = x | (o->condition == EXIT_EQ || o->condition == EXIT_NE ? y : 0);
+			return 1;
+		case OP_SIDE_EXIT: case OP_INTERPRET: *use = LIVE_ALL; return 1;
+	}
+	return 0;
+}
+
+/* Backwards over the block, everything being live at its exits: writes nobody reads are dropped, and
+ * so are the VF flags of the arithmetic when VF is written again before it is read. Guarded writes
+ * may not happen and do not hide the ones before them. Then the skips' spans are counted */
+static void eliminateDeadStores(TierBlock *block) {
+	unsigned int live = LIVE_ALL, def, use, i, kept = 0;
+	TierOp *o;
+
+	for (i = block->op_count; i-- > 0;) {
+		o = &block->ops[i];
+		int effects = operands(o, &def, &use);
+		if (!effects && !(def & live)) {
+			o->kind = OP_NONE;
+			continue;
+		}
+		if (!(live & (1u << 0xF)) && o->x != 0xF && o->y != 0xF) {
+			switch (o->kind) {
+				case OP_ADD: o->kind = OP_ADD_NF; break;
+				case OP_SUB: o->kind = OP_SUB_NF; break;
+				case OP_SUBN: o->kind = OP_SUBN_NF; break;
+				case OP_SHR: o->kind = OP_SHR_NF; break;
+				case OP_SHL: o->kind = OP_SHL_NF; break;
+				case OP_ADD_IMM_F: o->kind = OP_ADD_IMM; break;
+				case OP_SUB_IMM_F: o->kind = OP_ADD_IMM; o->imm = (0x100 - o->imm) & 0xFF; break;
+			}
+			operands(o, &def, &use);
+		}
+		live = (live & (o->guarded ? ~0u : ~def)) | use;
+	}
+	for (i = 0; i < block->op_count; i++) {
+		if (block->ops[i].kind != OP_NONE)
+			block->ops[kept++] = block->ops[i];
+	}
+	block->op_count = kept;
+	for (i = 0; i < block->op_count; i++) {
+		o = &block->ops[i];
+		if (o->kind == OP_SKIP) {
+			while (i + 1 + o->span < block->op_count && block->ops[i + 1 + o->span].guarded &&
+					block->ops[i + 1 + o->span].pos == o->pos + 1)
+				o->span++;
+		}
+	}
+}
+
+/* Compiles the block at start, up to the end of its memory page */
+static TierBlock *compileBlock(const Chip8 *chip, unsigned int start) {
+	TierBlock *block = calloc(1, sizeof(TierBlock));
+	Compiler c = {block, 0, {0}, 0};
+	const unsigned char *code = codeAt(chip, start);
+	unsigned int end = (start | (MEM_PAGE_SIZE - 1)) + 1, addr = start, pos = 0, op, next, r;
+	unsigned int known, guard_count = 0, guard_skip = 0;
+	unsigned char value[16];
+
+	block->start = start;
+	block->quirks = chip->quirks;
+	block->variants = chip->variants;
+	block->exit = EXIT_FALL;
+	block->fall = path(start, 0, 0);
+	while (pos < TIER_MAX_BLOCK && addr + 2 <= end) {
+		op = code[addr - start] << 8 | code[addr - start + 1];
+		if (!compilable(chip, op))
+			break;
+		switch (op >> 12) {
+			case 0x1:
+				block->fall = path(op & 0xFFF, op, pos + 1);
+				addr += 2;
+				goto done;
+			case 0x2:
+				block->exit = EXIT_CALL;
+				block->eimm = addr;
+				block->fall = path(op & 0xFFF, op, pos + 1);
+				block->taken = path(addr + 2, op, pos + 1);
+				addr += 2;
+				goto done;
+			case 0xB:
+				block->exit = EXIT_JUMP_V;
+				block->ex = (chip->quirks & QUIRK_JUMP_VX) ? (op >> 8) & 0xF : 0;
+				block->eimm = op & 0xFFF;
+				block->fall = path(0, op, pos + 1);
+				addr += 2;
+				goto done;
+			case 0x3: case 0x4: case 0x5: case 0x9: case 0xE:
+				if (addr + 4 > end)
+					goto done;	/* The word it skips is on the next page */
+				next = code[addr + 2 - start] << 8 | code[addr + 3 - start];
+				switch (skipExit(&c, chip, op, next, addr, pos)) {
+					case SKIP_END:
+						addr += 4;
+						goto done;
+					case SKIP_ALWAYS:
+						addr += 4;
+						if (block->fall.pc > end)
+							goto done;	/* Over F000 NNNN, to the next page */
+						addr = block->fall.pc;
+						pos++;
+						break;
+					case SKIP_GUARD: /* Registers the next instruction may set are unknown after it */
+						known = c.known;
+						memcpy(value, c.value, sizeof(value));
+						c.guard = 1;
+						translate(&c, chip->quirks, next, addr + 2, pos + 1);
+						c.guard = 0;
+						for (r = 0; r < 16; r++) {
+							if (!((known >> r) & 1) || value[r] != c.value[r])
+								c.known &= ~(1u << r);
+						}
+						addr += 4;
+						pos += 2;
+						block->fall = path(addr, next, pos);
+						guard_count = pos;
+						guard_skip = op;
+						break;
+					default:
+						addr += 2;
+						pos++;
+						block->fall = path(addr, op, pos);
+				}
+				break;
+			case 0x0:
+				if (op == 0x00EE) {
+					block->exit = EXIT_RET;
+					block->eimm = addr;
+					block->fall = path(addr + 2, op, pos + 1);
+					addr += 2;
+					goto done;
+				}
+				/* falls through - 00E0 is straight-line code */
+			default: {
+				int ends = translate(&c, chip->quirks, op, addr, pos);
+				addr += 2;
+				pos++;
+				block->fall = path(addr, op, pos);
+				if (ends)
+					goto done;
+			}
+		}
+	}
+done:
+	if (block->exit == EXIT_FALL && block->fall.count == guard_count)
+		block->tail_skip = guard_skip;
+	block->length = block->exit == EXIT_FALL || block->fall.count > block->taken.count ? block->fall.count : block->taken.count;
+	block->code_len = block->length > 0 ? addr - start : (end - start < 2 ? end - start : 2);
+	memcpy(block->code, code, block->code_len);
+	block->mem_hash = chip->mem_hash;
+	eliminateDeadStores(block);
+	return block;
+}
+
+/* Skip condition of an exit on VX and VY or imm */
+static inline int holds(const Chip8 *chip, unsigned int condition, unsigned int x, unsigned int y, unsigned int imm) {
+	switch (condition) {
+		case EXIT_EQ_IMM: return chip->V[x] == imm;
+		case EXIT_NE_IMM: return chip->V[x] != imm;
+		case EXIT_EQ: return chip->V[x] == chip->V[y];
+		case EXIT_NE: return chip->V[x] != chip->V[y];
+		case EXIT_KEY: return chip->keypad[chip->V[x] & 0xF] == 1;
+		case EXIT_NO_KEY: return chip->keypad[chip->V[x] & 0xF] == 0;
+	}
+	return 0;
+}
+
+/* The timers tick after every instruction: value at instruction at (a position less the instructions
+ * skipped) of one set at instruction mark */
+#define TIMER(t, at) ((t) > (at) - mark ? (t) - ((at) - mark) : 0)
+
+static unsigned int runBlock(Chip8 *chip, const TierBlock *block) {
+	unsigned char *V = chip->V;
+	unsigned int I = chip->index_reg, dt = chip->delay_timer, st = chip->sound_timer, mark = 0, i, pc;
+	unsigned int skipped = 0, skip_end = 0;	/* Instructions skipped, and where the last skipped one ends */
+	const TierPath *exit = &block->fall;
+	const TierOp *o, *end = block->ops + block->op_count;
+
+	for (o = block->ops; o < end; o++) {
+		switch (o->kind) {
+			case OP_SET: V[o->x] = o->imm; break;
+			case OP_ADD_IMM: V[o->x] += o->imm; break;
+			case OP_MOV: V[o->x] = V[o->y]; break;
+			case OP_OR: V[o->x] |= V[o->y]; break;
+			case OP_AND: V[o->x] &= V[o->y]; break;
+			case OP_XOR: V[o->x] ^= V[o->y]; break;
+			case OP_OR_IMM: V[o->x] |= o->imm; break;
+			case OP_AND_IMM: V[o->x] &= o->imm; break;
+			case OP_XOR_IMM: V[o->x] ^= o->imm; break;
+			case OP_ADD: V[0xF] = V[o->y] > 0xFF - V[o->x]; V[o->x] += V[o->y]; break;
+			case OP_ADD_NF: V[o->x] += V[o->y]; break;
+			case OP_ADD_IMM_F: V[0xF] = o->imm > 0xFF - V[o->x]; V[o->x] += o->imm; break;
+			case OP_SUB: V[0xF] = V[o->x] > V[o->y]; V[o->x] -= V[o->y]; break;
+			case OP_SUB_NF: V[o->x] -= V[o->y]; break;
+			case OP_SUB_IMM_F: V[0xF] = V[o->x] > o->imm; V[o->x] -= o->imm; break;
+			case OP_SUBN: V[0xF] = V[o->y] > V[o->x]; V[o->x] = V[o->y] - V[o->x]; break;
+			case OP_SUBN_NF: V[o->x] = V[o->y] - V[o->x]; break;
+			case OP_SHR: V[o->x] = V[o->y]; V[0xF] = V[o->x] & 1; V[o->x] >>= 1; break;
+			case OP_SHR_NF: V[o->x] = V[o->y] >> 1; break;
+			case OP_SHL: V[o->x] = V[o->y]; V[0xF] = V[o->x] & 1; V[o->x] <<= 1; break;
+			case OP_SHL_NF: V[o->x] = V[o->y] << 1; break;
+			case OP_SET_I: I = o->imm; break;
+			case OP_ADD_I: I = (I + V[o->x]) & indexMask(chip); break;
+			case OP_FONT: I = (V[o->x] * 5) % 80; break;
+			case OP_BIG_FONT: I = BIG_FONT_ADDR + (V[o->x] & 0xF) * 10; break;
+			case OP_RND:
+				chip->rng ^= chip->rng << 13;
+				chip->rng ^= chip->rng >> 17;
+				chip->rng ^= chip->rng << 5;
+				V[o->x] = chip->rng & o->imm;
+				break;
+			case OP_GET_DT: V[o->x] = TIMER(dt, o->pos - skipped); break;
+			case OP_SET_DT: st = TIMER(st, o->pos - skipped); dt = V[o->x]; mark = o->pos - skipped; break;
+			case OP_SET_ST: dt = TIMER(dt, o->pos - skipped); st = V[o->x]; mark = o->pos - skipped; break;
+			case OP_LOAD:
+				for (i = 0; i <= o->x; i++)
+					V[i] = memRead(chip, I + i);
+				if (o->y)
+					I = (I + o->x + 1) & indexMask(chip);
+				break;
+			case OP_STORE:
+				for (i = 0; i <= o->x; i++)
+					memWrite(chip, I + i, V[i]);
+				if (o->y)
+					I = (I + o->x + 1) & indexMask(chip);
+				break;
+			case OP_BCD:
+				memWrite(chip, I, V[o->x] / 100);
+				memWrite(chip, I + 1, (V[o->x] / 10) % 10);
+				memWrite(chip, I + 2, V[o->x] % 10);
+				break;
+			case OP_SAVE_FLAGS: memcpy(chip->rpl, V, o->x + 1); break;
+			case OP_LOAD_FLAGS: memcpy(V, chip->rpl, o->x + 1); break;
+			case OP_INTERPRET: /* At its address, with the state it sees synchronized */
+				chip->index_reg = I;
+				chip->delay_timer = TIMER(dt, o->pos - skipped);
+				chip->sound_timer = TIMER(st, o->pos - skipped);
+				chip->pc = o->imm;
+				chip8_interpreters[block->quirks & (QUIRK_COMBINATIONS - 1)](chip, 1);
+				I = chip->index_reg;
+				dt = chip->delay_timer;
+				st = chip->sound_timer;
+				mark = o->pos + 1 - skipped;
+				break;
+			case OP_SKIP:
+				if (holds(chip, o->condition, o->x, o->y, o->imm)) {
+					skipped++;
+					skip_end = o->pos + 2;
+					o += o->span;
+				}
+				break;
+			case OP_SIDE_EXIT:
+				if (holds(chip, o->condition, o->x, o->y, o->imm)) {
+					exit = &block->sides[o->pos];
+					pc = exit->pc;
+					goto leave;
+				}
+				break;
+		}
+	}
+
+	switch (block->exit) {
+		case EXIT_CALL: /* Like the interpreter, which reports it */
+			if (chip->sp >= 16) {
+				printf("Stack overflow!\n");
+				exit = &block->taken;
+			} else {
+				chip->stack[chip->sp++] = block->eimm;
+			}
+			break;
+		default:
+			if (holds(chip, block->exit, block->ex, block->ey, block->eimm))
+				exit = &block->taken;
+	}
+	pc = exit->pc;
+	if (block->exit == EXIT_RET) {
+		if (chip->sp == 0)
+			printf("Stack is empty!\n");
+		else
+			pc = (unsigned short)(chip->stack[--chip->sp] + 2);
+	} else if (block->exit == EXIT_JUMP_V) {
+		pc = V[block->ex] + block->eimm;
+	}
+
+leave:
+	chip->pc = pc;
+	chip->opcode = exit == &block->fall && block->tail_skip && skip_end == exit->count ? block->tail_skip : exit->opcode;
+	chip->index_reg = I;
+	chip->delay_timer = TIMER(dt, exit->count - skipped);
+	chip->sound_timer = TIMER(st, exit->count - skipped);
+	return exit->count - skipped;
+}
+
+/* Compiled block at pc if it is hot, counting the entry otherwise. A block compiled from other code
+ * (changed since, or another program's) is dropped and counted again; the code is only compared
+ * when memory changed since it last was */
+static TierBlock *lookup(Tier *t, const Chip8 *chip, unsigned int pc) {
+	unsigned int slot = pc & (TIER_SLOTS - 1);
+	TierBlock *block = t->blocks[slot];
+
+	if (block != NULL) {
+		if (block->start == pc && block->quirks == chip->quirks && block->variants == chip->variants) {
+			if (block->mem_hash == chip->mem_hash)
+				return block;
+			if (memcmp(codeAt(chip, pc), block->code, block->code_len) == 0) {
+				block->mem_hash = chip->mem_hash;
+				return block;
+			}
+		}
+		free(block);
+		t->blocks[slot] = NULL;
+		t->counters[slot] = 0;
+	}
+	if (++t->counters[slot] < TIER_THRESHOLD)
+		return NULL;
+	t->blocks[slot] = compileBlock(chip, pc);
+	return t->blocks[slot];
+}
+
+/* A block doing nothing but jumping back to itself (the usual end of a program, or 1NNN to itself
+ * while a sound plays) only moves the timers: its remaining runs in the frame are skipped at once */
+static unsigned int spin(Chip8 *chip, const TierBlock *block, unsigned int cycles) {
+	unsigned int count = cycles - cycles % block->length;
+
+	chip->delay_timer = chip->delay_timer > count ? chip->delay_timer - count : 0;
+	chip->sound_timer = chip->sound_timer > count ? chip->sound_timer - count : 0;
+	chip->pc = block->fall.pc;
+	chip->opcode = block->fall.opcode;
+	return count;
+}
+
+void tieredFrame(Chip8 *chip, unsigned int cycles) {
+	FrameFunction interpret = chip8_interpreters[chip->quirks & (QUIRK_COMBINATIONS - 1)];
+	unsigned int pc;
+	int entry = 1;
+
+	if (chip->debug) { /* Blocks do not trace */
+		interpret(chip, cycles);
+		return;
+	}
+	if (tier == NULL)
+		tier = calloc(1, sizeof(Tier));
+	while (cycles > 0) {
+		pc = chip->pc & chip->mem_mask;
+		if (entry) {
+			TierBlock *block = lookup(tier, chip, pc);
+			if (block != NULL && block->length > 0 && block->length <= cycles) {
+				if (block->op_count == 0 && block->exit == EXIT_FALL && block->fall.pc == pc)
+					cycles -= spin(chip, block, cycles);
+				else
+					cycles -= runBlock(chip, block);
+				continue;
+			}
+		}
+		interpret(chip, 1);
+		cycles--;
+		if ((chip->pc & chip->mem_mask) == pc) { /* Waiting in place (FX0A, 00FD): the interpreter's */
+			interpret(chip, cycles);
+			return;
+		}
+		entry = chip->pc != pc + 2 || endsBlock(chip, chip->opcode);
+	}
+}
+
+void tierFlush(void) {
+	unsigned int i;
+	if (tier == NULL)
+		return;
+	for (i = 0; i < TIER_SLOTS; i++)
+		free(tier->blocks[i]);
+	free(tier);
+	tier = NULL;
+}
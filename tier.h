@@ -0,0 +1,31 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include "chip8.h"
+
+/* Tiered execution: cold code runs on the specialized interpreter (chip8_interpreters) while the
+ * entries of each block are counted, and blocks entered TIER_THRESHOLD times are compiled into
+ * pre-decoded operations, optimized over the whole block:
+ *
+ *   - constant propagation: registers set by 6XNN (or computed from constants) are folded into the
+ *     instructions using them, an 8XY4 on a constant VY becoming an add immediate
+ *   - dead stores: writes overwritten within the block are dropped, VF flags of 8XY4/8XY5 chains
+ *     included, which leaves the plain arithmetic
+ *   - fused compare-and-skip: a skip over a jump (3XNN 1NNN) is one conditional exit ending the
+ *     block, a skip over a straight-line instruction a guard jumping over its operations, other
+ *     skips side exits; skips on constants are resolved
+ *
+ * Blocks run whole or not at all: the interpreter takes over when a frame has no room left for the
+ * next one, so the state between two frames is exactly the interpreter's. Drawing runs inside blocks
+ * on the interpreter; calls to machine code, key waits and the variants' instructions end them. A
+ * block jumping to itself and doing nothing else skips to the end of the frame. The compiled blocks
+ * of a thread are kept with a copy of their code, compared on entry once memory changed: code
+ * changed by the program is compiled again */
+
+#define TIER_THRESHOLD 64	/* Entries of a block before it is compiled */
+#define TIER_MAX_BLOCK 32	/* Instructions per block */
+
+void tieredFrame(Chip8 *chip, unsigned int cycles);	/* emulateFrame() with the hot blocks compiled */
+void tierFlush(void);		/* Drops the calling thread's compiled blocks and counters */
+
+#endif